@@ -98,6 +98,7 @@ symbol_t* symbol_new(compiler_t* compiler, ast_t* node, int address, datatype_t*
     symbol->isClassParam = false;
     symbol->owner = 0;
     symbol->arraySize = -1;
+    symbol->alias = false;
     return symbol;
 }
 
@@ -182,6 +183,23 @@ bool symbol_exists(compiler_t* compiler, ast_t* node, char* ident) {
     return false;
 }
 
+/**
+ * subscript_op:
+ * Selects the string variant of a subscript opcode,
+ * if the container type is a string (char[]).
+ */
+opcode_t subscript_op(datatype_t* dt, opcode_t op) {
+    if(!datatype_is_string(dt)) return op;
+    switch(op) {
+        case OP_GETSUB: return OP_SGETSUB;
+        case OP_SETSUB: return OP_SSETSUB;
+        case OP_LEN: return OP_SLEN;
+        case OP_APPEND: return OP_SAPPEND;
+        case OP_CONS: return OP_SCONS;
+        default: return op;
+    }
+}
+
 /**
  * symbol_replace:
  * Used to emit a replacement operation for a given symbol (store).
@@ -198,10 +216,36 @@ void symbol_replace(compiler_t* compiler, symbol_t* symbol) {
     }
     // Up!
     else {
-        emit_store_upval(compiler->buffer, depth, symbol->address);
+        emit_store_upval(compiler->buffer, compiler->depth - depth, symbol->address);
     }
 }
 
+/**
+ * symbol_local:
+ * Returns the symbol of a variable that lives in a plain stack slot
+ * (a local of the current function or a global), otherwise NULL.
+ */
+symbol_t* symbol_local(compiler_t* compiler, ast_t* node) {
+    if(node->class != AST_IDENT) return 0;
+
+    int depth = 0;
+    symbol_t* symbol = symbol_get_recursive(compiler->scope, node->ident, &depth);
+    if(!symbol || symbol->node->class != AST_DECLVAR || symbol->owner) return 0;
+    if(depth != 0 && !symbol->global) return 0;
+    return symbol;
+}
+
+/**
+ * symbol_slot:
+ * Returns the symbol of an integer variable in a plain stack slot, otherwise NULL.
+ * Those can be accessed by the local slot operations (incl, addl, jixxlk).
+ */
+symbol_t* symbol_slot(compiler_t* compiler, ast_t* node) {
+    symbol_t* symbol = symbol_local(compiler, node);
+    if(!symbol || !symbol->type || symbol->type->type != DATA_INT) return 0;
+    return symbol;
+}
+
 /**
  * eval_block:
  * Evaluate a list of abstract syntax trees.
@@ -215,8 +259,10 @@ datatype_t* eval_block(compiler_t* compiler, list_t* block) {
     size_t space = 0;
     while(!list_iterator_end(iter)) {
         ast_t* node = list_iterator_next(iter);
-        if(node->class == AST_DECLVAR) {
+        if(node->class == AST_DECLVAR || node->class == AST_TRY) {
             space++;
+        } else if(node->class == AST_FOR) {
+            space += node->forstmt.to ? 2 : 3;
         }
     }
     if(space > 0) emit_reserve(compiler->buffer, space);
@@ -232,13 +278,46 @@ datatype_t* eval_block(compiler_t* compiler, list_t* block) {
     // Free the allocated space
     if(space > 0) {
         instruction_t* instr = vector_top(compiler->buffer);
-        if(instr->op != OP_RET && instr->op != OP_RETVIRTUAL) {
+        if(instr->op != OP_RET && instr->op != OP_RETVIRTUAL && instr->op != OP_RETVOID && instr->op != OP_TAILCALL) {
             emit_reserve(compiler->buffer, -space);
         }
     }
     return ret;
 }
 
+// Checks if a function body declares functions or classes,
+// which may access its variables as upvalues
+bool has_nested_funcs(list_t* body) {
+    bool found = false;
+    list_iterator_t* iter = list_iterator_create(body);
+    while(!list_iterator_end(iter) && !found) {
+        ast_t* sub = list_iterator_next(iter);
+        switch(sub->class) {
+            case AST_DECLFUNC:
+            case AST_CLASS: found = true; break;
+            case AST_WHILE: found = has_nested_funcs(sub->whilestmt.body); break;
+            case AST_FOR: found = has_nested_funcs(sub->forstmt.body); break;
+            case AST_TRY: {
+                found = has_nested_funcs(sub->trystmt.body) || has_nested_funcs(sub->trystmt.handler);
+                break;
+            }
+            case AST_BLOCK: found = has_nested_funcs(sub->block); break;
+            case AST_IF: {
+                list_iterator_t* clauses = list_iterator_create(sub->ifstmt);
+                while(!list_iterator_end(clauses) && !found) {
+                    ast_t* clause = list_iterator_next(clauses);
+                    found = has_nested_funcs(clause->ifclause.body);
+                }
+                list_iterator_free(clauses);
+                break;
+            }
+            default: break;
+        }
+    }
+    list_iterator_free(iter);
+    return found;
+}
+
 datatype_t* eval_func_body(compiler_t* compiler, ast_t* node) {
     // Add a jump, set the position at the end
     val_t* addr = emit_jmp(compiler->buffer, 0);
@@ -247,7 +326,7 @@ datatype_t* eval_func_body(compiler_t* compiler, ast_t* node) {
     // Treat each parameter as a local variable, with no type or value
     push_scope(compiler, node);
     list_iterator_t* iter = list_iterator_create(node->funcdecl.impl.formals);
-    int i = -(list_size(node->funcdecl.impl.formals) + 3);
+    int i = -list_size(node->funcdecl.impl.formals);
     while(!list_iterator_end(iter)) {
         // Create parameter in symbols list
         ast_t* param = list_iterator_next(iter);
@@ -258,6 +337,16 @@ datatype_t* eval_func_body(compiler_t* compiler, ast_t* node) {
         i++;
     }
 
+    // The frame becomes the display entry of this level,
+    // nested functions find the upvalues through it
+    if(has_nested_funcs(node->funcdecl.impl.body)) {
+        if(compiler->depth >= DISPLAY_SIZE) {
+            compiler_throw(compiler, node, "Functions are nested too deeply");
+            return context_null(compiler->context);
+        }
+        emit_enter(compiler->buffer, compiler->depth);
+    }
+
     // Body analysis
     list_iterator_reset(iter, node->funcdecl.impl.body);
     bool hasReturn = false;
@@ -282,21 +371,17 @@ datatype_t* eval_func_body(compiler_t* compiler, ast_t* node) {
 
     list_iterator_free(iter);
 
-    // Compile and end
+    // Compile and end, try blocks around the declaration do not guard the body
+    int guarded = compiler->guarded;
+    compiler->guarded = 0;
     eval_block(compiler, node->funcdecl.impl.body);
+    compiler->guarded = guarded;
     pop_scope(compiler);
 
-    // Handle void return
+    // Handle void return, nothing is returned
+    // (a method leaves its class in place, see retvoid)
     if(node->funcdecl.rettype->type == DATA_VOID) {
-        // Just return 0 if void
-        // (as needed by retvirtual / return)
-        emit_int(compiler->buffer, 0);
-        ast_t* refNode = 0;
-        if(scope_is_class(compiler->scope, AST_CLASS, &refNode)) {
-            emit_op(compiler->buffer, OP_RETVIRTUAL);
-        } else {
-            emit_return(compiler->buffer);
-        }
+        emit_op(compiler->buffer, OP_RETVOID);
     } else {
         if(!hasReturn) {
             compiler_throw(compiler, node, "Warning: Function without return statement");
@@ -450,6 +535,38 @@ datatype_t* eval_bool(compiler_t* compiler, ast_t* node) {
     return context_get(compiler->context, "bool");
 }
 
+/**
+ * eval_slot_update:
+ * Compiles counter updates of integer variables to local slot operations.
+ * x := x + k and x := x - k emit incl / ginc, x := x + y emits addl (locals only).
+ * Returns true if the assignment was emitted.
+ */
+bool eval_slot_update(compiler_t* compiler, symbol_t* symbol, ast_t* lhs, ast_t* rhs) {
+    if(rhs->class != AST_BINARY) return false;
+    token_type_t op = rhs->binary.op;
+    ast_t* left = rhs->binary.left;
+    ast_t* right = rhs->binary.right;
+
+    if(op != TOKEN_ADD && op != TOKEN_SUB) return false;
+    if(symbol_slot(compiler, lhs) != symbol) return false;
+    if(left->class != AST_IDENT || strcmp(left->ident, lhs->ident) != 0) return false;
+
+    if(right->class == AST_INT) {
+        int k = (op == TOKEN_ADD) ? right->i : -right->i;
+        emit_inc(compiler->buffer, symbol->address, k, symbol->global);
+        return true;
+    }
+
+    symbol_t* other = symbol_slot(compiler, right);
+    if(op == TOKEN_ADD && other && !symbol->global && !other->global) {
+        emit_add_local(compiler->buffer, symbol->address, other->address);
+        return true;
+    }
+    return false;
+}
+
+datatype_t* eval_logical(compiler_t* compiler, ast_t* node);
+
 // Eval.binary(node)
 // This function evaluates a binary node.
 // A binary node consists of two seperate nodes
@@ -562,6 +679,11 @@ datatype_t* eval_binary(compiler_t* compiler, ast_t* node) {
         return compiler_eval(compiler, lhs);
     }
 
+    // && and || skip the right side (see eval_condition)
+    if(op == TOKEN_AND || op == TOKEN_OR) {
+        return eval_logical(compiler, node);
+    }
+
     // Assignment operator: special case
     if(op == TOKEN_ASSIGN) {
         if(lhs->class == AST_IDENT) {
@@ -573,14 +695,9 @@ datatype_t* eval_binary(compiler_t* compiler, ast_t* node) {
                         return context_null(compiler->context);
                     }
 
-                    if(symbol->owner) {
-                        // ldarg0
-                        // <...>
-                        // setfield
-                        // setarg0
-
-                        // Access class field, load class first
-                        emit_op(compiler->buffer, OP_LDARG0);
+                    // Counter updates, e.g. i := i + 1
+                    if(eval_slot_update(compiler, symbol, lhs, rhs)) {
+                        return context_null(compiler->context);
                     }
 
                     datatype_t* dt = compiler_eval(compiler, rhs);
@@ -598,8 +715,8 @@ datatype_t* eval_binary(compiler_t* compiler, ast_t* node) {
                             return context_null(compiler->context);
                         }
 
-                        emit_class_setfield(compiler->buffer, symbol->address);
-                        emit_op(compiler->buffer, OP_SETARG0);
+                        // The field of the receiver is changed in place
+                        emit_class_stfield(compiler->buffer, symbol->address);
                         return context_null(compiler->context);
                     }
 
@@ -643,11 +760,6 @@ datatype_t* eval_binary(compiler_t* compiler, ast_t* node) {
                             // let var = "Hello World"
                             // var[0] = "B"
 
-                            // If it is a class, reload for modifying
-                            if(symbol->owner) {
-                                emit_op(compiler->buffer, OP_LDARG0);
-                            }
-
                             // If we found a subscript, it has to be an array
                             // Evaluate the rhs and lhs
                             datatype_t* rhsType = compiler_eval(compiler, rhs);
@@ -667,7 +779,7 @@ datatype_t* eval_binary(compiler_t* compiler, ast_t* node) {
                             // lhs -> vardecl / namespace varaible declaration
 
                             compiler_eval(compiler, key);
-                            emit_op(compiler->buffer, OP_SETSUB);
+                            emit_op(compiler->buffer, subscript_op(lhsType, OP_SETSUB));
                             //emit_store(compiler->buffer, symbol->address, symbol->global);
 
                             // If it is a class field, we have to reassign it to the actual field / class
@@ -680,8 +792,7 @@ datatype_t* eval_binary(compiler_t* compiler, ast_t* node) {
                                     return context_null(compiler->context);
                                 }
 
-                                emit_class_setfield(compiler->buffer, symbol->address);
-                                emit_op(compiler->buffer, OP_SETARG0);
+                                emit_class_stfield(compiler->buffer, symbol->address);
                             } else {
                                 symbol_replace(compiler, symbol);
                             }
@@ -727,9 +838,7 @@ datatype_t* eval_binary(compiler_t* compiler, ast_t* node) {
             case TOKEN_LESS:
             case TOKEN_GREATER:
             case TOKEN_LEQUAL:
-            case TOKEN_GEQUAL:
-            case TOKEN_AND:
-            case TOKEN_OR: return context_get(compiler->context, "bool");
+            case TOKEN_GEQUAL: return context_get(compiler->context, "bool");
             default: {
                 return lhs_type;
             }
@@ -783,7 +892,7 @@ datatype_t* eval_ident(compiler_t* compiler, ast_t* node) {
             if(depth == 0 || ptr->global) {
                 emit_load(compiler->buffer, ptr->address, ptr->global);
             } else {
-                emit_load_upval(compiler->buffer, depth, ptr->address);
+                emit_load_upval(compiler->buffer, compiler->depth - depth, ptr->address);
             }
         }
         return ptr->type;
@@ -793,6 +902,14 @@ datatype_t* eval_ident(compiler_t* compiler, ast_t* node) {
     return context_null(compiler->context);
 }
 
+// Remembers the invocation just emitted, it may become a tail call (see eval_return).
+// Nested functions are never called this way: their upvalues are
+// in the frame of the enclosing function, which may be the replaced one.
+void mark_tailcall(compiler_t* compiler, bool virtual) {
+    compiler->tailcall = vector_size(compiler->buffer) - 1;
+    compiler->tailvirtual = virtual;
+}
+
 /**
  * eval_compare_and_call:
  * @param func Function declaration node
@@ -855,24 +972,20 @@ bool eval_compare_and_call(compiler_t* compiler, ast_t* func, ast_t* node, int a
         list_iterator_free(iter);
     }
 
-    // Emit invocation
+    // Emit invocation, void functions push no result
+    int flags = 0;
+    if(func->class == AST_DECLFUNC && func->funcdecl.rettype->type == DATA_VOID) {
+        flags = CALL_VOID;
+    }
     if(external) {
-        emit_syscall(compiler->buffer, func->funcdecl.external-1);
+        emit_syscall(compiler->buffer, func->funcdecl.external-1, argc | flags);
     } else {
-        emit_invoke(compiler->buffer, address, argc);
+        emit_invoke(compiler->buffer, address, argc | flags);
     }
 
     return true;
 }
 
-// Call this after eval_compare_and_call to remove unneeded NULL values.
-datatype_t* finish_call(compiler_t* compiler, datatype_t* rettype) {
-    if(datatype_match(rettype, context_void(compiler->context))) {
-        emit_pop(compiler->buffer);
-    }
-    return rettype;
-}
-
 datatype_t* eval_bool_func(compiler_t* compiler, ast_t* node, datatype_t* dt) {
     ast_t* call = node->call.callee;
     ast_t* key = call->subscript.key;
@@ -969,13 +1082,13 @@ datatype_t* eval_array_func(compiler_t* compiler, ast_t* node, datatype_t* dt) {
         ASSERT_ZERO_ARGS()
 
         // Length operation
-        emit_op(compiler->buffer, OP_LEN);
+        emit_op(compiler->buffer, subscript_op(dt, OP_LEN));
         return context_get(compiler->context, "int");
     } else if(!strcmp(key->ident, "empty")) {
         ASSERT_ZERO_ARGS()
 
         // empty? = (len <= 0)
-        emit_op(compiler->buffer, OP_LEN);
+        emit_op(compiler->buffer, subscript_op(dt, OP_LEN));
         emit_int(compiler->buffer, 0);
         emit_op(compiler->buffer, OP_ILE);
         return context_get(compiler->context, "bool");
@@ -992,7 +1105,7 @@ datatype_t* eval_array_func(compiler_t* compiler, ast_t* node, datatype_t* dt) {
             return context_null(compiler->context);
         }
 
-        emit_op(compiler->buffer, OP_APPEND);
+        emit_op(compiler->buffer, subscript_op(dt, OP_APPEND));
         return dt;
     } else if(!strcmp(key->ident, "add")) {
         if(ls != 1) {
@@ -1007,7 +1120,7 @@ datatype_t* eval_array_func(compiler_t* compiler, ast_t* node, datatype_t* dt) {
             return context_null(compiler->context);
         }
 
-        emit_op(compiler->buffer, OP_CONS);
+        emit_op(compiler->buffer, subscript_op(dt, OP_CONS));
         return dt;
     } else if(!strcmp(key->ident, "at")) {
         // TODO: Wrap these Typechecks into functions
@@ -1026,7 +1139,7 @@ datatype_t* eval_array_func(compiler_t* compiler, ast_t* node, datatype_t* dt) {
             return context_null(compiler->context);
         }
 
-        emit_op(compiler->buffer, OP_GETSUB);
+        emit_op(compiler->buffer, subscript_op(dt, OP_GETSUB));
         return subtype;
     } else {
         compiler_throw(compiler, node, "Invalid array operation");
@@ -1060,18 +1173,30 @@ datatype_t* eval_class_call(compiler_t* compiler, ast_t* node, datatype_t* dt) {
         return context_null(compiler->context);
     }
 
+    // The receiver has just been loaded (see eval_call). If it is a local or global
+    // variable, it is borrowed: the method changes the object in place,
+    // so it is neither copied nor stored back
+    instruction_t* load = vector_top(compiler->buffer);
+    symbol_t* local = symbol_local(compiler, expr);
+    bool borrowed = local && !local->alias && (load->op == OP_LOAD || load->op == OP_GLOAD);
+    if(borrowed) {
+        load->op = (load->op == OP_LOAD) ? OP_BORROW : OP_GBORROW;
+    }
+
     if(eval_compare_and_call(compiler, func->node, node, func->address)) {
+        mark_tailcall(compiler, true);
+
         // Class is on top, reassign it
         // Else replace
         symbol_t* sym = symbol_get(compiler->scope, expr->vardecl.name);
-        if(sym) {
+        if(sym && !borrowed) {
             symbol_replace(compiler, sym);
         } else {
             emit_pop(compiler->buffer);
         }
 
         // Return the type
-        return finish_call(compiler, func->node->funcdecl.rettype);
+        return func->node->funcdecl.rettype;
     }
 
     return context_null(compiler->context);
@@ -1147,21 +1272,28 @@ datatype_t* eval_call(compiler_t* compiler, ast_t* node) {
                     }
 
                     isClass = true;
-                    emit_op(compiler->buffer, OP_LDARG0);
+                    emit_op(compiler->buffer, OP_BORROW0);
                 }
 
                 // Normal function call
                 if(eval_compare_and_call(compiler, symbol->node, node, symbol->address)) {
+                    if(isClass || symbol->global) {
+                        mark_tailcall(compiler, isClass);
+                    }
+
                     // Convert to class-method-call
                     if(isClass) {
                         emit_op(compiler->buffer, OP_SETARG0);
                     }
 
-                    return finish_call(compiler, symbol->node->funcdecl.rettype);
+                    return symbol->node->funcdecl.rettype;
                 }
             } else if(symbol->node->class == AST_CLASS) {
                 // Class constructor call
                 if(eval_compare_and_call(compiler, symbol->node, node, symbol->address)) {
+                    if(symbol->global) {
+                        mark_tailcall(compiler, false);
+                    }
                     return symbol->type;
                 }
             } else {
@@ -1219,7 +1351,7 @@ bool append_interpolated(compiler_t* compiler, char* buffer, bool on_stack) {
     }
 
     if(on_stack) {
-        emit_op(compiler->buffer, OP_APPEND);
+        emit_op(compiler->buffer, OP_SAPPEND);
     }
 
     return true;
@@ -1249,7 +1381,7 @@ void interpolate_string(compiler_t* compiler, char* str) {
             if(c-start > 0) {
                 emit_string(compiler->buffer, content);
                 if(string_on_stack) {
-                    emit_op(compiler->buffer, OP_APPEND);
+                    emit_op(compiler->buffer, OP_SAPPEND);
                 }
 
                 string_on_stack = true;
@@ -1287,7 +1419,7 @@ void interpolate_string(compiler_t* compiler, char* str) {
             memcpy(content, start, c-start);
 
             emit_string(compiler->buffer, content);
-            emit_op(compiler->buffer, OP_APPEND);
+            emit_op(compiler->buffer, OP_SAPPEND);
         }
     }
 }
@@ -1366,6 +1498,371 @@ datatype_t* eval_array(compiler_t* compiler, ast_t* node) {
     return context_find_or_create(compiler->context, &ret);
 }
 
+// Sets every jump in the list to the address
+static void patch_jumps(list_t* jmps, int address) {
+    list_iterator_t* iter = list_iterator_create(jmps);
+    while(!list_iterator_end(iter)) {
+        val_t* jmp = list_iterator_next(iter);
+        *jmp = INT32_VAL(address);
+    }
+    list_iterator_free(iter);
+}
+
+// Eval.condition(node)
+// Evaluates a condition and emits the jumps that are taken if it is false.
+// Single int / char / float comparisons are fused into one compare-and-branch
+// instruction; an integer literal on the right side becomes an immediate.
+// Example:
+// 01: load x
+// 02: jiltk 5, 10    <-- while x < 10
+//
+// && and || are short-circuited, the right side is only evaluated if needed:
+// 01: <a>            <-- if a && b, both jump to the else part
+// 02: jmpf 6
+// 03: <b>
+// 04: jmpf 6
+//
+// 01: <a>            <-- if a || b
+// 02: jmpf 4
+// 03: jmp 6          <-- a is true, skip b
+// 04: <b>
+// 05: jmpf ..
+// The datatype of the condition is returned, the jump address references are added to 'jmps'.
+datatype_t* eval_condition(compiler_t* compiler, ast_t* cond, list_t* jmps) {
+    bool compare = false;
+    bool logical = false;
+    if(cond->class == AST_BINARY) {
+        switch(cond->binary.op) {
+            case TOKEN_EQUAL:
+            case TOKEN_NEQUAL:
+            case TOKEN_LESS:
+            case TOKEN_GREATER:
+            case TOKEN_LEQUAL:
+            case TOKEN_GEQUAL: compare = true; break;
+            case TOKEN_AND:
+            case TOKEN_OR: logical = true; break;
+            default: break;
+        }
+    }
+
+    if(logical) {
+        token_type_t op = cond->binary.op;
+        list_t* next = (op == TOKEN_OR) ? list_new() : jmps;
+        datatype_t* lhs_type = eval_condition(compiler, cond->binary.left, next);
+        val_t* taken = 0;
+        if(op == TOKEN_OR) {
+            taken = emit_jmp(compiler->buffer, 0);
+            patch_jumps(next, vector_size(compiler->buffer));
+            list_free(next);
+        }
+
+        datatype_t* rhs_type = eval_condition(compiler, cond->binary.right, jmps);
+        if(taken) {
+            *taken = INT32_VAL(vector_size(compiler->buffer));
+        }
+
+        if(lhs_type->type != DATA_BOOL || rhs_type->type != DATA_BOOL) {
+            compiler_throw(compiler, cond, "Cannot perform operation '%s' on the types '%s' and '%s'",
+                token_string(op), datatype_str(lhs_type), datatype_str(rhs_type));
+            return context_null(compiler->context);
+        }
+        return lhs_type;
+    }
+
+    // Constant expressions are folded by eval_binary
+    ast_t* lhs = compare ? cond->binary.left : 0;
+    ast_t* rhs = compare ? cond->binary.right : 0;
+    if(!compare || (lhs->class == rhs->class && (lhs->class == AST_INT || lhs->class == AST_FLOAT))) {
+        datatype_t* dt = compiler_eval(compiler, cond);
+        list_push(jmps, emit_jmpf(compiler->buffer, 0));
+        return dt;
+    }
+
+    // Local integer compared with a literal, e.g. while i < 10
+    token_type_t op = cond->binary.op;
+    symbol_t* symbol = symbol_slot(compiler, lhs);
+    if(symbol && !symbol->global && rhs->class == AST_INT) {
+        val_t* jmp = emit_cmp_local_jmpf(compiler->buffer, op, symbol->address, rhs->i, 0);
+        if(jmp) {
+            list_push(jmps, jmp);
+            return context_get(compiler->context, "bool");
+        }
+    }
+
+    datatype_t* lhs_type = compiler_eval(compiler, lhs);
+    if(lhs_type->type == DATA_INT && rhs->class == AST_INT) {
+        list_push(jmps, emit_cmp_jmpf_k(compiler->buffer, op, rhs->i, 0));
+        return context_get(compiler->context, "bool");
+    }
+
+    datatype_t* rhs_type = compiler_eval(compiler, rhs);
+    if(!datatype_match(lhs_type, rhs_type)) {
+        compiler_throw(compiler, cond, "Cannot perform operation '%s' on the types '%s' and '%s'",
+            token_string(op), datatype_str(lhs_type), datatype_str(rhs_type));
+        return context_null(compiler->context);
+    }
+
+    // Fall back to the comparison and a jmpf, e.g. for booleans
+    val_t* jmp = emit_cmp_jmpf(compiler->buffer, op, lhs_type, 0);
+    if(!jmp) {
+        if(!emit_tok2op(compiler->buffer, op, lhs_type)) {
+            compiler_throw(compiler, cond, "Cannot perform operation '%s' on the types '%s' and '%s'",
+                token_string(op), datatype_str(lhs_type), datatype_str(rhs_type));
+            return context_null(compiler->context);
+        }
+        jmp = emit_jmpf(compiler->buffer, 0);
+    }
+    list_push(jmps, jmp);
+    return context_get(compiler->context, "bool");
+}
+
+// Eval.logical(node)
+// Evaluates && and || as a value, the conditional jumps
+// are shared with eval_condition.
+// Example: let b = x < 5 && y
+// 01: jiltlk x, 5, 6
+// 02: load y
+// 03: jmpf 6
+// 04: push true
+// 05: jmp 7
+// 06: push false
+datatype_t* eval_logical(compiler_t* compiler, ast_t* node) {
+    list_t* jmps = list_new();
+    datatype_t* dt = eval_condition(compiler, node, jmps);
+    emit_bool(compiler->buffer, true);
+    val_t* end = emit_jmp(compiler->buffer, 0);
+    patch_jumps(jmps, vector_size(compiler->buffer));
+    emit_bool(compiler->buffer, false);
+    *end = INT32_VAL(vector_size(compiler->buffer));
+    list_free(jmps);
+    return dt;
+}
+
+// If / else if chains over the keys of one variable (see eval_switch).
+// Shorter chains stay a sequence of comparisons.
+#define SWITCH_MIN_KEYS 4
+// A jump table is used, if at least every 4th entry is a key
+#define SWITCH_DENSITY 4
+#define SWITCH_MAX_TABLE 256
+// Number of keys tested one after another by the binary search
+#define SWITCH_LINEAR 3
+
+// Key and the index of its ifclause
+typedef struct {
+    int key;
+    int clause;
+} switch_case_t;
+
+// Value of an int (or negated int) or char literal of the type
+static bool switch_literal(ast_t* node, type_t type, int* key) {
+    if(type == DATA_CHAR) {
+        if(node->class != AST_CHAR) return false;
+        *key = node->ch;
+        return true;
+    }
+
+    bool minus = node->class == AST_UNARY && node->unary.op == TOKEN_SUB;
+    if(minus) node = node->unary.expr;
+    if(node->class != AST_INT || (minus && node->i == INT32_MIN)) return false;
+    *key = minus ? -node->i : node->i;
+    return true;
+}
+
+// Counts the comparisons of a condition 'x = k1 || x = k2 ...',
+// x is the variable 'name' and k a literal of its type.
+// Returns -1 if the condition has another form.
+static int switch_count(ast_t* cond, char* name, type_t type) {
+    if(cond->class != AST_BINARY) return -1;
+    ast_t* lhs = cond->binary.left;
+    ast_t* rhs = cond->binary.right;
+    if(cond->binary.op == TOKEN_OR) {
+        int left = switch_count(lhs, name, type);
+        int right = switch_count(rhs, name, type);
+        return (left < 0 || right < 0) ? -1 : left + right;
+    }
+
+    int key = 0;
+    if(cond->binary.op != TOKEN_EQUAL || lhs->class != AST_IDENT || strcmp(lhs->ident, name)) return -1;
+    return switch_literal(rhs, type, &key) ? 1 : -1;
+}
+
+// Adds the keys of a condition (see switch_count)
+static void switch_collect(ast_t* cond, type_t type, int clause, switch_case_t* cases, int* count) {
+    if(cond->binary.op == TOKEN_OR) {
+        switch_collect(cond->binary.left, type, clause, cases, count);
+        switch_collect(cond->binary.right, type, clause, cases, count);
+        return;
+    }
+
+    switch_literal(cond->binary.right, type, &cases[*count].key);
+    cases[*count].clause = clause;
+    (*count)++;
+}
+
+// Orders by key, the first clause of a key comes first
+static int switch_cmp(const void* a, const void* b) {
+    const switch_case_t* c1 = a;
+    const switch_case_t* c2 = b;
+    if(c1->key != c2->key) return c1->key < c2->key ? -1 : 1;
+    return c1->clause - c2->clause;
+}
+
+// Compares the variable with k and jumps if the comparison is false
+static val_t* switch_compare(compiler_t* compiler, symbol_t* symbol, token_type_t op, int k) {
+    if(!symbol->global) {
+        val_t* jmp = emit_cmp_local_jmpf(compiler->buffer, op, symbol->address, k, 0);
+        if(jmp) return jmp;
+    }
+    emit_load(compiler->buffer, symbol->address, symbol->global);
+    return emit_cmp_jmpf_k(compiler->buffer, op, k, 0);
+}
+
+// Binary search over the sorted keys cases[lo ... hi],
+// the jumps to the clauses are added to 'jmps', others to jmps[other]
+static void switch_search(compiler_t* compiler, symbol_t* symbol, switch_case_t* cases,
+    int lo, int hi, list_t** jmps, int other) {
+    if(hi - lo < SWITCH_LINEAR) {
+        for(int i = lo; i <= hi; i++) {
+            // Jumps, if x != k is false
+            list_push(jmps[cases[i].clause], switch_compare(compiler, symbol, TOKEN_NEQUAL, cases[i].key));
+        }
+        list_push(jmps[other], emit_jmp(compiler->buffer, 0));
+        return;
+    }
+
+    int mid = lo + (hi - lo + 1) / 2;
+    val_t* lower = switch_compare(compiler, symbol, TOKEN_GEQUAL, cases[mid].key);
+    switch_search(compiler, symbol, cases, mid, hi, jmps, other);
+    *lower = INT32_VAL(vector_size(compiler->buffer));
+    switch_search(compiler, symbol, cases, lo, mid - 1, jmps, other);
+}
+
+/**
+ * eval_switch:
+ * Compiles an if / else if chain, whose conditions all compare the same
+ * int or char variable with literals, e.g. if c = '+' {..} else if c = '-' || c = '_' {..}.
+ * Dense keys become a jump table, sparse ones a binary search,
+ * so that the last clause is not found after testing all others.
+ * Returns false (nothing is emitted), if the chain has another form.
+ *
+ * Example:
+ * 01: load x
+ * 02: switch 1, 4      <-- keys 1 ... 4
+ * 03: case 08          <-- x = 1
+ * 04: case 10          <-- x = 2
+ * 05: case 12          <-- 3 is not a key: else
+ * 06: case 08          <-- x = 4 (if x = 1 || x = 4)
+ * 07: case 12          <-- default: else
+ * 08: <clause 1>
+ * 09: jmp 13
+ * 10: <clause 2>
+ * 11: jmp 13
+ * 12: <else>
+ */
+bool eval_switch(compiler_t* compiler, ast_t* node) {
+    // The variable is the left side of the first comparison
+    ast_t* first = ((ast_t*)list_get(node->ifstmt, 0))->ifclause.cond;
+    while(first && first->class == AST_BINARY && first->binary.op == TOKEN_OR) {
+        first = first->binary.left;
+    }
+    if(!first || first->class != AST_BINARY) return false;
+
+    symbol_t* symbol = symbol_local(compiler, first->binary.left);
+    if(!symbol || !symbol->type || (symbol->type->type != DATA_INT && symbol->type->type != DATA_CHAR)) {
+        return false;
+    }
+
+    // Clauses with a condition, an else clause has to be the last
+    int total = 0;
+    int clauses = 0;
+    list_iterator_t* iter = list_iterator_create(node->ifstmt);
+    while(!list_iterator_end(iter)) {
+        ast_t* subnode = list_iterator_next(iter);
+        ast_t* cond = subnode->ifclause.cond;
+        int count = cond ? switch_count(cond, first->binary.left->ident, symbol->type->type) : 0;
+        if(count < 0 || (!cond && !list_iterator_end(iter))) {
+            total = -1;
+            break;
+        }
+        total += count;
+        if(cond) clauses++;
+    }
+    list_iterator_free(iter);
+    if(total < SWITCH_MIN_KEYS) return false;
+
+    // Sorted keys, a key belongs to its first clause
+    switch_case_t* cases = malloc(sizeof(switch_case_t) * total);
+    int count = 0;
+    iter = list_iterator_create(node->ifstmt);
+    for(int i = 0; i < clauses; i++) {
+        ast_t* subnode = list_iterator_next(iter);
+        switch_collect(subnode->ifclause.cond, symbol->type->type, i, cases, &count);
+    }
+    qsort(cases, count, sizeof(switch_case_t), switch_cmp);
+    count = 0;
+    for(int i = 0; i < total; i++) {
+        if(count == 0 || cases[count-1].key != cases[i].key) {
+            cases[count++] = cases[i];
+        }
+    }
+
+    // Jumps to every clause, the last list is for the else clause (or the end)
+    vector_t* buffer = compiler->buffer;
+    list_t** jmps = malloc(sizeof(list_t*) * (clauses + 1));
+    for(int i = 0; i <= clauses; i++) {
+        jmps[i] = list_new();
+    }
+
+    int64_t range = (int64_t)cases[count-1].key - cases[0].key + 1;
+    if(range <= SWITCH_MAX_TABLE && range <= (int64_t)count * SWITCH_DENSITY) {
+        emit_load(buffer, symbol->address, symbol->global);
+        emit_switch(buffer, cases[0].key, (int)range);
+        int next = 0;
+        for(int i = 0; i < range; i++) {
+            int clause = clauses;
+            if(cases[next].key == cases[0].key + i) {
+                clause = cases[next++].clause;
+            }
+            list_push(jmps[clause], emit_case(buffer, 0));
+        }
+        list_push(jmps[clauses], emit_case(buffer, 0));
+    } else {
+        switch_search(compiler, symbol, cases, 0, count - 1, jmps, clauses);
+    }
+    free(cases);
+
+    // Clauses in the order of the source, as in eval_if
+    list_t* ends = list_new();
+    list_iterator_reset(iter, node->ifstmt);
+    int clause = 0;
+    while(!list_iterator_end(iter)) {
+        ast_t* subnode = list_iterator_next(iter);
+        patch_jumps(jmps[clause], vector_size(buffer));
+
+        push_scope_virtual(compiler, node);
+        eval_block(compiler, subnode->ifclause.body);
+        pop_scope_virtual(compiler);
+
+        if(subnode->ifclause.cond) {
+            list_push(ends, emit_jmp(buffer, 0));
+        }
+        clause++;
+    }
+    list_iterator_free(iter);
+
+    // Without an else clause, the other keys continue after the chain
+    if(clause == clauses) {
+        patch_jumps(jmps[clauses], vector_size(buffer));
+    }
+    patch_jumps(ends, vector_size(buffer));
+    list_free(ends);
+    for(int i = 0; i <= clauses; i++) {
+        list_free(jmps[i]);
+    }
+    free(jmps);
+    return true;
+}
+
 // Eval.if(node)
 // The function evaluates ifclauses
 // by emitting jumps around the instructions.
@@ -1392,6 +1889,10 @@ datatype_t* eval_array(compiler_t* compiler, ast_t* node) {
 // 10: ieq
 // 11: jmpf ..        <-- jump to condition 3 and so on
 datatype_t* eval_if(compiler_t* compiler, ast_t* node) {
+    if(eval_switch(compiler, node)) {
+        return context_null(compiler->context);
+    }
+
     // Eval the sub-ifclauses
     list_t* jmps = list_new();
     list_iterator_t* iter = list_iterator_create(node->ifstmt);
@@ -1401,18 +1902,17 @@ datatype_t* eval_if(compiler_t* compiler, ast_t* node) {
 
         // Jump #1 - declaration
         // Test if not an else-statement
-        val_t* instr = 0;
+        list_t* falses = list_new();
         if(subnode->ifclause.cond) {
-            // Eval the condition and generate an if-false jump
-            datatype_t* cond_type = compiler_eval(compiler, subnode->ifclause.cond);
+            // Eval the condition and generate the if-false jumps
+            datatype_t* cond_type = eval_condition(compiler, subnode->ifclause.cond, falses);
             if(cond_type->type != DATA_BOOL) {
                 compiler_throw(compiler, subnode, "Conditions must of of type boolean");
+                list_free(falses);
                 list_free(jmps);
                 list_iterator_free(iter);
                 return context_null(compiler->context);
             }
-
-            instr = emit_jmpf(compiler->buffer, 0);
         }
 
         // Eval execution block code
@@ -1431,9 +1931,8 @@ datatype_t* eval_if(compiler_t* compiler, ast_t* node) {
         // If not an else statement
         // Generate jump to next clause
         // (set the previously generated jump)
-        if(subnode->ifclause.cond) {
-            *instr = INT32_VAL(vector_size(compiler->buffer));
-        }
+        patch_jumps(falses, vector_size(compiler->buffer));
+        list_free(falses);
     }
 
     // Set the jump points to end after whole if block
@@ -1456,22 +1955,207 @@ datatype_t* eval_if(compiler_t* compiler, ast_t* node) {
 // 04: jmp 1
 datatype_t* eval_while(compiler_t* compiler, ast_t* node) {
     size_t start = vector_size(compiler->buffer);
-    compiler_eval(compiler, node->whilestmt.cond);
-    val_t* instr = emit_jmpf(compiler->buffer, 0);
+    list_t* falses = list_new();
+    eval_condition(compiler, node->whilestmt.cond, falses);
+    if(list_size(falses) == 0) {
+        list_free(falses);
+        return context_null(compiler->context);
+    }
 
     push_scope_virtual(compiler, node);
     eval_block(compiler, node->whilestmt.body);
     pop_scope_virtual(compiler);
 
     emit_jmp(compiler->buffer, start);
-    *instr = INT32_VAL(vector_size(compiler->buffer));
+    patch_jumps(falses, vector_size(compiler->buffer));
+    list_free(falses);
+    return context_null(compiler->context);
+}
+
+/**
+ * eval_for:
+ * Compiles a for loop over an int range (from...to, to excluded) or an array.
+ * The loop variable and the state of the loop live in consecutive slots,
+ * reserved by the enclosing block (see eval_block):
+ * range: i, limit
+ * array: array, index, element (the loop variable)
+ * An array variable is borrowed and the elements are not copied,
+ * arrays are never changed in place (see setsub).
+ *
+ * Example (range):
+ * 01: <from>; store i
+ * 02: <to>; store i+1
+ * 03: load i; load i+1; jilt 06
+ * 04: <body>
+ * 05: forl 04, i
+ *
+ * Example (array):
+ * 01: <array>; store a
+ * 02: push -1; store a+1
+ * 03: jmp 05
+ * 04: <body>
+ * 05: forin 04, a
+ */
+datatype_t* eval_for(compiler_t* compiler, ast_t* node) {
+    ast_t* var = node->forstmt.var;
+    vector_t* buffer = compiler->buffer;
+    bool global = compiler->depth == 0;
+    int address = compiler->scope->address;
+
+    datatype_t* type = compiler_eval(compiler, node->forstmt.expr);
+    val_t* jmp = 0;
+    if(node->forstmt.to) {
+        compiler->scope->address += 2;
+        emit_store(buffer, address, global);
+        datatype_t* to = compiler_eval(compiler, node->forstmt.to);
+        if(type->type != DATA_INT || to->type != DATA_INT) {
+            compiler_throw(compiler, node, "The bounds of a range have to be of type int");
+            return context_null(compiler->context);
+        }
+        emit_store(buffer, address+1, global);
+        emit_load(buffer, address, global);
+        emit_load(buffer, address+1, global);
+        jmp = emit_cmp_jmpf(buffer, TOKEN_LESS, type, 0);
+    } else {
+        if(type->type != DATA_ARRAY || datatype_is_string(type)) {
+            compiler_throw(compiler, node, "For loops iterate over int ranges and arrays (no strings)");
+            return context_null(compiler->context);
+        }
+        compiler->scope->address += 3;
+
+        // The array is not copied
+        instruction_t* load = vector_top(buffer);
+        if(symbol_local(compiler, node->forstmt.expr) && (load->op == OP_LOAD || load->op == OP_GLOAD)) {
+            load->op = (load->op == OP_LOAD) ? OP_BORROW : OP_GBORROW;
+        }
+        emit_store(buffer, address, global);
+        emit_int(buffer, -1);
+        emit_store(buffer, address+1, global);
+        jmp = emit_jmp(buffer, 0);
+    }
+
+    size_t body = vector_size(buffer);
+    push_scope_virtual(compiler, node);
+    if(!symbol_exists(compiler, var, var->vardecl.name)) {
+        datatype_t* vartype = node->forstmt.to ? type : type->subtype;
+        symbol_t* symbol = symbol_new(compiler, var, node->forstmt.to ? address : address+2, vartype);
+        symbol->alias = !node->forstmt.to;
+        var->vardecl.type = vartype;
+        hashmap_set(compiler->scope->symbols, var->vardecl.name, symbol);
+        eval_block(compiler, node->forstmt.body);
+    }
+    pop_scope_virtual(compiler);
+
+    if(node->forstmt.to) {
+        emit_for_range(buffer, address, body);
+        *jmp = INT32_VAL(vector_size(buffer));
+    } else {
+        *jmp = INT32_VAL(vector_size(buffer));
+        emit_for_each(buffer, address, body);
+    }
+    return context_null(compiler->context);
+}
+
+/**
+ * eval_try:
+ * Compiles a try statement.
+ * The guarded block runs as it is, nothing is executed on entry.
+ * The handler follows it and is only reached by unwinding (see vm_unwind),
+ * the handler tables are built from the catch instructions (see bytecode_load).
+ * The slot of the exception is reserved by the enclosing block.
+ *
+ * Example:
+ * 01: <try block>
+ * 02: jmp 06
+ * 03: catch 01       <-- handler of 01 - 02, pushes the exception
+ * 04: store e
+ * 05: <catch block>
+ */
+datatype_t* eval_try(compiler_t* compiler, ast_t* node) {
+    ast_t* var = node->trystmt.var;
+    datatype_t* type = var->vardecl.type;
+
+    // Exceptions are created by the VM, as instances of the class of the core library
+    void* tmp;
+    if(hashmap_get(compiler->imports, "core", &tmp) != HMAP_OK
+        || type->type != DATA_CLASS || type->id != djb2((unsigned char*)"Exception")) {
+        compiler_throw(compiler, var, "Only the type Exception can be caught (using core)");
+        return context_null(compiler->context);
+    }
+
+    int address = compiler->scope->address++;
+    size_t start = vector_size(compiler->buffer);
+
+    compiler->guarded++;
+    push_scope_virtual(compiler, node);
+    eval_block(compiler, node->trystmt.body);
+    pop_scope_virtual(compiler);
+    compiler->guarded--;
+    val_t* end = emit_jmp(compiler->buffer, 0);
+
+    emit_catch(compiler->buffer, start);
+    push_scope_virtual(compiler, node);
+    if(!symbol_exists(compiler, var, var->vardecl.name)) {
+        symbol_t* symbol = symbol_new(compiler, var, address, type);
+        hashmap_set(compiler->scope->symbols, var->vardecl.name, symbol);
+        emit_store(compiler->buffer, address, symbol->global);
+        eval_block(compiler, node->trystmt.handler);
+    }
+    pop_scope_virtual(compiler);
+
+    *end = INT32_VAL(vector_size(compiler->buffer));
     return context_null(compiler->context);
 }
 
 // Eval.return(node)
 // Simply compiles the return data and emits the bytecode
+/**
+ * eval_tailcall:
+ * Replaces a call at the end of a return expression by a tail call.
+ * Accepted endings:
+ * invoke         (function or constructor)
+ * invoke; pop    (method of another object, its class is dropped)
+ * invoke; setarg0 (method of the same object)
+ * Returns false, if there is no call in tail position.
+ */
+bool eval_tailcall(compiler_t* compiler, bool virtual) {
+    vector_t* buffer = compiler->buffer;
+    int size = vector_size(buffer);
+    int index = compiler->tailcall;
+    compiler->tailcall = -1;
+    if(index < 0) return false;
+
+    instruction_t* call = vector_get(buffer, index);
+    int args = AS_INT32(call->v2);
+    if(call->op != OP_INVOKE || args != TAIL_ARGS(args)) return false;
+
+    int mode = 0;
+    if(!compiler->tailvirtual && index == size - 1) {
+        // The class of a method has to be returned as well
+        if(virtual) mode = TAIL_SELF_VIRTUAL | TAIL_KEEP;
+    } else if(compiler->tailvirtual && virtual && index == size - 2) {
+        instruction_t* next = vector_top(buffer);
+        if(next->op == OP_POP) {
+            mode = TAIL_SELF_VIRTUAL | TAIL_CALLEE_VIRTUAL | TAIL_KEEP;
+        } else if(next->op == OP_SETARG0) {
+            mode = TAIL_SELF_VIRTUAL | TAIL_CALLEE_VIRTUAL;
+        } else {
+            return false;
+        }
+        vector_pop(buffer);
+        free(next);
+    } else {
+        return false;
+    }
+
+    call->op = OP_TAILCALL;
+    call->v2 = INT32_VAL(args | mode);
+    return true;
+}
+
 datatype_t* eval_return(compiler_t* compiler, ast_t* node) {
     datatype_t* dt = context_void(compiler->context);
+    compiler->tailcall = -1;
     if(node->returnstmt) {
         dt = compiler_eval(compiler, node->returnstmt);
     }
@@ -1487,9 +2171,20 @@ datatype_t* eval_return(compiler_t* compiler, ast_t* node) {
         return context_null(compiler->context);
     }
 
-    if(scope_is_class(compiler->scope, AST_CLASS, &refNode)) {
-        emit_op(compiler->buffer, OP_RETVIRTUAL);
-    } else {
+    // The frame of a function with nested functions has to stay,
+    // the callee may access its variables through the display.
+    // Within a try block the frame holds the handler of the callee.
+    if(has_nested_funcs(refNode->funcdecl.impl.body) || compiler->guarded > 0) {
+        compiler->tailcall = -1;
+    }
+
+    if(!node->returnstmt) {
+        emit_op(compiler->buffer, OP_RETVOID);
+    } else if(scope_is_class(compiler->scope, AST_CLASS, &refNode)) {
+        if(!eval_tailcall(compiler, true)) {
+            emit_op(compiler->buffer, OP_RETVIRTUAL);
+        }
+    } else if(!eval_tailcall(compiler, false)) {
         emit_return(compiler->buffer);
     }
 
@@ -1552,7 +2247,7 @@ datatype_t* eval_subscript(compiler_t* compiler, ast_t* node) {
 
         // We got an array and want to access an element.
         // Remove the array flag to get the return type.
-        emit_op(compiler->buffer, OP_GETSUB);
+        emit_op(compiler->buffer, subscript_op(exprType, OP_GETSUB));
         return exprType->subtype;
     } else {
         compiler_throw(compiler, node, "Invalid subscript operation");
@@ -1662,7 +2357,7 @@ datatype_t* eval_class(compiler_t* compiler, ast_t* node) {
 
     // Treat each parameter as a local variable, with no type or value
     list_iterator_t* iter = list_iterator_create(node->classstmt.formals);
-    int i = -(list_size(node->classstmt.formals) + 3);
+    int i = -list_size(node->classstmt.formals);
     while(!list_iterator_end(iter)) {
         // Create parameter in symbols list
         ast_t* param = list_iterator_next(iter);
@@ -1827,6 +2522,10 @@ datatype_t* eval_class(compiler_t* compiler, ast_t* node) {
     *addr = INT32_VAL(byte_address);
 
     // Set the class fields count
+    if(field_count > CLASS_FIELDS) {
+        compiler_throw(compiler, node, "Class has too many fields");
+        return context_null(compiler->context);
+    }
     *fields = INT32_VAL(field_count);
     return context_null(compiler->context);
 }
@@ -1900,6 +2599,11 @@ datatype_t* eval_annotation(compiler_t* compiler, ast_t* node) {
         return context_null(compiler->context);
     }
 
+    // Every function may throw, the annotation only documents it
+    if(node->annotation == ANN_EXCEPTION) {
+        return context_null(compiler->context);
+    }
+
     if(node->annotation != ANN_UNUSED) {
         if(!compiler->scope->node) {
             compiler_throw(compiler, node, "Annotations can only be used within classes");
@@ -1951,6 +2655,8 @@ datatype_t* compiler_eval(compiler_t* compiler, ast_t* node) {
         case AST_CALL: return eval_call(compiler, node);
         case AST_IF: return eval_if(compiler, node);
         case AST_WHILE: return eval_while(compiler, node);
+        case AST_FOR: return eval_for(compiler, node);
+        case AST_TRY: return eval_try(compiler, node);
         case AST_UNARY: return eval_unary(compiler, node);
         case AST_SUBSCRIPT: return eval_subscript(compiler, node);
         case AST_CLASS: return eval_class(compiler, node);
@@ -1974,6 +2680,9 @@ vector_t* compile_buffer(const char* name, char* source) {
     compiler.buffer = vector_new();
     compiler.error = false;
     compiler.depth = 0;
+    compiler.tailcall = -1;
+    compiler.tailvirtual = false;
+    compiler.guarded = 0;
     hashmap_set(compiler.imports, name, 0);
 
     // Run the parser
@@ -1989,6 +2698,15 @@ vector_t* compile_buffer(const char* name, char* source) {
         // Add final HALT instruction to end
         compiler_eval(&compiler, root);
         emit_op(compiler.buffer, OP_HLT);
+
+        // Run the bytecode optimization passes,
+        // the symbols keep addressing their code
+        if(!compiler.error) {
+            size_t size = vector_size(compiler.buffer);
+            int* relocation = optimize_buffer(compiler.buffer);
+            scope_relocate(compiler.scope, relocation, size);
+            free(relocation);
+        }
     } else {
         compiler.error = true;
     }
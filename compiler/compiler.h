@@ -18,6 +18,7 @@
 #include "../parser/types.h"
 #include "../vm/bytecode.h"
 #include "../compiler/scope.h"
+#include "../compiler/optimizer.h"
 #include "../lib/native.h"
 
 typedef struct compiler_t {
@@ -28,6 +29,13 @@ typedef struct compiler_t {
     vector_t* buffer;
     bool error;
     int depth;
+
+    // Last call, that may be in tail position (see eval_return)
+    int tailcall;
+    bool tailvirtual;
+
+    // Number of try blocks around the current code of a function (see eval_try)
+    int guarded;
 } compiler_t;
 
 vector_t* compile_buffer(const char* name, char* source);
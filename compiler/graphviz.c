@@ -267,6 +267,66 @@ int graphviz_eval(graphviz_t* state, ast_t* node) {
             graphviz_connection(state, this, bodyBranch);
             return this;
         }
+        case AST_FOR: {
+            int this = graphviz_get_id(state);
+            graphviz_mnemonic(state);
+            fprintf(state->fp, "node%d [label=\"FOR %s\"]\n", this, node->forstmt.var->vardecl.name);
+
+            int rangeBranch = graphviz_get_id(state);
+            graphviz_mnemonic(state);
+            fprintf(state->fp, "node%d [label=\"%s\"]\n", rangeBranch, node->forstmt.to ? "RANGE" : "ARRAY");
+
+            graphviz_connection(state, rangeBranch, graphviz_eval(state, node->forstmt.expr));
+            if(node->forstmt.to) {
+                graphviz_connection(state, rangeBranch, graphviz_eval(state, node->forstmt.to));
+            }
+            graphviz_connection(state, this, rangeBranch);
+
+            int bodyBranch = graphviz_get_id(state);
+            graphviz_mnemonic(state);
+            fprintf(state->fp, "node%d [label=\"BODY\"]\n", bodyBranch);
+
+            list_iterator_t* iter = list_iterator_create(node->forstmt.body);
+            while(!list_iterator_end(iter)) {
+                ast_t* next = list_iterator_next(iter);
+                int other = graphviz_eval(state, next);
+                graphviz_connection(state, bodyBranch, other);
+            }
+            list_iterator_free(iter);
+            graphviz_connection(state, this, bodyBranch);
+            return this;
+        }
+        case AST_TRY: {
+            int this = graphviz_get_id(state);
+            graphviz_mnemonic(state);
+            fprintf(state->fp, "node%d [label=\"TRY\"]\n", this);
+
+            int bodyBranch = graphviz_get_id(state);
+            graphviz_mnemonic(state);
+            fprintf(state->fp, "node%d [label=\"BODY\"]\n", bodyBranch);
+
+            list_iterator_t* iter = list_iterator_create(node->trystmt.body);
+            while(!list_iterator_end(iter)) {
+                ast_t* next = list_iterator_next(iter);
+                int other = graphviz_eval(state, next);
+                graphviz_connection(state, bodyBranch, other);
+            }
+            graphviz_connection(state, this, bodyBranch);
+
+            int catchBranch = graphviz_get_id(state);
+            graphviz_mnemonic(state);
+            fprintf(state->fp, "node%d [label=\"CATCH %s\"]\n", catchBranch, node->trystmt.var->vardecl.name);
+
+            list_iterator_reset(iter, node->trystmt.handler);
+            while(!list_iterator_end(iter)) {
+                ast_t* next = list_iterator_next(iter);
+                int other = graphviz_eval(state, next);
+                graphviz_connection(state, catchBranch, other);
+            }
+            list_iterator_free(iter);
+            graphviz_connection(state, this, catchBranch);
+            return this;
+        }
         case AST_IMPORT: {
             int this = graphviz_get_id(state);
             graphviz_mnemonic(state);
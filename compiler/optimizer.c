@@ -0,0 +1,308 @@
+// Copyright (C) 2017 Alexander Koch
+#include "optimizer.h"
+
+// Fusable instruction sequence
+typedef struct {
+    opcode_t fused;
+    size_t length;
+    opcode_t ops[3];
+} fusion_t;
+
+// Dynamic counts of benchmarks/*.gs and tests/*.gs (-DPROFILE), most frequent first:
+// isublk 16%, ldfield 2%, load2 1.2%, iaddlk 0.2% of the executed instructions.
+// iltlk and storejmp are no longer fused, conditions compile to compare-and-branch
+// instructions and loops end with incl; jmp, so they matched (almost) never.
+// Sequences with the same prefix are tested longest first.
+static const fusion_t fusions[] = {
+    {OP_ISUBLK, 3, {OP_LOAD, OP_PUSH, OP_ISUB}},      // fib(n-1)
+    {OP_LDFIELD, 2, {OP_LDARG0, OP_GETFIELD}},        // class field access
+    {OP_LOAD2, 2, {OP_LOAD, OP_LOAD}},
+    {OP_IADDLK, 3, {OP_LOAD, OP_PUSH, OP_IADD}},      // i + 1
+};
+
+#define NUM_FUSIONS (sizeof(fusions) / sizeof(fusions[0]))
+
+/**
+ * Marks every instruction that is the target of an address.
+ * Sequences can only be fused, if no instruction except the first is a target.
+ */
+static bool* find_targets(vector_t* buffer) {
+    size_t sz = vector_size(buffer);
+    bool* targets = calloc(sz + 1, sizeof(bool));
+    for(size_t i = 0; i < sz; i++) {
+        instruction_t* instr = vector_get(buffer, i);
+        if(op_has_address(instr->op)) {
+            int address = AS_INT32(instr->v1);
+            if(address >= 0 && (size_t)address <= sz) {
+                targets[address] = true;
+            }
+        }
+    }
+    return targets;
+}
+
+/**
+ * Relocates all addresses of the new instructions in 'out'
+ * (relocation maps every old address to its new address, sz is the old size)
+ * and moves them into the buffer. The relocation is kept by the caller.
+ */
+static void relocate(vector_t* buffer, vector_t* out, int* relocation, size_t sz) {
+    for(size_t j = 0; j < vector_size(out); j++) {
+        instruction_t* instr = vector_get(out, j);
+        if(op_has_address(instr->op)) {
+            int address = AS_INT32(instr->v1);
+            if(address >= 0 && (size_t)address <= sz) {
+                instr->v1 = INT32_VAL(relocation[address]);
+            }
+        }
+    }
+
+    // Swap the contents of the buffers
+    free(buffer->data);
+    *buffer = *out;
+    free(out);
+}
+
+static bool fusion_matches(vector_t* buffer, bool* targets, size_t i, const fusion_t* fusion) {
+    if(i + fusion->length > vector_size(buffer)) return false;
+
+    for(size_t j = 0; j < fusion->length; j++) {
+        instruction_t* instr = vector_get(buffer, i + j);
+        if(instr->op != fusion->ops[j]) return false;
+        if(j > 0 && targets[i + j]) return false;
+
+        // Only integer immediates can be fused
+        if(instr->op == OP_PUSH && !IS_INT32(instr->v1)) return false;
+    }
+    return true;
+}
+
+// Builds the fused instruction from the sequence at position i
+static instruction_t* fusion_build(vector_t* buffer, size_t i, const fusion_t* fusion) {
+    instruction_t* first = vector_get(buffer, i);
+    instruction_t* second = vector_get(buffer, i + 1);
+    instruction_t* fused = malloc(sizeof(*fused));
+    fused->op = fusion->fused;
+    fused->v1 = NULL_VAL;
+    fused->v2 = NULL_VAL;
+
+    switch(fusion->fused) {
+        case OP_IADDLK:
+        case OP_ISUBLK:
+        case OP_ILTLK:
+        case OP_LOAD2: {
+            fused->v1 = first->v1;
+            fused->v2 = second->v1;
+            break;
+        }
+        case OP_LDFIELD: {
+            fused->v1 = second->v1;
+            break;
+        }
+        case OP_STOREJMP: {
+            // Address first, so it can be relocated
+            fused->v1 = second->v1;
+            fused->v2 = first->v1;
+            break;
+        }
+        default: break;
+    }
+    return fused;
+}
+
+// Returns the relocation of every old address (see relocate)
+static int* fuse(vector_t* buffer) {
+    size_t sz = vector_size(buffer);
+    bool* targets = find_targets(buffer);
+
+    // Maps every old address to its new address
+    int* relocation = malloc(sizeof(int) * (sz + 1));
+    vector_t* out = vector_new();
+
+    size_t i = 0;
+    while(i < sz) {
+        relocation[i] = vector_size(out);
+
+        const fusion_t* fusion = 0;
+        for(size_t f = 0; f < NUM_FUSIONS; f++) {
+            if(fusion_matches(buffer, targets, i, &fusions[f])) {
+                fusion = &fusions[f];
+                break;
+            }
+        }
+
+        if(!fusion) {
+            vector_push(out, vector_get(buffer, i));
+            i++;
+            continue;
+        }
+
+        // Replace the sequence, operands are moved to the new instruction
+        vector_push(out, fusion_build(buffer, i, fusion));
+        for(size_t j = 0; j < fusion->length; j++) {
+            instruction_t* instr = vector_get(buffer, i + j);
+            relocation[i + j] = vector_size(out) - 1;
+            free(instr);
+        }
+        i += fusion->length;
+    }
+    relocation[sz] = vector_size(out);
+
+    relocate(buffer, out, relocation, sz);
+    free(targets);
+    return relocation;
+}
+
+void optimize_superinstructions(vector_t* buffer) {
+    int* relocation = fuse(buffer);
+    free(relocation);
+}
+
+// Jumps within a function, that can be retargeted
+static bool is_jump(opcode_t op) {
+    return op_has_address(op) && op != OP_INVOKE && op != OP_TAILCALL && op != OP_CATCH;
+}
+
+// Follows a chain of unconditional jumps, stops at cycles
+static int jump_destination(vector_t* buffer, int address) {
+    size_t sz = vector_size(buffer);
+    for(size_t n = 0; n < sz && (size_t)address < sz; n++) {
+        instruction_t* instr = vector_get(buffer, address);
+        if(instr->op != OP_JMP) break;
+        address = AS_INT32(instr->v1);
+    }
+    return address;
+}
+
+/**
+ * Marks the instructions that can be executed, starting from the toplevel code
+ * and the exception handlers. Functions that are never invoked are unreachable.
+ */
+static bool* find_reachable(vector_t* buffer) {
+    size_t sz = vector_size(buffer);
+    bool* live = calloc(sz + 1, sizeof(bool));
+    int* work = malloc(sizeof(int) * (sz + 1));
+    int count = 0;
+
+    live[0] = true;
+    work[count++] = 0;
+    for(size_t i = 0; i < sz; i++) {
+        instruction_t* instr = vector_get(buffer, i);
+        if(instr->op == OP_CATCH) {
+            live[i] = true;
+            work[count++] = i;
+        }
+    }
+
+    while(count > 0) {
+        int pc = work[--count];
+        if((size_t)pc >= sz) continue;
+
+        instruction_t* instr = vector_get(buffer, pc);
+        int next[2] = {-1, -1};
+        if(op_has_address(instr->op) && instr->op != OP_CATCH) {
+            next[0] = AS_INT32(instr->v1);
+        }
+        if(!op_is_terminator(instr->op)) {
+            next[1] = pc + 1;
+        }
+
+        for(int j = 0; j < 2; j++) {
+            if(next[j] >= 0 && (size_t)next[j] <= sz && !live[next[j]]) {
+                live[next[j]] = true;
+                work[count++] = next[j];
+            }
+        }
+
+        // The entries of a jump table follow the switch
+        if(instr->op == OP_SWITCH) {
+            int last = pc + AS_INT32(instr->v2) + 1;
+            for(int j = pc + 1; j <= last && (size_t)j < sz; j++) {
+                if(!live[j]) {
+                    live[j] = true;
+                    work[count++] = j;
+                }
+            }
+        }
+    }
+    free(work);
+    return live;
+}
+
+// Returns the relocation of every old address (see relocate)
+static int* thread_jumps(vector_t* buffer) {
+    size_t sz = vector_size(buffer);
+
+    // Thread jumps to jumps, a jump to a return becomes the return
+    for(size_t i = 0; i < sz; i++) {
+        instruction_t* instr = vector_get(buffer, i);
+        if(!is_jump(instr->op)) continue;
+
+        int address = jump_destination(buffer, AS_INT32(instr->v1));
+        instr->v1 = INT32_VAL(address);
+        if(instr->op == OP_JMP && (size_t)address < sz) {
+            instruction_t* dest = vector_get(buffer, address);
+            if(dest->op == OP_RET || dest->op == OP_RETVIRTUAL || dest->op == OP_RETVOID || dest->op == OP_HLT) {
+                instr->op = dest->op;
+                instr->v1 = NULL_VAL;
+            }
+        }
+    }
+
+    // Remove unreachable code and jumps to the next remaining instruction,
+    // backwards, so that a sequence of such jumps is removed completely
+    bool* keep = find_reachable(buffer);
+    if(sz > 0) {
+        // Errors continue at the final hlt (see vm_throw)
+        keep[sz - 1] = true;
+    }
+
+    int following = sz;
+    for(int i = sz - 1; i >= 0; i--) {
+        if(!keep[i]) continue;
+
+        instruction_t* instr = vector_get(buffer, i);
+        if(instr->op == OP_JMP && AS_INT32(instr->v1) == following) {
+            keep[i] = false;
+            continue;
+        }
+        following = i;
+    }
+
+    // Maps every old address to its new address,
+    // removed instructions to the next remaining one
+    int* relocation = malloc(sizeof(int) * (sz + 1));
+    vector_t* out = vector_new();
+    for(size_t i = 0; i < sz; i++) {
+        instruction_t* instr = vector_get(buffer, i);
+        relocation[i] = vector_size(out);
+        if(keep[i]) {
+            vector_push(out, instr);
+        } else {
+            if(instr->v1 != NULL_VAL) val_free(instr->v1);
+            if(instr->v2 != NULL_VAL) val_free(instr->v2);
+            free(instr);
+        }
+    }
+    relocation[sz] = vector_size(out);
+
+    relocate(buffer, out, relocation, sz);
+    free(keep);
+    return relocation;
+}
+
+void optimize_jumps(vector_t* buffer) {
+    int* relocation = thread_jumps(buffer);
+    free(relocation);
+}
+
+int* optimize_buffer(vector_t* buffer) {
+    size_t sz = vector_size(buffer);
+    int* relocation = thread_jumps(buffer);
+    int* fused = fuse(buffer);
+    for(size_t i = 0; i <= sz; i++) {
+        relocation[i] = fused[relocation[i]];
+    }
+    free(fused);
+    return relocation;
+}
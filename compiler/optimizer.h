@@ -0,0 +1,42 @@
+/**
+ * optimizer.h
+ * Copyright (C) 2017 Alexander Koch
+ * Bytecode optimization passes
+ *
+ * The passes run over the instruction buffer of the compiler
+ * after code generation and rewrite it in place.
+ * All bytecode addresses (jumps, invocations) are relocated.
+ */
+
+#ifndef optimizer_h
+#define optimizer_h
+
+#include "../adt/vector.h"
+#include "../vm/bytecode.h"
+
+/**
+ * Superinstruction fusion:
+ * Replaces frequent instruction sequences by a single instruction.
+ * The fused sequences are chosen from measured opcode pair counts
+ * (build with -DPROFILE to print them).
+ */
+void optimize_superinstructions(vector_t* buffer);
+
+/**
+ * Jump threading and dead code elimination:
+ * Jumps to jumps are redirected to the final destination,
+ * a jump to ret / retvirtual / retvoid / hlt is replaced by a copy of it.
+ * Unreachable instructions (e.g. functions that are never invoked)
+ * and jumps to the following instruction are removed.
+ * The entries of jump tables (case) are threaded, but always kept.
+ */
+void optimize_jumps(vector_t* buffer);
+
+/**
+ * Runs both passes, returns the table that maps every address
+ * of the buffer before to its new address (size + 1 entries, to be freed),
+ * so addresses kept elsewhere (symbols) can be relocated as well.
+ */
+int* optimize_buffer(vector_t* buffer);
+
+#endif
@@ -0,0 +1,783 @@
+// Copyright (C) 2017 Alexander Koch
+#include "regcode.h"
+
+// Largest frame (in slots) of a function, that is translated
+#define MAX_FRAME 512
+
+// Symbolic stack entry
+typedef enum {
+    ENTRY_SLOT,     // Value is in its own slot
+    ENTRY_LOCAL,    // Pending load of a local slot
+    ENTRY_CONST     // Pending constant, never an object
+} entry_type_t;
+
+typedef struct {
+    entry_type_t type;
+    int slot;
+    val_t v;
+} entry_t;
+
+typedef struct {
+    bytecode_t* bytecode;
+    int* depth;         // Stack depth before every instruction, -1 if unreachable
+    int* func;          // Entry of the function of every instruction, 0 for toplevel
+    int* frame;         // Maximum stack depth of a function, by entry
+    bool* targets;
+    int* map;           // Stack address -> register address
+
+    reg_t* code;
+    size_t size;
+    size_t capacity;
+    int last;           // Last instruction, whose destination may be changed
+
+    entry_t stack[MAX_FRAME];
+    int top;
+    bool toplevel;
+} regcode_gen_t;
+
+/**
+ * Computes the stack depth of every instruction (see bytecode_depths).
+ * Returns false, if the code was not verified, has exception handlers
+ * (they unwind the stack frames of the stack VM) or a frame is too large.
+ */
+static bool regcode_analyze(regcode_gen_t* gen) {
+    if(!gen->bytecode->frame || gen->bytecode->handlerCount > 0) {
+        return false;
+    }
+    if(!bytecode_depths(gen->bytecode, gen->depth, gen->func, gen->frame)) {
+        return false;
+    }
+    for(size_t i = 0; i < gen->bytecode->size; i++) {
+        if(gen->depth[i] != -1 && gen->frame[gen->func[i]] > MAX_FRAME) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static reg_t* regcode_emit(regcode_gen_t* gen, regop_t op, int a, int b, int c) {
+    if(gen->size >= gen->capacity) {
+        gen->capacity *= 2;
+        gen->code = realloc(gen->code, sizeof(reg_t) * gen->capacity);
+    }
+
+    reg_t* instr = &gen->code[gen->size++];
+    memset(instr, 0, sizeof(reg_t));
+    instr->op = op;
+    instr->a = a;
+    instr->b = b;
+    instr->c = c;
+    instr->live = gen->top;
+    instr->v = NULL_VAL;
+    gen->last = -1;
+    return instr;
+}
+
+// Marks the last instruction as producer of the top of the stack
+static void regcode_produced(regcode_gen_t* gen, int pos) {
+    gen->last = gen->size - 1;
+    gen->stack[pos].type = ENTRY_SLOT;
+    gen->top = pos + 1;
+}
+
+// Moves a pending value into its slot.
+// Copying a local may trigger the GC, so everything below has to be in place.
+static void regcode_materialize(regcode_gen_t* gen, int pos) {
+    entry_t* entry = &gen->stack[pos];
+    if(entry->type == ENTRY_LOCAL) {
+        reg_t* instr = regcode_emit(gen, R_COPY, pos, entry->slot, 0);
+        instr->live = pos + 1;
+    } else if(entry->type == ENTRY_CONST) {
+        reg_t* instr = regcode_emit(gen, R_LOADK, pos, 0, 0);
+        instr->v = entry->v;
+    }
+    entry->type = ENTRY_SLOT;
+}
+
+// Materializes all values below pos
+static void regcode_flush(regcode_gen_t* gen, int pos) {
+    for(int i = 0; i < pos; i++) {
+        regcode_materialize(gen, i);
+    }
+}
+
+// Slot to read a value from, without taking ownership
+static int regcode_operand(regcode_gen_t* gen, int pos) {
+    entry_t* entry = &gen->stack[pos];
+    if(entry->type == ENTRY_LOCAL) {
+        return entry->slot;
+    }
+    if(entry->type == ENTRY_CONST) {
+        regcode_materialize(gen, pos);
+    }
+    return pos;
+}
+
+static bool regcode_is_const(regcode_gen_t* gen, int pos) {
+    return gen->stack[pos].type == ENTRY_CONST && IS_INT32(gen->stack[pos].v);
+}
+
+static void regcode_push(regcode_gen_t* gen, entry_type_t type, int slot, val_t v) {
+    entry_t* entry = &gen->stack[gen->top++];
+    entry->type = type;
+    entry->slot = slot;
+    entry->v = v;
+}
+
+// A local is written, pending loads of it have to be executed before
+static void regcode_write_local(regcode_gen_t* gen, int slot) {
+    for(int i = 0; i < gen->top; i++) {
+        entry_t* entry = &gen->stack[i];
+        if(entry->type == ENTRY_LOCAL && entry->slot == slot) {
+            regcode_flush(gen, gen->top);
+            return;
+        }
+    }
+}
+
+// Pops the top of the stack into a local slot
+static void regcode_store(regcode_gen_t* gen, int slot) {
+    int pos = gen->top - 1;
+    entry_t* entry = &gen->stack[pos];
+
+    if(entry->type == ENTRY_LOCAL && entry->slot == slot) {
+        gen->top--;
+        return;
+    }
+
+    gen->top--;
+    regcode_write_local(gen, slot);
+    gen->top++;
+
+    if(entry->type == ENTRY_SLOT) {
+        // Let the producer write into the local directly
+        if(gen->last != -1 && gen->code[gen->last].a == pos) {
+            gen->code[gen->last].a = slot;
+            gen->code[gen->last].live = pos;
+        } else {
+            regcode_emit(gen, R_MOV, slot, pos, 0);
+        }
+    } else if(entry->type == ENTRY_LOCAL) {
+        regcode_flush(gen, pos);
+        reg_t* instr = regcode_emit(gen, R_COPY, slot, entry->slot, 0);
+        instr->live = pos;
+    } else {
+        reg_t* instr = regcode_emit(gen, R_LOADK, slot, 0, 0);
+        instr->v = entry->v;
+    }
+    gen->top--;
+    gen->last = -1;
+}
+
+static regop_t regcode_binary(opcode_t op) {
+    switch(op) {
+        case OP_IADD: return R_IADD;
+        case OP_ISUB: return R_ISUB;
+        case OP_IMUL: return R_IMUL;
+        case OP_IDIV: return R_IDIV;
+        case OP_MOD: return R_MOD;
+        case OP_BITL: return R_BITL;
+        case OP_BITR: return R_BITR;
+        case OP_BITAND: return R_BITAND;
+        case OP_BITOR: return R_BITOR;
+        case OP_BITXOR: return R_BITXOR;
+        case OP_FADD: return R_FADD;
+        case OP_FSUB: return R_FSUB;
+        case OP_FMUL: return R_FMUL;
+        case OP_FDIV: return R_FDIV;
+        case OP_BEQ: return R_BEQ;
+        case OP_IEQ: return R_IEQ;
+        case OP_FEQ: return R_FEQ;
+        case OP_BNE: return R_BNE;
+        case OP_INE: return R_INE;
+        case OP_FNE: return R_FNE;
+        case OP_ILT: return R_ILT;
+        case OP_IGT: return R_IGT;
+        case OP_ILE: return R_ILE;
+        case OP_IGE: return R_IGE;
+        case OP_FLT: return R_FLT;
+        case OP_FGT: return R_FGT;
+        case OP_FLE: return R_FLE;
+        case OP_FGE: return R_FGE;
+        case OP_BAND: return R_BAND;
+        case OP_BOR: return R_BOR;
+        default: return R_HLT;
+    }
+}
+
+static regop_t regcode_unary(opcode_t op) {
+    switch(op) {
+        case OP_BITNOT: return R_BITNOT;
+        case OP_IMINUS: return R_IMINUS;
+        case OP_I2F: return R_I2F;
+        case OP_FMINUS: return R_FMINUS;
+        case OP_F2I: return R_F2I;
+        case OP_NOT: return R_NOT;
+        case OP_B2I: return R_B2I;
+        case OP_LEN: return R_LEN;
+        case OP_SLEN: return R_SLEN;
+        default: return R_HLT;
+    }
+}
+
+static regop_t regcode_container(opcode_t op) {
+    switch(op) {
+        case OP_GETSUB: return R_GETSUB;
+        case OP_SETSUB: return R_SETSUB;
+        case OP_APPEND: return R_APPEND;
+        case OP_CONS: return R_CONS;
+        case OP_SGETSUB: return R_SGETSUB;
+        case OP_SSETSUB: return R_SSETSUB;
+        case OP_SAPPEND: return R_SAPPEND;
+        case OP_SCONS: return R_SCONS;
+        default: return R_HLT;
+    }
+}
+
+static regop_t regcode_jump(opcode_t op) {
+    switch(op) {
+        case OP_JIEQ: return R_JIEQ;
+        case OP_JINE: return R_JINE;
+        case OP_JILT: return R_JILT;
+        case OP_JIGT: return R_JIGT;
+        case OP_JILE: return R_JILE;
+        case OP_JIGE: return R_JIGE;
+        case OP_JFEQ: return R_JFEQ;
+        case OP_JFNE: return R_JFNE;
+        case OP_JFLT: return R_JFLT;
+        case OP_JFGT: return R_JFGT;
+        case OP_JFLE: return R_JFLE;
+        case OP_JFGE: return R_JFGE;
+        case OP_JIEQK:
+        case OP_JIEQLK: return R_JIEQK;
+        case OP_JINEK:
+        case OP_JINELK: return R_JINEK;
+        case OP_JILTK:
+        case OP_JILTLK: return R_JILTK;
+        case OP_JIGTK:
+        case OP_JIGTLK: return R_JIGTK;
+        case OP_JILEK:
+        case OP_JILELK: return R_JILEK;
+        case OP_JIGEK:
+        case OP_JIGELK: return R_JIGEK;
+        default: return R_HLT;
+    }
+}
+
+// Translates one stack instruction
+static void regcode_translate(regcode_gen_t* gen, code_t* instr) {
+    int top = gen->top;
+    switch(instr->op) {
+        case OP_HLT: {
+            regcode_emit(gen, R_HLT, 0, 0, 0);
+            break;
+        }
+        case OP_PUSH: {
+            regcode_push(gen, ENTRY_CONST, 0, instr->v);
+            break;
+        }
+        case OP_PUSHK: {
+            // Shares the constant of the bytecode
+            regcode_flush(gen, top);
+            reg_t* code = regcode_emit(gen, R_LOADK, top, 0, 0);
+            code->v = gen->bytecode->constants[instr->a];
+            code->live = top + 1;
+            regcode_produced(gen, top);
+            break;
+        }
+        case OP_POP: {
+            gen->top--;
+            break;
+        }
+        case OP_STORE: {
+            regcode_store(gen, instr->a);
+            break;
+        }
+        case OP_LOAD: {
+            regcode_push(gen, ENTRY_LOCAL, instr->a, NULL_VAL);
+            break;
+        }
+        case OP_LOAD2: {
+            regcode_push(gen, ENTRY_LOCAL, instr->a, NULL_VAL);
+            regcode_push(gen, ENTRY_LOCAL, instr->b, NULL_VAL);
+            break;
+        }
+        case OP_GSTORE: {
+            // Globals are locals of the toplevel frame
+            if(gen->toplevel) {
+                regcode_store(gen, instr->a);
+                break;
+            }
+            regcode_flush(gen, top);
+            reg_t* code = regcode_emit(gen, R_GSTORE, 0, top-1, 0);
+            code->x = instr->a;
+            gen->top--;
+            break;
+        }
+        case OP_GLOAD: {
+            if(gen->toplevel) {
+                regcode_push(gen, ENTRY_LOCAL, instr->a, NULL_VAL);
+                break;
+            }
+            regcode_flush(gen, top);
+            reg_t* code = regcode_emit(gen, R_GLOAD, top, 0, 0);
+            code->x = instr->a;
+            code->live = top + 1;
+            regcode_produced(gen, top);
+            break;
+        }
+        case OP_LDARG0:
+        case OP_LDFIELD:
+        case OP_CLASS: {
+            regcode_flush(gen, top);
+            regop_t op = instr->op == OP_LDARG0 ? R_LDARG0
+                : (instr->op == OP_LDFIELD ? R_LDFIELD : R_CLASS);
+            reg_t* code = regcode_emit(gen, op, top, 0, 0);
+            code->x = instr->a;
+            code->live = top + 1;
+            regcode_produced(gen, top);
+            break;
+        }
+        case OP_BORROW: {
+            // The receiver is moved, not copied
+            regcode_flush(gen, top);
+            regcode_emit(gen, R_MOV, top, instr->a, 0)->live = top + 1;
+            regcode_produced(gen, top);
+            break;
+        }
+        case OP_GBORROW:
+        case OP_BORROW0: {
+            regcode_flush(gen, top);
+            reg_t* code;
+            if(instr->op == OP_BORROW0) {
+                code = regcode_emit(gen, R_BORROW0, top, 0, 0);
+            } else if(gen->toplevel) {
+                code = regcode_emit(gen, R_MOV, top, instr->a, 0);
+            } else {
+                code = regcode_emit(gen, R_GBORROW, top, 0, 0);
+                code->x = instr->a;
+            }
+            code->live = top + 1;
+            regcode_produced(gen, top);
+            break;
+        }
+        case OP_SETARG0: {
+            regcode_flush(gen, top);
+            regcode_emit(gen, R_SETARG0, 0, top-1, 0);
+            gen->top--;
+            break;
+        }
+        case OP_UPVAL: {
+            regcode_flush(gen, top);
+            reg_t* code = regcode_emit(gen, R_UPVAL, top, instr->b, 0);
+            code->x = instr->a;
+            code->live = top + 1;
+            regcode_produced(gen, top);
+            break;
+        }
+        case OP_UPSTORE: {
+            regcode_flush(gen, top);
+            reg_t* code = regcode_emit(gen, R_UPSTORE, instr->b, top-1, 0);
+            code->x = instr->a;
+            gen->top--;
+            break;
+        }
+        case OP_IADD:
+        case OP_ISUB: {
+            // Integer immediates
+            int pos = top - 2;
+            regop_t op = instr->op == OP_IADD ? R_IADDK : R_ISUBK;
+            if(regcode_is_const(gen, pos+1)) {
+                int k = AS_INT32(gen->stack[pos+1].v);
+                int b = regcode_operand(gen, pos);
+                regcode_emit(gen, op, pos, b, 0)->k = k;
+                regcode_produced(gen, pos);
+                break;
+            }
+            if(instr->op == OP_IADD && regcode_is_const(gen, pos)) {
+                int k = AS_INT32(gen->stack[pos].v);
+                int b = regcode_operand(gen, pos+1);
+                regcode_emit(gen, op, pos, b, 0)->k = k;
+                regcode_produced(gen, pos);
+                break;
+            }
+        }
+        // Fallthrough
+        case OP_IMUL:
+        case OP_IDIV:
+        case OP_MOD:
+        case OP_BITL:
+        case OP_BITR:
+        case OP_BITAND:
+        case OP_BITOR:
+        case OP_BITXOR:
+        case OP_FADD:
+        case OP_FSUB:
+        case OP_FMUL:
+        case OP_FDIV:
+        case OP_BEQ:
+        case OP_IEQ:
+        case OP_FEQ:
+        case OP_BNE:
+        case OP_INE:
+        case OP_FNE:
+        case OP_ILT:
+        case OP_IGT:
+        case OP_ILE:
+        case OP_IGE:
+        case OP_FLT:
+        case OP_FGT:
+        case OP_FLE:
+        case OP_FGE:
+        case OP_BAND:
+        case OP_BOR: {
+            int pos = top - 2;
+            int b = regcode_operand(gen, pos);
+            int c = regcode_operand(gen, pos+1);
+            regcode_emit(gen, regcode_binary(instr->op), pos, b, c);
+            regcode_produced(gen, pos);
+            break;
+        }
+        case OP_IADDLK:
+        case OP_ISUBLK: {
+            regop_t op = instr->op == OP_IADDLK ? R_IADDK : R_ISUBK;
+            regcode_emit(gen, op, top, instr->a, 0)->k = instr->b;
+            regcode_produced(gen, top);
+            break;
+        }
+        case OP_ILTLK: {
+            reg_t* code = regcode_emit(gen, R_LOADK, top, 0, 0);
+            code->v = INT32_VAL(instr->b);
+            regcode_emit(gen, R_ILT, top, instr->a, top);
+            regcode_produced(gen, top);
+            break;
+        }
+        case OP_BITNOT:
+        case OP_IMINUS:
+        case OP_I2F:
+        case OP_FMINUS:
+        case OP_F2I:
+        case OP_NOT:
+        case OP_B2I:
+        case OP_LEN:
+        case OP_SLEN: {
+            int pos = top - 1;
+            int b = regcode_operand(gen, pos);
+            regcode_emit(gen, regcode_unary(instr->op), pos, b, 0);
+            regcode_produced(gen, pos);
+            break;
+        }
+        case OP_TOSTR:
+        case OP_GETFIELD: {
+            int pos = top - 1;
+            regcode_flush(gen, pos);
+            int b = regcode_operand(gen, pos);
+            reg_t* code = regcode_emit(gen, instr->op == OP_TOSTR ? R_TOSTR : R_GETFIELD, pos, b, 0);
+            code->x = instr->a;
+            code->live = pos + 1;
+            regcode_produced(gen, pos);
+            break;
+        }
+        case OP_GETSUB:
+        case OP_APPEND:
+        case OP_CONS:
+        case OP_SGETSUB:
+        case OP_SAPPEND:
+        case OP_SCONS: {
+            int pos = top - 2;
+            regcode_flush(gen, pos);
+            int b = regcode_operand(gen, pos);
+            int c = regcode_operand(gen, pos+1);
+            regcode_emit(gen, regcode_container(instr->op), pos, b, c)->live = pos + 1;
+            regcode_produced(gen, pos);
+            break;
+        }
+        case OP_SETSUB:
+        case OP_SSETSUB: {
+            // The value is moved into the copied object
+            int pos = top - 3;
+            regcode_flush(gen, pos + 1);
+            int b = regcode_operand(gen, pos+1);
+            int c = regcode_operand(gen, pos+2);
+            regcode_emit(gen, regcode_container(instr->op), pos, b, c)->live = pos + 1;
+            gen->stack[pos].type = ENTRY_SLOT;
+            gen->top = pos + 1;
+            break;
+        }
+        case OP_SETFIELD: {
+            // The class is modified in place, so it has to be a copy
+            regcode_flush(gen, top);
+            regcode_emit(gen, R_SETFIELD, top-2, top-1, 0)->x = instr->a;
+            gen->top--;
+            break;
+        }
+        case OP_STFIELD: {
+            regcode_flush(gen, top);
+            regcode_emit(gen, R_STFIELD, 0, top-1, 0)->x = instr->a;
+            gen->top--;
+            break;
+        }
+        case OP_ARR:
+        case OP_STR: {
+            int pos = top - instr->a;
+            regcode_flush(gen, top);
+            reg_t* code = regcode_emit(gen, instr->op == OP_ARR ? R_ARR : R_STR, pos, 0, 0);
+            code->x = instr->a;
+            code->live = pos + 1;
+            gen->stack[pos].type = ENTRY_SLOT;
+            gen->top = pos + 1;
+            break;
+        }
+        case OP_INCL:
+        case OP_GINC: {
+            if(instr->op == OP_GINC && !gen->toplevel) {
+                regcode_emit(gen, R_GINC, 0, 0, 0);
+                gen->code[gen->size-1].x = instr->a;
+                gen->code[gen->size-1].k = instr->b;
+                break;
+            }
+            regcode_write_local(gen, instr->a);
+            regcode_emit(gen, R_INCL, instr->a, 0, 0)->k = instr->b;
+            break;
+        }
+        case OP_ADDL: {
+            regcode_write_local(gen, instr->a);
+            regcode_emit(gen, R_ADDL, instr->a, instr->b, 0);
+            break;
+        }
+        case OP_FORL:
+        case OP_FORIN: {
+            regcode_flush(gen, top);
+            reg_t* code = regcode_emit(gen, instr->op == OP_FORL ? R_FORL : R_FORIN, instr->b, 0, 0);
+            code->x = instr->a;
+            break;
+        }
+        case OP_SWITCH: {
+            // The entries are translated one by one, right after it
+            int pos = top - 1;
+            regcode_flush(gen, pos);
+            int b = regcode_operand(gen, pos);
+            reg_t* code = regcode_emit(gen, R_SWITCH, 0, b, 0);
+            code->k = instr->a;
+            code->x = instr->b;
+            gen->top = pos;
+            break;
+        }
+        case OP_CASE: {
+            regcode_emit(gen, R_CASE, 0, 0, 0)->x = instr->a;
+            break;
+        }
+        case OP_SYSCALL:
+        case OP_INVOKE: {
+            regcode_flush(gen, top);
+            int pos = top - CALL_ARGS(instr->b);
+            bool call = instr->op == OP_INVOKE;
+            reg_t* code = regcode_emit(gen, call ? R_CALL : R_SYSCALL, pos, CALL_ARGS(instr->b), 0);
+            code->x = instr->a;
+            if(call) {
+                code->c = gen->frame[instr->a];
+            }
+
+            // Virtual calls leave the class on top of the return value,
+            // void calls return nothing
+            if(instr->b & CALL_VOID) {
+                gen->top = pos;
+                break;
+            }
+            gen->stack[pos].type = ENTRY_SLOT;
+            gen->top = pos + 1;
+            break;
+        }
+        case OP_TAILCALL: {
+            regcode_flush(gen, top);
+            int count = TAIL_ARGS(instr->b) + ((instr->b & TAIL_CALLEE_VIRTUAL) ? 1 : 0);
+            reg_t* code = regcode_emit(gen, R_TAILCALL, top - count, instr->b, gen->frame[instr->a]);
+            code->x = instr->a;
+            break;
+        }
+        case OP_ENTER: {
+            regcode_emit(gen, R_ENTER, 0, 0, 0)->x = instr->a;
+            break;
+        }
+        case OP_RESERVE: {
+            if(instr->a < 0) {
+                gen->top += instr->a;
+                break;
+            }
+            for(int i = 0; i < instr->a; i++) {
+                regcode_push(gen, ENTRY_SLOT, 0, NULL_VAL);
+            }
+            break;
+        }
+        case OP_RET:
+        case OP_RETVIRTUAL: {
+            int b = regcode_operand(gen, top-1);
+            regcode_emit(gen, instr->op == OP_RET ? R_RET : R_RETVIRTUAL, 0, b, 0);
+            break;
+        }
+        case OP_RETVOID: {
+            regcode_emit(gen, R_RETVOID, 0, 0, 0);
+            break;
+        }
+        case OP_JMP: {
+            regcode_flush(gen, top);
+            regcode_emit(gen, R_JMP, 0, 0, 0)->x = instr->a;
+            break;
+        }
+        case OP_STOREJMP: {
+            regcode_store(gen, instr->b);
+            regcode_flush(gen, gen->top);
+            regcode_emit(gen, R_JMP, 0, 0, 0)->x = instr->a;
+            break;
+        }
+        case OP_JMPF: {
+            int pos = top - 1;
+            regcode_flush(gen, pos);
+            int b = regcode_operand(gen, pos);
+            regcode_emit(gen, R_JMPF, 0, b, 0)->x = instr->a;
+            gen->top = pos;
+            break;
+        }
+        case OP_JIEQ:
+        case OP_JINE:
+        case OP_JILT:
+        case OP_JIGT:
+        case OP_JILE:
+        case OP_JIGE:
+        case OP_JFEQ:
+        case OP_JFNE:
+        case OP_JFLT:
+        case OP_JFGT:
+        case OP_JFLE:
+        case OP_JFGE: {
+            int pos = top - 2;
+            regcode_flush(gen, pos);
+            int b = regcode_operand(gen, pos);
+            if(instr->op <= OP_JIGE && regcode_is_const(gen, pos+1)) {
+                reg_t* code = regcode_emit(gen, R_JIEQK + (instr->op - OP_JIEQ), 0, b, 0);
+                code->k = AS_INT32(gen->stack[pos+1].v);
+                code->x = instr->a;
+            } else {
+                int c = regcode_operand(gen, pos+1);
+                regcode_emit(gen, regcode_jump(instr->op), 0, b, c)->x = instr->a;
+            }
+            gen->top = pos;
+            break;
+        }
+        case OP_JIEQK:
+        case OP_JINEK:
+        case OP_JILTK:
+        case OP_JIGTK:
+        case OP_JILEK:
+        case OP_JIGEK: {
+            int pos = top - 1;
+            regcode_flush(gen, pos);
+            int b = regcode_operand(gen, pos);
+            reg_t* code = regcode_emit(gen, regcode_jump(instr->op), 0, b, 0);
+            code->k = instr->b;
+            code->x = instr->a;
+            gen->top = pos;
+            break;
+        }
+        case OP_JIEQLK:
+        case OP_JINELK:
+        case OP_JILTLK:
+        case OP_JIGTLK:
+        case OP_JILELK:
+        case OP_JIGELK: {
+            regcode_flush(gen, top);
+            reg_t* code = regcode_emit(gen, regcode_jump(instr->op), 0, SLOT_OF(instr->b), 0);
+            code->k = IMM_OF(instr->b);
+            code->x = instr->a;
+            break;
+        }
+        default: break;
+    }
+}
+
+static bool regcode_has_address(regop_t op) {
+    return op == R_JMP || op == R_JMPF || op == R_CALL || op == R_TAILCALL
+        || op == R_FORL || op == R_FORIN || op == R_CASE || (op >= R_JIEQ && op <= R_JIGEK);
+}
+
+regcode_t* regcode_gen(bytecode_t* bytecode) {
+    size_t size = bytecode->size;
+    regcode_gen_t* gen = calloc(1, sizeof(regcode_gen_t));
+    gen->bytecode = bytecode;
+    gen->depth = malloc(sizeof(int) * (size + 1));
+    gen->func = malloc(sizeof(int) * (size + 1));
+    gen->frame = malloc(sizeof(int) * (size + 1));
+    gen->targets = calloc(size + 1, sizeof(bool));
+    gen->map = malloc(sizeof(int) * (size + 1));
+    gen->capacity = 64;
+    gen->code = malloc(sizeof(reg_t) * gen->capacity);
+    gen->last = -1;
+
+    regcode_t* regcode = 0;
+    if(!regcode_analyze(gen)) {
+        goto cleanup;
+    }
+
+    for(size_t i = 0; i < size; i++) {
+        code_t* instr = &bytecode->code[i];
+        if(op_has_address(instr->op) && instr->a >= 0 && (size_t)instr->a <= size) {
+            gen->targets[instr->a] = true;
+        }
+    }
+
+    // Translate reachable instructions,
+    // at every jump target the stack is in place
+    bool reachable = false;
+    for(size_t i = 0; i < size; i++) {
+        if(gen->depth[i] == -1) {
+            gen->map[i] = gen->size;
+            reachable = false;
+            continue;
+        }
+
+        // Values falling through are materialized before the target
+        if(gen->targets[i] || !reachable) {
+            if(reachable) {
+                regcode_flush(gen, gen->top);
+            }
+            gen->top = gen->depth[i];
+            for(int j = 0; j < gen->top; j++) {
+                gen->stack[j].type = ENTRY_SLOT;
+            }
+            gen->last = -1;
+        }
+        gen->map[i] = gen->size;
+
+        gen->toplevel = gen->func[i] == 0;
+        code_t* instr = &bytecode->code[i];
+        regcode_translate(gen, instr);
+        reachable = !op_is_terminator(instr->op);
+    }
+    gen->map[size] = gen->size;
+
+    // Jump position if an error occurs
+    regcode_emit(gen, R_HLT, 0, 0, 0);
+
+    for(size_t i = 0; i < gen->size; i++) {
+        reg_t* instr = &gen->code[i];
+        if(regcode_has_address(instr->op)) {
+            instr->x = gen->map[instr->x];
+        }
+    }
+
+    regcode = malloc(sizeof(regcode_t));
+    regcode->code = gen->code;
+    regcode->size = gen->size;
+    regcode->frame = gen->frame[0];
+    gen->code = 0;
+
+cleanup:
+    free(gen->code);
+    free(gen->depth);
+    free(gen->func);
+    free(gen->frame);
+    free(gen->targets);
+    free(gen->map);
+    free(gen);
+    return regcode;
+}
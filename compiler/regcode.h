@@ -0,0 +1,27 @@
+/**
+ * regcode.h
+ * Copyright (C) 2017 Alexander Koch
+ * Translates loaded stack bytecode into register code (see vm/regvm.h).
+ *
+ * Every stack position of a frame becomes a frame slot,
+ * so the frame layout and the calling convention stay the same.
+ * Loads of locals and constants are not executed, but kept on a
+ * symbolic stack and used directly as operands by the consuming instruction.
+ * They are materialized before jumps, calls and allocations,
+ * so that the GC always sees a consistent frame.
+ */
+
+#ifndef regcode_h
+#define regcode_h
+
+#include "../vm/bytecode.h"
+#include "../vm/regvm.h"
+
+/**
+ * Generates the register code of a program.
+ * Returns NULL if the bytecode was not verified, has exception handlers
+ * or a frame is too large, the program has to run on the stack VM then.
+ */
+regcode_t* regcode_gen(bytecode_t* bytecode);
+
+#endif
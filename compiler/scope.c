@@ -62,3 +62,35 @@ bool scope_is_class(scope_t* scope, ast_class_t class, ast_t** node) {
 void scope_unflag(scope_t* scope) {
     scope->flag = 0;
 }
+
+typedef struct {
+    int* relocation;
+    size_t size;
+} relocation_t;
+
+int relocateSymbol(void* arg, void* val) {
+    symbol_t* symbol = arg;
+    relocation_t* relocation = val;
+    bool code = symbol->node->class == AST_DECLFUNC || symbol->node->class == AST_CLASS;
+    if(code && symbol->address >= 0 && (size_t)symbol->address <= relocation->size) {
+        symbol->address = relocation->relocation[symbol->address];
+    }
+    return 0;
+}
+
+// Scope.relocate()
+// Moves the bytecode addresses of functions and classes,
+// after the optimizer changed the code (see optimize_buffer).
+// size is the size of the code before. Functions that were removed
+// address the code that followed them.
+void scope_relocate(scope_t* scope, int* relocation, size_t size) {
+    relocation_t table = {relocation, size};
+    hashmap_foreach(scope->symbols, relocateSymbol, &table);
+
+    list_iterator_t* liter = list_iterator_create(scope->subscopes);
+    while(!list_iterator_end(liter)) {
+        scope_t* subscope = list_iterator_next(liter);
+        scope_relocate(subscope, relocation, size);
+    }
+    list_iterator_free(liter);
+}
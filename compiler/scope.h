@@ -22,6 +22,9 @@
  * Variable => immutable / mutable + name + type
  * Function => name + returntype
  * Class    => name + functions + attributes / variables
+ *
+ * An alias variable holds an object owned by another one
+ * (the element of an array in a for loop), it is never borrowed.
  */
 typedef struct symbol_t {
     ast_t* node;
@@ -31,6 +34,7 @@ typedef struct symbol_t {
     bool isClassParam;
     struct symbol_t* owner;
     int arraySize;
+    bool alias;
 } symbol_t;
 
 // Scope: contains symbols
@@ -50,5 +54,6 @@ void scope_free(scope_t* scope);
 bool scope_requests(scope_t* scope, annotation_t ann);
 bool scope_is_class(scope_t* scope, ast_class_t class, ast_t** node);
 void scope_unflag(scope_t* scope);
+void scope_relocate(scope_t* scope, int* relocation, size_t size);
 
 #endif
@@ -27,39 +27,54 @@ bool serialize_value(FILE* fp, val_t val) {
     return true;
 }
 
-bool serialize_instruction(FILE* fp, instruction_t* ins) {
+bool serialize_instruction(FILE* fp, code_t* ins) {
     bool valid = true;
     uint8_t opcode = ins->op;
     fwrite((const void*)&opcode, sizeof(uint8_t), 1, fp);
 
+    // Integer operands are stored as values,
+    // so the file format stays independent of the packed layout
+    operand_t operands = op_operands(ins->op);
     uint8_t args = 0;
-    if(ins->v1 != NULL_VAL) args++;
-    if(ins->v2 != NULL_VAL) args++;
+    if(operands == OPERAND_VAL || operands == OPERAND_INT) args = 1;
+    if(operands == OPERAND_INT2) args = 2;
     fwrite((const void*)&args, sizeof(uint8_t), 1, fp);
 
-    if(args > 0) {
-        valid &= serialize_value(fp, ins->v1);
+    if(operands == OPERAND_VAL) {
+        valid &= serialize_value(fp, ins->v);
+    }
+    if(args > 0 && operands != OPERAND_VAL) {
+        valid &= serialize_value(fp, INT32_VAL(ins->a));
     }
     if(args > 1) {
-        valid &= serialize_value(fp, ins->v2);
+        valid &= serialize_value(fp, INT32_VAL(ins->b));
     }
 
     return valid;
 }
 
-bool serialize(const char* filename, vector_t* buffer) {
+bool serialize(const char* filename, bytecode_t* bytecode) {
     FILE* fp = fopen(filename, "wb");
     if(!fp) return false;
 
     // Write magic number + amount of instructions to fetch
     uint32_t magic = 0xACCE55;
-    uint32_t codes = vector_size(buffer);
+    uint32_t codes = bytecode->size;
     fwrite((const void*)&magic, sizeof(uint32_t), 1, fp);
     fwrite((const void*)&codes, sizeof(uint32_t), 1, fp);
 
     bool valid = true;
-    for(size_t i = 0; i < vector_size(buffer); i++) {
-        instruction_t* ins = vector_get(buffer, i);
+    for(size_t i = 0; i < bytecode->size; i++) {
+        code_t* ins = &bytecode->code[i];
+
+        // Constants are stored inline, the load step interns them again
+        if(ins->op == OP_PUSHK) {
+            code_t push;
+            push.op = OP_PUSH;
+            push.v = bytecode->constants[ins->a];
+            valid &= serialize_instruction(fp, &push);
+            continue;
+        }
         valid &= serialize_instruction(fp, ins);
     }
 
@@ -67,37 +82,45 @@ bool serialize(const char* filename, vector_t* buffer) {
     return valid;
 }
 
-val_t deserialize_value(FILE* fp) {
-    val_t ret = NULL_VAL;
-
+// Reads a value into out. Returns false if the file ends
+// or the value does not match its tag: the raw bits of numbers
+// and bools must not carry the tag of an object.
+bool deserialize_value(FILE* fp, val_t* out) {
     // Read the tag
     uint8_t tag = 0;
-    fread(&tag, sizeof(uint8_t), 1, fp);
-
-    // If not string, read directly
-    if(tag != TAG_STR) {
-        fread(&ret, sizeof(val_t), 1, fp);
+    if(fread(&tag, sizeof(uint8_t), 1, fp) != 1) return false;
+
+    // Numbers and bools are read directly
+    if(tag == TAG_NUM || tag == TAG_BOOL) {
+        val_t val;
+        if(fread(&val, sizeof(val_t), 1, fp) != 1) return false;
+        if(tag == TAG_NUM ? !IS_NUM(val) : !IS_BOOL(val)) return false;
+        *out = val;
+        return true;
     }
-    // Otherwise, read the length, then the string data
-    else {
-        uint32_t len = 0;
-        fread(&len, sizeof(uint32_t), 1, fp);
-        if(len <= 0) return ret;
-
-        char* str = malloc(sizeof(char) * (len+1));
-        fread((char*)str, sizeof(char), len, fp);
-        str[len] = '\0';
-        ret = STRING_NOCOPY_VAL(str);
+    if(tag != TAG_STR) return false;
+
+    // Strings: read the length, then the string data
+    uint32_t len = 0;
+    if(fread(&len, sizeof(uint32_t), 1, fp) != 1) return false;
+
+    char* str = malloc(sizeof(char) * ((size_t)len+1));
+    if(!str) return false;
+    if(fread((char*)str, sizeof(char), len, fp) != len) {
+        free(str);
+        return false;
     }
-    return ret;
+    str[len] = '\0';
+    *out = STRING_NOCOPY_VAL(str);
+    return true;
 }
 
-bool deserialize(const char* filename, vector_t** out) {
+bool deserialize(const char* filename, bytecode_t** out) {
     FILE* fp = fopen(filename, "rb");
     if(!fp) return false;
 
     // Read the magic number + the code size
-    uint32_t magic, codes;
+    uint32_t magic = 0, codes = 0;
     fread(&magic, sizeof(uint32_t), 1, fp);
     fread(&codes, sizeof(uint32_t), 1, fp);
 
@@ -106,24 +129,33 @@ bool deserialize(const char* filename, vector_t** out) {
         return false;
     }
 
-    // Read the instructions
+    // Read the instructions, then run the load step
+    vector_t* buffer = vector_new();
     for(uint32_t i = 0; i < codes; i++) {
         instruction_t* ins = malloc(sizeof(*ins));
         ins->v1 = NULL_VAL;
         ins->v2 = NULL_VAL;
 
         // First get the header
-        uint8_t op, args;
-        fread(&op, sizeof(uint8_t), 1, fp);
-        fread(&args, sizeof(uint8_t), 1, fp);
+        uint8_t op = 0, args = 0;
+        bool valid = fread(&op, sizeof(uint8_t), 1, fp) == 1
+            && fread(&args, sizeof(uint8_t), 1, fp) == 1;
         ins->op = op;
-
-        // Read the values
-        if(args > 0) ins->v1 = deserialize_value(fp);
-        if(args > 1) ins->v2 = deserialize_value(fp);
-        vector_push((*out), ins);
+        vector_push(buffer, ins);
+
+        // Read the values, a malformed file is rejected
+        // before the load step looks at them
+        if(valid && args > 0) valid = deserialize_value(fp, &ins->v1);
+        if(valid && args > 1) valid = deserialize_value(fp, &ins->v2);
+        if(!valid) {
+            fclose(fp);
+            bytecode_buffer_free(buffer);
+            return false;
+        }
     }
 
     fclose(fp);
+    *out = bytecode_load(buffer);
+    bytecode_buffer_free(buffer);
     return true;
 }
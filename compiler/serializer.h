@@ -1,7 +1,7 @@
 /**
  * serializer.h
  * Copyright (C) 2017 Alexander Koch
- * Converts a list of bytecodes into a *.gvm-file and vice versa.
+ * Converts loaded bytecode into a *.gvm-file and vice versa.
  */
 
 #ifndef serializer_h
@@ -40,7 +40,7 @@
 #define TAG_BOOL 2
 #define TAG_STR 3
 
-bool serialize(const char* filename, vector_t* buffer);
-bool deserialize(const char* filename, vector_t** out);
+bool serialize(const char* filename, bytecode_t* bytecode);
+bool deserialize(const char* filename, bytecode_t** out);
 
 #endif
@@ -44,6 +44,7 @@ const char* token_string(token_type_t type) {
         case TOKEN_COLON: return ":";
         case TOKEN_ARROW: return "->";
         case TOKEN_AT: return "@";
+        case TOKEN_RANGE: return "...";
         case TOKEN_USING: return "using";
         case TOKEN_LET: return "let";
         case TOKEN_MUT: return "mut";
@@ -51,8 +52,11 @@ const char* token_string(token_type_t type) {
         case TOKEN_IF: return "if";
         case TOKEN_ELSE: return "else";
         case TOKEN_WHILE: return "while";
+        case TOKEN_FOR: return "for";
         case TOKEN_TYPE: return "type";
         case TOKEN_RETURN: return "return";
+        case TOKEN_TRY: return "try";
+        case TOKEN_CATCH: return "catch";
         case TOKEN_NONE: return "None";
         default: return "undefined";
     }
@@ -79,8 +83,11 @@ token_type_t keywords[] = {
     TOKEN_IF,
     TOKEN_ELSE,
     TOKEN_WHILE,
+    TOKEN_FOR,
     TOKEN_TYPE,
     TOKEN_RETURN,
+    TOKEN_TRY,
+    TOKEN_CATCH,
     TOKEN_NONE,
 };
 
@@ -216,6 +223,7 @@ int lex_op(lexer_t* lexer, token_t* token) {
         RESERVED_ENTRY(":=", TOKEN_ASSIGN),
         RESERVED_ENTRY("!=", TOKEN_NEQUAL),
         RESERVED_ENTRY("!", TOKEN_NOT),
+        RESERVED_ENTRY("...", TOKEN_RANGE),
         RESERVED_ENTRY(".", TOKEN_DOT),
         RESERVED_ENTRY("<<", TOKEN_BITLSHIFT),
         RESERVED_ENTRY("<=", TOKEN_LEQUAL),
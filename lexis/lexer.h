@@ -80,6 +80,7 @@ typedef enum {
     TOKEN_COLON,     // ':'
     TOKEN_ARROW,     // '->'
     TOKEN_AT,        // '@'
+    TOKEN_RANGE,     // '...'
 
     // Keywords
     TOKEN_USING,
@@ -89,8 +90,11 @@ typedef enum {
     TOKEN_IF,
     TOKEN_ELSE,
     TOKEN_WHILE,
+    TOKEN_FOR,
     TOKEN_TYPE,
     TOKEN_RETURN,
+    TOKEN_TRY,
+    TOKEN_CATCH,
     TOKEN_NONE,
 } token_type_t;
 
@@ -21,18 +21,19 @@ int corelib_fn_count = 7;
  * 05 break
  * 06 clock
  * 07 sysarg
+ *
+ * class list:
+ * Exception
  */
 
 void core_print(vm_t* vm) {
 	val_print(vm_pop(vm));
 	fflush(stdout); //perhaps adding it in val_print instead of here ?
-	vm_push(vm, NULL_VAL);
 }
 
 void core_println(vm_t* vm) {
 	val_print(vm_pop(vm));
 	putchar('\n');
-    vm_push(vm, NULL_VAL);
 }
 
 void core_getline(vm_t* vm) {
@@ -53,7 +54,6 @@ void core_parseFloat(vm_t* vm) {
 
 void core_break(vm_t* vm) {
 	getchar();
-	vm_push(vm, NULL_VAL);
 }
 
 void core_clock(vm_t* vm) {
@@ -115,5 +115,31 @@ int core_gen_signatures(context_t* context, list_t* toplevel) {
 	function_add_param(NULL, int_type);
 	function_upload(toplevel);
 
+	/**
+	Thrown by the VM (see vm_raise), the message is the only field:
+
+	type Exception(_message:char[]) {
+		@Getter
+		let message = _message
+	}
+	**/
+
+	ast_t *var = 0, *clazz = 0, *ann = 0;
+
+	// type Exception(_message:char[]) {
+	class_new("Exception");
+	class_add_param("_message", string_type);
+
+	// @Getter
+	annotation_new(ANN_GETTER);
+	annotation_upload(clazz->classstmt.body);
+
+	// let message = _message
+	variable_new("message", string_type);
+	var->vardecl.initializer = ast_class_create(AST_IDENT, loc);
+	var->vardecl.initializer->ident = strdup("_message");
+	variable_upload(clazz->classstmt.body);
+	class_upload(toplevel);
+
 	return 0;
 }
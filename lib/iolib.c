@@ -32,7 +32,6 @@ void io_writeFile(vm_t* vm) {
         fprintf(fp, "%s", content);
     	fclose(fp);
     }
-	vm_push(vm, NULL_VAL);
 }
 
 int io_gen_signatures(context_t* context, list_t* toplevel) {
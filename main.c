@@ -20,6 +20,7 @@
 #include "compiler/compiler.h"
 #include "compiler/serializer.h"
 #include "compiler/graphviz.h"
+#include "compiler/regcode.h"
 
 void print_info(void) {
     printf("Golem compiler / Nspire port v2.0b\n");
@@ -31,13 +32,27 @@ int main(int argc, char** argv) {
 	enable_relative_paths(argv); //allow relative paths. Don't know if it'll work for every function ?
 
     seed_prng(time(0));
-    vm_t vm = {0};
+    vm_t vm;
+    vm_init(&vm, STACK_LIMIT);
 
     if(argc == 2) {
         // Generate and execute bytecode (Interpreter)
         vector_t* buffer = compile_file(argv[1]);
         if(buffer) {
-            vm_run_args(&vm, buffer, argc, argv);
+            bytecode_t* bytecode = bytecode_load(buffer);
+#ifdef REGVM
+            // Register VM, if the code can be translated
+            regcode_t* regcode = regcode_gen(bytecode);
+            if(regcode) {
+                regvm_run_args(&vm, regcode, argc, argv);
+                regcode_free(regcode);
+            } else {
+                vm_run_args(&vm, bytecode, argc, argv);
+            }
+#else
+            vm_run_args(&vm, bytecode, argc, argv);
+#endif
+            bytecode_free(bytecode);
         }
         bytecode_buffer_free(buffer);
         }*/
@@ -47,6 +62,7 @@ int main(int argc, char** argv) {
 
         print_info();
     }
+    vm_free(&vm);
 
 #ifndef NO_MEMINFO
     mem_leak_check();
@@ -28,9 +28,11 @@ const char* ast_classname(ast_class_t class) {
         case AST_IF: return "if condition";
         case AST_IFCLAUSE: return "if clause";
         case AST_WHILE: return "while loop";
+        case AST_FOR: return "for loop";
         case AST_IMPORT: return "import";
         case AST_CLASS: return "class";
         case AST_RETURN: return "return";
+        case AST_TRY: return "try statement";
         case AST_BLOCK: return "block";
         case AST_ANNOTATION: return "annotation";
         case AST_NONE: return "none";
@@ -135,6 +137,18 @@ void ast_free(ast_t* ast) {
             ast_free(ast->whilestmt.cond);
             break;
         }
+        case AST_FOR: {
+            iter = list_iterator_create(ast->forstmt.body);
+            while(!list_iterator_end(iter)) {
+                ast_free(list_iterator_next(iter));
+            }
+            list_iterator_free(iter);
+            list_free(ast->forstmt.body);
+            ast_free(ast->forstmt.var);
+            ast_free(ast->forstmt.expr);
+            ast_free(ast->forstmt.to);
+            break;
+        }
         case AST_IMPORT: {
             free(ast->import);
             break;
@@ -164,6 +178,22 @@ void ast_free(ast_t* ast) {
             ast_free(ast->returnstmt);
             break;
         }
+        case AST_TRY: {
+            iter = list_iterator_create(ast->trystmt.body);
+            while(!list_iterator_end(iter)) {
+                ast_free(list_iterator_next(iter));
+            }
+            list_free(ast->trystmt.body);
+
+            list_iterator_reset(iter, ast->trystmt.handler);
+            while(!list_iterator_end(iter)) {
+                ast_free(list_iterator_next(iter));
+            }
+            list_iterator_free(iter);
+            list_free(ast->trystmt.handler);
+            ast_free(ast->trystmt.var);
+            break;
+        }
         case AST_BLOCK: {
             iter = list_iterator_create(ast->block);
             while(!list_iterator_end(iter)) {
@@ -352,6 +382,25 @@ void ast_dump(ast_t* node, int level) {
             putchar(')');
             break;
         }
+        case AST_FOR: {
+            printf("(for name='%s'\n", node->forstmt.var->vardecl.name);
+            ast_dump(node->forstmt.expr, level+1);
+            if(node->forstmt.to) {
+                putchar('\n');
+                ast_dump(node->forstmt.to, level+1);
+            }
+            printf(")\n");
+
+            list_iterator_t* iter = list_iterator_create(node->forstmt.body);
+            while(!list_iterator_end(iter)) {
+                ast_t* next = list_iterator_next(iter);
+                ast_dump(next, level+1);
+                if(!list_iterator_end(iter)) putchar('\n');
+            }
+            list_iterator_free(iter);
+            putchar(')');
+            break;
+        }
         case AST_IMPORT: {
             printf("(import %s)", node->import);
             break;
@@ -382,6 +431,28 @@ void ast_dump(ast_t* node, int level) {
             putchar(')');
             break;
         }
+        case AST_TRY: {
+            printf("(try\n");
+            list_iterator_t* iter = list_iterator_create(node->trystmt.body);
+            while(!list_iterator_end(iter)) {
+                ast_t* next = list_iterator_next(iter);
+                ast_dump(next, level+1);
+                putchar('\n');
+            }
+
+            for(int i = 0; i < level+1; i++) printf("  ");
+            printf("(catch\n");
+            ast_dump(node->trystmt.var, level+2);
+            list_iterator_reset(iter, node->trystmt.handler);
+            while(!list_iterator_end(iter)) {
+                ast_t* next = list_iterator_next(iter);
+                putchar('\n');
+                ast_dump(next, level+2);
+            }
+            list_iterator_free(iter);
+            printf("))");
+            break;
+        }
         case AST_BLOCK: {
             list_iterator_t* iter = list_iterator_create(node->block);
             while(!list_iterator_end(iter)) {
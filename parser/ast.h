@@ -26,10 +26,12 @@ typedef struct ast_s ast_t;
 // @Getter
 // @Setter
 // @Unused
+// @Exception
 typedef enum {
     ANN_GETTER = 1 << 1,
     ANN_SETTER = 1 << 2,
-    ANN_UNUSED = 1 << 3
+    ANN_UNUSED = 1 << 3,
+    ANN_EXCEPTION = 1 << 4
 } annotation_t;
 
 // ast_class_t
@@ -51,9 +53,11 @@ typedef enum {
 // AST_IF         -> stores a ifclauses / an if-statement
 // AST_IFCLAUSE   -> stores a sub-if-clause, can also be else if there is no condition
 // AST_WHILE      -> stores a while loop
+// AST_FOR        -> stores a for loop over a range or an array
 // AST_IMPORT     -> stores an import / using statement
 // AST_CLASS      -> stores a class
 // AST_RETURN     -> stores a return statement
+// AST_TRY        -> stores a try statement with its catch clause
 // AST_BLOCK      -> stores a list of ASTs
 // AST_ANNOTATION -> stores an annotation
 // AST_NONE       -> stores an option None type
@@ -75,9 +79,11 @@ typedef enum {
     AST_IF,
     AST_IFCLAUSE,
     AST_WHILE,
+    AST_FOR,
     AST_IMPORT,
     AST_CLASS,
     AST_RETURN,
+    AST_TRY,
     AST_BLOCK,
     AST_ANNOTATION,
     AST_NONE,
@@ -126,6 +132,22 @@ typedef struct {
     hashmap_t* fields;
 } ast_struct_t;
 
+// Try struct, var is the declaration of the caught exception
+typedef struct {
+    list_t* body;
+    ast_t* var;
+    list_t* handler;
+} ast_try_t;
+
+// For struct, var is the declaration of the loop variable.
+// Counts from expr up to (excluding) to, or iterates over the array expr if to is NULL
+typedef struct {
+    ast_t* var;
+    ast_t* expr;
+    ast_t* to;
+    list_t* body;
+} ast_for_t;
+
 typedef struct {
     datatype_t* type;
 } ast_none_t;
@@ -150,7 +172,9 @@ struct ast_s {
         ast_decl_t vardecl;
         ast_cond_t ifclause;
         ast_cond_t whilestmt;
+        ast_for_t forstmt;
         ast_struct_t classstmt;
+        ast_try_t trystmt;
         annotation_t annotation;
         ast_none_t none;
 
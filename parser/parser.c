@@ -7,6 +7,8 @@ ast_t* parse_var_declaration(parser_t* parser, location_t loc);
 ast_t* parse_fn_declaration(parser_t* parser, location_t loc);
 ast_t* parse_if_declaration(parser_t* parser, location_t loc);
 ast_t* parse_while_declaration(parser_t* parser, location_t loc);
+ast_t* parse_for_declaration(parser_t* parser, location_t loc);
+ast_t* parse_try_declaration(parser_t* parser, location_t loc);
 ast_t* parse_class_declaration(parser_t* parser, location_t loc);
 ast_t* parse_return_declaration(parser_t* parser, location_t loc);
 ast_t* parse_annotation_declaration(parser_t* parser, location_t loc);
@@ -739,7 +741,7 @@ list_t* parse_block(parser_t* parser) {
  *
  * EBNF:
  * Statement = ( Import | Variable | Function
- *  | If | While | Class | Return | Annotation | Expression ) ";" .
+ *  | If | While | For | Try | Class | Return | Annotation | Expression ) ";" .
  */
 ast_t* parse_stmt(parser_t* parser) {
     location_t pos = get_location(parser);
@@ -754,6 +756,8 @@ ast_t* parse_stmt(parser_t* parser) {
         {TOKEN_FUNC, parse_fn_declaration},
         {TOKEN_IF, parse_if_declaration},
         {TOKEN_WHILE, parse_while_declaration},
+        {TOKEN_FOR, parse_for_declaration},
+        {TOKEN_TRY, parse_try_declaration},
         {TOKEN_TYPE, parse_class_declaration},
         {TOKEN_RETURN, parse_return_declaration},
         {TOKEN_AT, parse_annotation_declaration}
@@ -999,6 +1003,108 @@ ast_t* parse_while_declaration(parser_t* parser, location_t loc) {
     return node;
 }
 
+/**
+ * parse_for_declaration:
+ * Builds an ast for a for loop.
+ * The loop variable is a declaration, its type is set by the compiler.
+ * 'in' is not a keyword, it may still be used as a name.
+ *
+ * EBNF:
+ * For = "for" "|" TOKEN_WORD "|" "in" Expression [ "..." Expression ] Block .
+ *
+ * Example:
+ * for |i| in 0...10 {
+ *     println(i)
+ * }
+ */
+ast_t* parse_for_declaration(parser_t* parser, location_t loc) {
+    ast_t* node = ast_class_create(AST_FOR, loc);
+    parser->cursor++;
+    node->forstmt.var = 0;
+    node->forstmt.expr = 0;
+    node->forstmt.to = 0;
+    node->forstmt.body = list_new();
+
+    const token_t* name = parser_peek(parser, 1);
+    const token_t* in = parser_peek(parser, 3);
+    if(!match_type(parser, TOKEN_BITOR) || name->type != TOKEN_WORD
+        || parser_peek(parser, 2)->type != TOKEN_BITOR
+        || in->type != TOKEN_WORD || strcmp(in->value, "in")) {
+        parser_throw(parser, "Malformed for loop, expected: for |name| in ...");
+        return node;
+    }
+    parser->cursor += 4;
+
+    ast_t* var = ast_class_create(AST_DECLVAR, name->location);
+    var->vardecl.name = strdup(name->value);
+    var->vardecl.mutate = false;
+    var->vardecl.initializer = 0;
+    var->vardecl.type = 0;
+    node->forstmt.var = var;
+
+    node->forstmt.expr = parse_expression(parser);
+    if(!node->forstmt.expr) return node;
+    if(match_type(parser, TOKEN_RANGE)) {
+        parser->cursor++;
+        node->forstmt.to = parse_expression(parser);
+        if(!node->forstmt.to) return node;
+    }
+
+    list_free(node->forstmt.body);
+    node->forstmt.body = parse_block(parser);
+    return node;
+}
+
+/**
+ * parse_try_declaration:
+ * Builds an ast for a try statement.
+ * The caught exception is stored in a variable declaration.
+ *
+ * EBNF:
+ * Try = "try" Block "catch" "(" TOKEN_WORD ":" Datatype ")" Block .
+ *
+ * Example:
+ * try {
+ *     do1()
+ * } catch(e: Exception) {
+ *     println(e.getMessage())
+ * }
+ */
+ast_t* parse_try_declaration(parser_t* parser, location_t loc) {
+    ast_t* node = ast_class_create(AST_TRY, loc);
+    parser->cursor++;
+    node->trystmt.body = parse_block(parser);
+    node->trystmt.var = 0;
+    node->trystmt.handler = list_new();
+    if(parser_error(parser)) return node;
+
+    if(!expect_token(parser, TOKEN_CATCH) || !expect_token(parser, TOKEN_LPAREN)) {
+        return node;
+    }
+
+    const token_t* name = parser_peek(parser, 0);
+    if(name->type != TOKEN_WORD || parser_peek(parser, 1)->type != TOKEN_COLON) {
+        parser_throw(parser, "Malformed catch clause");
+        return node;
+    }
+    parser->cursor += 2;
+
+    ast_t* var = ast_class_create(AST_DECLVAR, name->location);
+    var->vardecl.name = strdup(name->value);
+    var->vardecl.type = parse_datatype(parser);
+    var->vardecl.mutate = false;
+    var->vardecl.initializer = 0;
+    node->trystmt.var = var;
+
+    if(!expect_token(parser, TOKEN_RPAREN)) {
+        return node;
+    }
+
+    list_free(node->trystmt.handler);
+    node->trystmt.handler = parse_block(parser);
+    return node;
+}
+
 /**
  * parse_class_declaration:
  * Parses a class declaration.
@@ -1050,7 +1156,7 @@ ast_t* parse_return_declaration(parser_t* parser, location_t loc) {
  * Parses an annotation.
  *
  * EBNF:
- * Annotation = "@" ( "Getter" | "Setter" | "Unused" ) .
+ * Annotation = "@" ( "Getter" | "Setter" | "Unused" | "Exception" ) .
  */
 ast_t* parse_annotation_declaration(parser_t* parser, location_t loc) {
     ast_t* node = ast_class_create(AST_ANNOTATION, loc);
@@ -1067,6 +1173,8 @@ ast_t* parse_annotation_declaration(parser_t* parser, location_t loc) {
             node->annotation = ANN_SETTER;
         } else if(!strcmp(str, "Unused")) {
             node->annotation = ANN_UNUSED;
+        } else if(!strcmp(str, "Exception")) {
+            node->annotation = ANN_EXCEPTION;
         } else {
             parser_throw(parser, "Unknown annotation type");
         }
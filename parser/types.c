@@ -42,6 +42,11 @@ void datatype_free(datatype_t* dt) {
     free(dt);
 }
 
+// Strings are arrays of chars (char[] is never stored as an array object)
+bool datatype_is_string(datatype_t* dt) {
+    return dt->type == DATA_ARRAY && dt->subtype && dt->subtype->type == DATA_CHAR;
+}
+
 const char* datatype_str(datatype_t* t) {
     switch(t->type) {
         case DATA_NULL: return "null";
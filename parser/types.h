@@ -36,6 +36,7 @@ datatype_t* datatype_new(type_t base);
 datatype_t* datatype_copy(datatype_t* other);
 bool datatype_match(datatype_t* t1, datatype_t* t2);
 void datatype_free(datatype_t* dt);
+bool datatype_is_string(datatype_t* dt);
 const char* datatype_str(datatype_t* type);
 
 typedef struct context_t {
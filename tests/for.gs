@@ -0,0 +1,46 @@
+# Test for loops over int ranges and arrays.
+# Expected: 10, 0, 60, 9, 6
+using core
+
+# Integer range, the end is excluded
+let mut sum = 0
+for |i| in 0...5 {
+	sum := sum + i
+}
+println(sum)
+
+# Empty and reversed ranges do not run the body
+let mut count = 0
+for |i| in 3...3 {
+	count := count + 1
+}
+for |i| in 5...2 {
+	count := count + 1
+}
+println(count)
+
+# Elements of an array
+let values = [10, 20, 30]
+let mut total = 0
+for |v| in values {
+	total := total + v
+}
+println(total)
+
+# Nested loops
+let mut pairs = 0
+for |i| in 0...3 {
+	for |j| in 0...3 {
+		pairs := pairs + 1
+	}
+}
+println(pairs)
+
+# Replacing the iterated array does not change the visited elements
+let mut arr = [1, 2, 3]
+let mut visited = 0
+for |x| in arr {
+	arr := [100, 200, 300, 400]
+	visited := visited + x
+}
+println(visited)
@@ -0,0 +1,22 @@
+# Test short-circuit evaluation of && and ||.
+# Expected: false, false, true, check, true, check, false
+using core
+
+func check(b:bool) -> bool {
+	println("check")
+	return b
+}
+
+let arr = [1, 2]
+let i = 2
+
+# The right side is skipped, it would read past the end
+println(i < arr.length() && arr[i] = 0)
+
+# Skipped if the left side decides the result
+println(false && check(true))
+println(true || check(false))
+
+# Evaluated otherwise
+println(true && check(true))
+println(false || check(false))
@@ -0,0 +1,54 @@
+# Test else-if chains over one variable (jump tables and sparse keys).
+# Expected: 10, 11, 12, 13, 14, 12, -1, -1, -1, 1, 2, 3, 4, 5, 0, 0
+using core
+
+# Dense keys: a jump table, || joins keys of one clause
+func dense(x:int) -> int {
+	let mut result = 0
+	if x = 0 {
+		result := 10
+	} else if x = 1 {
+		result := 11
+	} else if x = 2 || x = 5 {
+		result := 12
+	} else if x = 3 {
+		result := 13
+	} else if x = 4 {
+		result := 14
+	} else {
+		result := -1
+	}
+	return result
+}
+
+# Sparse keys: a binary search of compares
+func sparse(x:int) -> int {
+	if x = 1 {
+		return 1
+	} else if x = 100 {
+		return 2
+	} else if x = 1000 {
+		return 3
+	} else if x = 10000 {
+		return 4
+	} else if x = 100000 {
+		return 5
+	}
+	return 0
+}
+
+for |i| in 0...6 {
+	println(dense(i))
+}
+# Default branch, keys outside of the table
+println(dense(6))
+println(dense(-1))
+println(dense(1000))
+
+println(sparse(1))
+println(sparse(100))
+println(sparse(1000))
+println(sparse(10000))
+println(sparse(100000))
+println(sparse(50))
+println(sparse(-100))
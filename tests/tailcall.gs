@@ -0,0 +1,37 @@
+# Test tail calls, that reuse the frame of the caller.
+# Expected: 1250025000, 1250025000, 7, 50000, 7
+using core
+
+# Deep accumulator recursion, far more calls than frames
+func sum(n:int, acc:int) -> int {
+	if n = 0 {
+		return acc
+	}
+	return sum(n - 1, acc + n)
+}
+
+type Counter(start:int) {
+	@Getter
+	let value = start
+
+	# Tail calls a function, the class of the method is kept for the caller
+	func total(n:int) -> int {
+		return sum(n, 0)
+	}
+
+	# Tail calls itself on another object
+	func count(n:int, acc:int) -> int {
+		if n = 0 {
+			return acc
+		}
+		return Counter(value).count(n - 1, acc + 1)
+	}
+}
+
+println(sum(50000, 0))
+
+let counter = Counter(7)
+println(counter.total(50000))
+println(counter.getValue())
+println(counter.count(50000, 0))
+println(counter.getValue())
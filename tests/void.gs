@@ -0,0 +1,49 @@
+# Test void functions and methods called as statements in loops.
+# Expected: 100, 200, 7, 106, [1, 2, 3]
+using core
+
+let mut total = 0
+
+func add(x:int) -> void {
+	total := total + x
+}
+
+type Box(start:int) {
+	let mut count = start
+
+	func increment(x:int) -> void {
+		count := count + x
+	}
+
+	func get() -> int {
+		return count
+	}
+}
+
+func run() -> int {
+	let box = Box(0)
+	let a = 1
+	let mut i = 0
+	while i < 100 {
+		add(1)
+		box.increment(2)
+		i := i + 1
+	}
+
+	# Calls, that left a value behind, would shift the operands below
+	let b = 2
+	let c = a + b * box.get() / 100 + 1
+	println(total)
+	println(box.get())
+	return c + a
+}
+
+println(run())
+let values = [1, 2, 3]
+let mut j = 0
+while j < values.length() {
+	add(values[j])
+	j := j + 1
+}
+println(total)
+println(values)
@@ -0,0 +1,611 @@
+// Copyright (C) 2017 Alexander Koch
+// Ahead-of-time translator: bytecode to C (see vm/aot.h)
+#define USE_MEM_IMPLEMENTATION
+#include "../core/mem.h"
+#include <stdio.h>
+#include "../compiler/compiler.h"
+#include "../compiler/serializer.h"
+#include "../vm/bytecode.h"
+
+/**
+ * aot_t - translation state
+ *
+ * @depth Stack depth of every instruction
+ * @func Entry of the function of every instruction
+ * @target Instructions, that are jumped to
+ * @global Toplevel slots, that are accessed by gload / gborrow / gstore / ginc
+ * @entry Function, that is translated
+ * @level Display level of the function, 0 if none
+ * @low Lowest slot of the function (parameters are below fp)
+ * @used Parameters, that are accessed, from low
+ * @written Parameters, that are assigned, from low
+ * @captured Slots of the function, that are accessed by upval / upstore, from low
+ */
+typedef struct {
+    bytecode_t* bytecode;
+    FILE* out;
+    int* depth;
+    int* func;
+    bool* target;
+    bool* global;
+
+    int entry;
+    int level;
+    int low;
+    bool* used;
+    bool* written;
+    bool* captured;
+} aot_t;
+
+static bool has_slot(opcode_t op) {
+    switch(op) {
+        case OP_LOAD:
+        case OP_BORROW:
+        case OP_STORE:
+        case OP_IADDLK:
+        case OP_ISUBLK:
+        case OP_ILTLK:
+        case OP_INCL: return true;
+        default: return false;
+    }
+}
+
+// Slots read from other frames stay on the value stack
+static bool in_memory(aot_t* aot, int slot) {
+    bytecode_t* bytecode = aot->bytecode;
+    if(aot->entry == 0) {
+        return slot >= 0 && (size_t)slot < bytecode->size && aot->global[slot];
+    }
+    if(slot < aot->low || slot >= bytecode->frame[aot->entry]) return false;
+    return aot->captured[slot - aot->low];
+}
+
+static bool is_local(aot_t* aot, int slot) {
+    if(slot < 0 && (slot < aot->low || !aot->used[slot - aot->low])) return false;
+    return !in_memory(aot, slot);
+}
+
+// C expression of a slot relative to fp
+static const char* slot(aot_t* aot, int k) {
+    static char buf[8][32];
+    static int n = 0;
+    char* str = buf[n++ & 7];
+
+    if(!is_local(aot, k)) {
+        sprintf(str, "STACK(fp%+d)", k);
+    } else if(k < 0) {
+        sprintf(str, "a%d", -k);
+    } else {
+        sprintf(str, "s%d", k);
+    }
+    return str;
+}
+
+// Writes the locals below depth to the value stack,
+// parameters only if they have been assigned
+static void spill(aot_t* aot, int depth) {
+    for(int k = aot->low; k < depth; k++) {
+        if(is_local(aot, k) && (k >= 0 || aot->written[k - aot->low])) {
+            fprintf(aot->out, "    STACK(fp%+d) = %s;\n", k, slot(aot, k));
+        }
+    }
+}
+
+// ... and the state printed by exceptions
+static void sync(aot_t* aot, int depth, int pc) {
+    fprintf(aot->out, "    vm->pc = %d; vm->fp = fp;\n", pc);
+    spill(aot, depth);
+}
+
+static void reload(aot_t* aot, int k) {
+    if(k >= aot->low && is_local(aot, k)) {
+        fprintf(aot->out, "    %s = STACK(fp%+d);\n", slot(aot, k), k);
+    }
+}
+
+// Pushes src to slot depth, objects are copied (see COPY in vm.c)
+static void copy(aot_t* aot, const char* src, int depth) {
+    char dst[32];
+    strcpy(dst, slot(aot, depth));
+    fprintf(aot->out, "    if(IS_OBJ(%s)) {\n", src);
+    spill(aot, depth);
+    if(is_local(aot, depth)) {
+        fprintf(aot->out, "    %s = aot_copy(vm, fp%+d, %s);\n", dst, depth, src);
+    } else {
+        fprintf(aot->out, "    aot_copy(vm, fp%+d, %s);\n", depth, src);
+    }
+    fprintf(aot->out, "    } else %s = %s;\n", dst, src);
+}
+
+static void literal(val_t v, char* str) {
+    if(v == TRUE_VAL) strcpy(str, "TRUE_VAL");
+    else if(v == FALSE_VAL) strcpy(str, "FALSE_VAL");
+    else if(v == NULL_VAL) strcpy(str, "NULL_VAL");
+    else if(IS_INT32(v)) sprintf(str, "VI(%d)", AS_INT32(v));
+    else sprintf(str, "(val_t)0x%016llxULL", (unsigned long long)v);
+}
+
+static const char* int_op(opcode_t op) {
+    switch(op) {
+        case OP_IADD: case OP_FADD: case OP_IADDLK: return "+";
+        case OP_ISUB: case OP_FSUB: case OP_ISUBLK: return "-";
+        case OP_IMUL: case OP_FMUL: return "*";
+        case OP_IDIV: case OP_FDIV: return "/";
+        case OP_MOD: return "%";
+        case OP_BITL: return "<<";
+        case OP_BITR: return ">>";
+        case OP_BITAND: return "&";
+        case OP_BITOR: return "|";
+        case OP_BITXOR: return "^";
+        case OP_BAND: return "&&";
+        case OP_BOR: return "||";
+        case OP_BEQ: case OP_IEQ: case OP_FEQ:
+        case OP_JIEQ: case OP_JFEQ: case OP_JIEQK: case OP_JIEQLK: return "==";
+        case OP_BNE: case OP_INE: case OP_FNE:
+        case OP_JINE: case OP_JFNE: case OP_JINEK: case OP_JINELK: return "!=";
+        case OP_ILT: case OP_FLT: case OP_ILTLK:
+        case OP_JILT: case OP_JFLT: case OP_JILTK: case OP_JILTLK: return "<";
+        case OP_IGT: case OP_FGT: case OP_JIGT: case OP_JFGT: case OP_JIGTK: case OP_JIGTLK: return ">";
+        case OP_ILE: case OP_FLE: case OP_JILE: case OP_JFLE: case OP_JILEK: case OP_JILELK: return "<=";
+        default: return ">=";
+    }
+}
+
+static void translate_instr(aot_t* aot, int pc) {
+    FILE* out = aot->out;
+    code_t* instr = &aot->bytecode->code[pc];
+    opcode_t op = instr->op;
+    int d = aot->depth[pc];
+    int* maxDepth = aot->bytecode->frame;
+    char src[64];
+
+    // Slots relative to the stack pointer
+    #define T(k) slot(aot, d + (k))
+    #define S(k) slot(aot, k)
+
+    if(aot->target[pc]) fprintf(out, "L%d:;\n", pc);
+    switch(op) {
+        case OP_HLT: fprintf(out, "    return;\n"); break;
+        case OP_PUSH: {
+            literal(instr->v, src);
+            fprintf(out, "    %s = %s;\n", T(0), src);
+            break;
+        }
+        case OP_PUSHK: fprintf(out, "    %s = k[%d];\n", T(0), instr->a); break;
+        case OP_POP: break;
+        case OP_RESERVE: {
+            for(int i = 0; i < instr->a; i++) {
+                fprintf(out, "    %s = NULL_VAL;\n", T(i));
+            }
+            break;
+        }
+        case OP_STORE: fprintf(out, "    %s = %s;\n", S(instr->a), T(-1)); break;
+        case OP_LOAD: strcpy(src, S(instr->a)); copy(aot, src, d); break;
+        case OP_GSTORE: fprintf(out, "    STACK(%d) = %s;\n", instr->a, T(-1)); break;
+        case OP_GLOAD: sprintf(src, "STACK(%d)", instr->a); copy(aot, src, d); break;
+        case OP_LDARG0: copy(aot, "STACK(frame->receiver)", d); break;
+        case OP_SETARG0: fprintf(out, "    STACK(frame->receiver) = %s;\n", T(-1)); break;
+        case OP_BORROW: fprintf(out, "    %s = %s;\n", T(0), S(instr->a)); break;
+        case OP_GBORROW: fprintf(out, "    %s = STACK(%d);\n", T(0), instr->a); break;
+        case OP_BORROW0: fprintf(out, "    %s = STACK(frame->receiver);\n", T(0)); break;
+        case OP_IDIV:
+        case OP_MOD: {
+            fprintf(out, "    if(AI(%s) == 0) aot_divzero(vm, fp%+d);\n", T(-1), d);
+            fprintf(out, "    %s = VI(AI(%s) %s AI(%s));\n", T(-2), T(-2), int_op(op), T(-1));
+            break;
+        }
+        case OP_IADD:
+        case OP_ISUB:
+        case OP_IMUL:
+        case OP_BITL:
+        case OP_BITR:
+        case OP_BITAND:
+        case OP_BITOR:
+        case OP_BITXOR: {
+            fprintf(out, "    %s = VI(AI(%s) %s AI(%s));\n", T(-2), T(-2), int_op(op), T(-1));
+            break;
+        }
+        case OP_BITNOT: fprintf(out, "    %s = VI(~AI(%s));\n", T(-1), T(-1)); break;
+        case OP_IMINUS: fprintf(out, "    %s = VI(-AI(%s));\n", T(-1), T(-1)); break;
+        case OP_I2F: fprintf(out, "    %s = VF(AI(%s));\n", T(-1), T(-1)); break;
+        case OP_FADD:
+        case OP_FSUB:
+        case OP_FMUL:
+        case OP_FDIV: {
+            fprintf(out, "    %s = VF(AF(%s) %s AF(%s));\n", T(-2), T(-2), int_op(op), T(-1));
+            break;
+        }
+        case OP_FMINUS: fprintf(out, "    %s = VF(-AF(%s));\n", T(-1), T(-1)); break;
+        case OP_F2I: fprintf(out, "    %s = VI((int)AF(%s));\n", T(-1), T(-1)); break;
+        case OP_NOT: fprintf(out, "    %s = VB(!AB(%s));\n", T(-1), T(-1)); break;
+        case OP_B2I: fprintf(out, "    %s = VI(AB(%s));\n", T(-1), T(-1)); break;
+        case OP_SYSCALL: {
+            sync(aot, d, pc+1);
+            fprintf(out, "    aot_syscall(vm, fp%+d, %d);\n", d, instr->a);
+            if(!(instr->b & CALL_VOID)) reload(aot, d - CALL_ARGS(instr->b));
+            break;
+        }
+        case OP_INVOKE: {
+            int args = CALL_ARGS(instr->b);
+            sync(aot, d, pc+1);
+            fprintf(out, "    aot_invoke(vm, &callee, fp%+d, %d, %d);\n", d, args, maxDepth[instr->a]);
+            fprintf(out, "    f%d(vm, &callee, fp%+d);\n", instr->a, d);
+            reload(aot, d - args - 1);
+            if(!(instr->b & CALL_VOID)) reload(aot, d - args);
+            break;
+        }
+        case OP_RET: fprintf(out, "    aot_ret(vm, frame, %s);\n    return;\n", T(-1)); break;
+        case OP_RETVIRTUAL: fprintf(out, "    aot_retvirtual(vm, frame, %s);\n    return;\n", T(-1)); break;
+        case OP_RETVOID: fprintf(out, "    aot_retvoid(vm, frame);\n    return;\n"); break;
+        case OP_JMP: fprintf(out, "    goto L%d;\n", instr->a); break;
+        case OP_SWITCH: {
+            // The C compiler builds its own jump table
+            code_t* table = instr + 1;
+            fprintf(out, "    switch(AI(%s)) {\n", T(-1));
+            for(int i = 0; i < instr->b; i++) {
+                fprintf(out, "        case %d: goto L%d;\n", instr->a + i, table[i].a);
+            }
+            fprintf(out, "        default: goto L%d;\n    }\n", table[instr->b].a);
+            break;
+        }
+        case OP_CASE: break;
+        case OP_JMPF: fprintf(out, "    if(!AB(%s)) goto L%d;\n", T(-1), instr->a); break;
+        case OP_ARR:
+        case OP_STR: {
+            spill(aot, d);
+            fprintf(out, "    aot_%s(vm, fp%+d, %d);\n", op == OP_ARR ? "arr" : "str", d, instr->a);
+            reload(aot, d - instr->a);
+            break;
+        }
+        case OP_LDLIB: break;
+        case OP_TOSTR:
+        case OP_GETSUB:
+        case OP_SETSUB:
+        case OP_APPEND:
+        case OP_CONS:
+        case OP_SSETSUB:
+        case OP_SAPPEND:
+        case OP_SCONS: {
+            int operands = op == OP_TOSTR ? 1 : (op == OP_SETSUB || op == OP_SSETSUB) ? 3 : 2;
+            spill(aot, d);
+            fprintf(out, "    aot_%s(vm, fp%+d);\n", op2str(op), d);
+            reload(aot, d - operands);
+            break;
+        }
+        case OP_SGETSUB: {
+            // The program ends on an exception, so nothing is spilled
+            fprintf(out, "    if(!IN_STRING(AS_STRING(%s), AI(%s))) aot_bounds(vm, fp%+d);\n", T(-2), T(-1), d);
+            fprintf(out, "    %s = VI(AS_STRING(%s)[AI(%s)]);\n", T(-2), T(-2), T(-1));
+            break;
+        }
+        case OP_BEQ:
+        case OP_BNE:
+        case OP_BAND:
+        case OP_BOR: {
+            fprintf(out, "    %s = VB(AB(%s) %s AB(%s));\n", T(-2), T(-2), int_op(op), T(-1));
+            break;
+        }
+        case OP_IEQ:
+        case OP_INE:
+        case OP_ILT:
+        case OP_IGT:
+        case OP_ILE:
+        case OP_IGE: {
+            fprintf(out, "    %s = VB(AI(%s) %s AI(%s));\n", T(-2), T(-2), int_op(op), T(-1));
+            break;
+        }
+        case OP_FEQ:
+        case OP_FNE:
+        case OP_FLT:
+        case OP_FGT:
+        case OP_FLE:
+        case OP_FGE: {
+            fprintf(out, "    %s = VB(AF(%s) %s AF(%s));\n", T(-2), T(-2), int_op(op), T(-1));
+            break;
+        }
+        case OP_LEN: fprintf(out, "    %s = VI((int)AS_ARRAY(%s)->len);\n", T(-1), T(-1)); break;
+        case OP_SLEN: fprintf(out, "    %s = VI((int)strlen(AS_STRING(%s)));\n", T(-1), T(-1)); break;
+        case OP_UPVAL: sprintf(src, "STACK(vm->display[%d]%+d)", instr->a, instr->b); copy(aot, src, d); break;
+        case OP_UPSTORE: fprintf(out, "    STACK(vm->display[%d]%+d) = %s;\n", instr->a, instr->b, T(-1)); break;
+        case OP_CLASS: {
+            spill(aot, d);
+            fprintf(out, "    aot_class(vm, fp%+d, %d);\n", d, instr->a);
+            reload(aot, d);
+            break;
+        }
+        case OP_SETFIELD: fprintf(out, "    AS_CLASS(%s)->fields[%d] = %s;\n", T(-2), instr->a, T(-1)); break;
+        case OP_STFIELD: fprintf(out, "    AS_CLASS(STACK(frame->receiver))->fields[%d] = %s;\n", instr->a, T(-1)); break;
+        case OP_GETFIELD: {
+            sprintf(src, "AS_CLASS(%s)->fields[%d]", T(-1), instr->a);
+            copy(aot, src, d-1);
+            break;
+        }
+        case OP_LDFIELD: {
+            sprintf(src, "AS_CLASS(STACK(frame->receiver))->fields[%d]", instr->a);
+            copy(aot, src, d);
+            break;
+        }
+        case OP_IADDLK:
+        case OP_ISUBLK: fprintf(out, "    %s = VI(AI(%s) %s %d);\n", T(0), S(instr->a), int_op(op), instr->b); break;
+        case OP_ILTLK: fprintf(out, "    %s = VB(AI(%s) < %d);\n", T(0), S(instr->a), instr->b); break;
+        case OP_LOAD2: {
+            strcpy(src, S(instr->a));
+            copy(aot, src, d);
+            strcpy(src, S(instr->b));
+            copy(aot, src, d+1);
+            break;
+        }
+        case OP_STOREJMP: fprintf(out, "    %s = %s;\n    goto L%d;\n", S(instr->b), T(-1), instr->a); break;
+        case OP_JIEQ:
+        case OP_JINE:
+        case OP_JILT:
+        case OP_JIGT:
+        case OP_JILE:
+        case OP_JIGE: {
+            fprintf(out, "    if(!(AI(%s) %s AI(%s))) goto L%d;\n", T(-2), int_op(op), T(-1), instr->a);
+            break;
+        }
+        case OP_JFEQ:
+        case OP_JFNE:
+        case OP_JFLT:
+        case OP_JFGT:
+        case OP_JFLE:
+        case OP_JFGE: {
+            fprintf(out, "    if(!(AF(%s) %s AF(%s))) goto L%d;\n", T(-2), int_op(op), T(-1), instr->a);
+            break;
+        }
+        case OP_JIEQK:
+        case OP_JINEK:
+        case OP_JILTK:
+        case OP_JIGTK:
+        case OP_JILEK:
+        case OP_JIGEK: {
+            fprintf(out, "    if(!(AI(%s) %s %d)) goto L%d;\n", T(-1), int_op(op), instr->b, instr->a);
+            break;
+        }
+        case OP_JIEQLK:
+        case OP_JINELK:
+        case OP_JILTLK:
+        case OP_JIGTLK:
+        case OP_JILELK:
+        case OP_JIGELK: {
+            fprintf(out, "    if(!(AI(%s) %s %d)) goto L%d;\n",
+                S(SLOT_OF(instr->b)), int_op(op), IMM_OF(instr->b), instr->a);
+            break;
+        }
+        case OP_INCL: fprintf(out, "    %s = VI(AI(%s) + %d);\n", S(instr->a), S(instr->a), instr->b); break;
+        case OP_GINC: fprintf(out, "    STACK(%d) = VI(AI(STACK(%d)) + %d);\n", instr->a, instr->a, instr->b); break;
+        case OP_ADDL: fprintf(out, "    %s = VI(AI(%s) + AI(%s));\n", S(instr->a), S(instr->a), S(instr->b)); break;
+        case OP_FORL: {
+            fprintf(out, "    %s = VI(AI(%s) + 1);\n", S(instr->b), S(instr->b));
+            fprintf(out, "    if(AI(%s) < AI(%s)) goto L%d;\n", S(instr->b), S(instr->b + 1), instr->a);
+            break;
+        }
+        case OP_FORIN: {
+            // The element is not copied (see forin in vm.c)
+            fprintf(out, "    %s = VI(AI(%s) + 1);\n", S(instr->b + 1), S(instr->b + 1));
+            fprintf(out, "    if(AI(%s) < (int)AS_ARRAY(%s)->len) {\n", S(instr->b + 1), S(instr->b));
+            fprintf(out, "        %s = AS_ARRAY(%s)->data[AI(%s)];\n", S(instr->b + 2), S(instr->b), S(instr->b + 1));
+            fprintf(out, "        goto L%d;\n    }\n", instr->a);
+            break;
+        }
+        case OP_TAILCALL: {
+            // Calls to the function itself become a jump, other tail calls
+            // share the frame of this function (but not the C stack)
+            sync(aot, d, pc+1);
+            fprintf(out, "    fp = aot_tailcall(vm, frame, fp%+d, %d, %d);\n", d, instr->b, maxDepth[instr->a]);
+            if(instr->a == aot->entry) {
+                fprintf(out, "    goto entry;\n");
+            } else {
+                fprintf(out, "    f%d(vm, frame, fp);\n    return;\n", instr->a);
+            }
+            break;
+        }
+        case OP_ENTER: {
+            fprintf(out, "    frame->level = %d; frame->saved = vm->display[%d]; vm->display[%d] = fp;\n",
+                instr->a, instr->a, instr->a);
+            break;
+        }
+        default: break;
+    }
+
+    #undef T
+    #undef S
+}
+
+static void translate_func(aot_t* aot, int entry) {
+    bytecode_t* bytecode = aot->bytecode;
+    FILE* out = aot->out;
+    int size = bytecode->size;
+
+    aot->entry = entry;
+    aot->level = 0;
+    aot->low = 0;
+    for(int pc = entry; pc < size; pc++) {
+        if(aot->func[pc] != entry || aot->depth[pc] == -1) continue;
+        code_t* instr = &bytecode->code[pc];
+        if(instr->op == OP_ENTER) aot->level = instr->a;
+
+        int slots[2] = {0, 0};
+        if(has_slot(instr->op)) slots[0] = instr->a;
+        if(instr->op == OP_LOAD2 || instr->op == OP_ADDL) { slots[0] = instr->a; slots[1] = instr->b; }
+        if(instr->op == OP_STOREJMP) slots[0] = instr->b;
+        if(instr->op >= OP_JIEQLK && instr->op <= OP_JIGELK) slots[0] = SLOT_OF(instr->b);
+        for(int i = 0; i < 2; i++) {
+            if(slots[i] < aot->low) aot->low = slots[i];
+        }
+    }
+
+    // Parameters that are accessed
+    aot->used = malloc(sizeof(bool) * (-aot->low + 1));
+    aot->written = malloc(sizeof(bool) * (-aot->low + 1));
+    memset(aot->used, 0, sizeof(bool) * (-aot->low + 1));
+    memset(aot->written, 0, sizeof(bool) * (-aot->low + 1));
+    for(int pc = entry; pc < size; pc++) {
+        if(aot->func[pc] != entry || aot->depth[pc] == -1) continue;
+        code_t* instr = &bytecode->code[pc];
+        if(has_slot(instr->op) && instr->a < 0) aot->used[instr->a - aot->low] = true;
+        if(instr->op == OP_LOAD2 || instr->op == OP_ADDL) {
+            if(instr->a < 0) aot->used[instr->a - aot->low] = true;
+            if(instr->b < 0) aot->used[instr->b - aot->low] = true;
+        }
+        if(instr->op == OP_STOREJMP && instr->b < 0) {
+            aot->used[instr->b - aot->low] = true;
+            aot->written[instr->b - aot->low] = true;
+        }
+        if((instr->op == OP_STORE || instr->op == OP_INCL || instr->op == OP_ADDL) && instr->a < 0) {
+            aot->written[instr->a - aot->low] = true;
+        }
+        if(instr->op >= OP_JIEQLK && instr->op <= OP_JIGELK && SLOT_OF(instr->b) < 0) {
+            aot->used[SLOT_OF(instr->b) - aot->low] = true;
+        }
+    }
+
+    // Slots of the display level, that nested functions access
+    int count = bytecode->frame[entry] - aot->low;
+    aot->captured = malloc(sizeof(bool) * (count + 1));
+    memset(aot->captured, 0, sizeof(bool) * (count + 1));
+    for(int pc = 0; pc < size && aot->level > 0; pc++) {
+        code_t* instr = &bytecode->code[pc];
+        if((instr->op == OP_UPVAL || instr->op == OP_UPSTORE) && aot->depth[pc] != -1 && instr->a == aot->level
+            && instr->b >= aot->low && instr->b < bytecode->frame[entry]) {
+            aot->captured[instr->b - aot->low] = true;
+        }
+    }
+
+    fprintf(out, "\nstatic void f%d(vm_t* vm, frame_t* frame, int fp) {\n", entry);
+    fprintf(out, "    frame_t callee;\n");
+    for(int k = aot->low; k < bytecode->frame[entry]; k++) {
+        if(is_local(aot, k)) fprintf(out, "    val_t %s = NULL_VAL;\n", slot(aot, k));
+    }
+    fprintf(out, "entry:\n");
+    for(int k = aot->low; k < 0; k++) {
+        reload(aot, k);
+    }
+
+    for(int pc = entry; pc < size; pc++) {
+        if(aot->func[pc] != entry || aot->depth[pc] == -1) continue;
+        translate_instr(aot, pc);
+    }
+    fprintf(out, "}\n");
+
+    free(aot->used);
+    free(aot->written);
+    free(aot->captured);
+}
+
+static void print_string(FILE* out, const char* str) {
+    fputc('"', out);
+    for(; *str; str++) {
+        unsigned char c = *str;
+        if(c == '"' || c == '\\') fprintf(out, "\\%c", c);
+        else if(c < 32 || c >= 127) fprintf(out, "\\%03o", c);
+        else fputc(c, out);
+    }
+    fputc('"', out);
+}
+
+// Translates the bytecode into a C translation unit,
+// returns why it can not be translated or NULL.
+// Code with exception handlers is not translated, C has no unwinding.
+const char* aot_translate(bytecode_t* bytecode, FILE* out) {
+    if(!bytecode->frame) return bytecode->error;
+    if(bytecode->handlerCount > 0) return "Exception handlers can not be translated";
+
+    size_t size = bytecode->size;
+    aot_t aot;
+    aot.bytecode = bytecode;
+    aot.out = out;
+    aot.depth = malloc(sizeof(int) * (size + 1));
+    aot.func = malloc(sizeof(int) * (size + 1));
+    aot.target = malloc(sizeof(bool) * (size + 1));
+    aot.global = malloc(sizeof(bool) * (size + 1));
+    int* frame = malloc(sizeof(int) * (size + 1));
+    bytecode_depths(bytecode, aot.depth, aot.func, frame);
+    free(frame);
+
+    for(size_t i = 0; i < size; i++) {
+        aot.target[i] = false;
+        aot.global[i] = false;
+    }
+    for(size_t i = 0; i < size; i++) {
+        code_t* instr = &bytecode->code[i];
+        if(aot.depth[i] == -1) continue;
+        if(op_has_address(instr->op)) aot.target[instr->a] = true;
+        if(instr->op == OP_GLOAD || instr->op == OP_GBORROW || instr->op == OP_GSTORE || instr->op == OP_GINC) {
+            if(instr->a >= 0 && (size_t)instr->a < size) aot.global[instr->a] = true;
+        }
+    }
+
+    fprintf(out, "// Generated by golem-aot, link with the Golem runtime (vm/*.c, lib/*.c, ...)\n");
+    fprintf(out, "#define USE_MEM_IMPLEMENTATION\n");
+    fprintf(out, "#include \"core/mem.h\"\n");
+    fprintf(out, "#include \"core/util.h\"\n");
+    fprintf(out, "#include \"vm/aot.h\"\n\n");
+    // Constant pool of the bytecode, the strings are permanent like in the VM
+    int count = bytecode->constantCount;
+    fprintf(out, "static val_t k[%d];\n\n", count > 0 ? count : 1);
+
+    for(size_t i = 0; i < size; i++) {
+        if(aot.func[i] == (int)i && aot.depth[i] != -1) {
+            fprintf(out, "static void f%d(vm_t* vm, frame_t* frame, int fp);\n", (int)i);
+        }
+    }
+    for(size_t i = 0; i < size; i++) {
+        if(aot.func[i] == (int)i && aot.depth[i] != -1) {
+            translate_func(&aot, i);
+        }
+    }
+
+    fprintf(out, "\nint main(int argc, char** argv) {\n");
+    fprintf(out, "    vm_t vm;\n");
+    fprintf(out, "    vm_init(&vm, STACK_LIMIT);\n");
+    fprintf(out, "    seed_prng(time(0));\n");
+    for(int i = 0; i < count; i++) {
+        fprintf(out, "    k[%d] = val_permanent(STRING_VAL(", i);
+        print_string(out, AS_STRING(bytecode->constants[i]));
+        fprintf(out, "));\n");
+    }
+    fprintf(out, "\n    aot_run(&vm, f0, %d, argc, argv);\n\n", bytecode->frame[0]);
+    fprintf(out, "    for(int i = 0; i < %d; i++) val_release(k[i]);\n", count);
+    fprintf(out, "    vm_free(&vm);\n");
+    fprintf(out, "#ifndef NO_MEMINFO\n    mem_leak_check();\n#endif\n");
+    fprintf(out, "    return 0;\n}\n");
+
+    free(aot.depth);
+    free(aot.func);
+    free(aot.target);
+    free(aot.global);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if(argc != 2 && argc != 3) {
+        printf("Usage: golem-aot file.gs|file.gvm [out.c]\n");
+        return 0;
+    }
+
+    // Source files are compiled, anything else is read as bytecode
+    bytecode_t* bytecode = 0;
+    const char* ext = strrchr(argv[1], '.');
+    if(ext && !strcmp(ext, ".gs")) {
+        vector_t* buffer = compile_file(argv[1]);
+        if(buffer) bytecode = bytecode_load(buffer);
+        bytecode_buffer_free(buffer);
+    } else if(!deserialize(argv[1], &bytecode)) {
+        bytecode_free(bytecode);
+        bytecode = 0;
+    }
+    if(!bytecode) {
+        printf("Could not read file '%s'\n", argv[1]);
+        return 1;
+    }
+
+    FILE* out = argc == 3 ? fopen(argv[2], "w") : stdout;
+    const char* error = out ? aot_translate(bytecode, out) : "Could not open the output file";
+    if(out && out != stdout) fclose(out);
+    if(error) printf("Could not translate '%s': %s\n", argv[1], error);
+
+    bytecode_free(bytecode);
+    return error ? 1 : 0;
+}
@@ -1,16 +1,30 @@
 // Copyright (C) 2017 Alexander Koch
 #include "../compiler/compiler.h"
+#include "../compiler/regcode.h"
 #include "../core/util.h"
 #include "../vm/vm.h"
 
 int golem_interpret(const char* module, char* source) {
     seed_prng(time(0));
 	vm_t vm;
-	memset(&vm, 0, sizeof(vm_t));
+	vm_init(&vm, STACK_LIMIT);
 	vector_t* buffer = compile_buffer(source, module);
 	if(buffer) {
-		vm_run(&vm, buffer);
+		bytecode_t* bytecode = bytecode_load(buffer);
+#ifdef REGVM
+		regcode_t* regcode = regcode_gen(bytecode);
+		if(regcode) {
+			regvm_run(&vm, regcode);
+			regcode_free(regcode);
+		} else {
+			vm_run(&vm, bytecode);
+		}
+#else
+		vm_run(&vm, bytecode);
+#endif
+		bytecode_free(bytecode);
 		bytecode_buffer_free(buffer);
 	}
+	vm_free(&vm);
 	return 0;
 }
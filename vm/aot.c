@@ -0,0 +1,234 @@
+// Copyright (C) 2017 Alexander Koch
+#include <setjmp.h>
+#include "aot.h"
+
+// Exceptions are printed by vm_throw, afterwards the program ends
+// (the VM continues at errjmp, which halts)
+static jmp_buf aot_catch;
+
+static void aot_throw(vm_t* vm, const char* msg) {
+    vm_throw(vm, msg);
+    longjmp(aot_catch, 1);
+}
+
+void aot_run(vm_t* vm, aot_func_t toplevel, int size, int argc, char** argv) {
+    vm->argc = argc;
+    vm->argv = argv;
+    vm->maxObjects = 8;
+    vm->errjmp = -1;
+
+    if(!setjmp(aot_catch)) {
+        if(size > vm->stackSize && !vm_grow_stack(vm, size)) {
+            aot_throw(vm, "Stack overflow");
+        }
+
+        frame_t frame;
+        memset(&frame, 0, sizeof(frame));
+        frame.receiver = -1;
+        toplevel(vm, &frame, 0);
+    }
+    vm_clear(vm);
+}
+
+val_t aot_copy(vm_t* vm, int sp, val_t val) {
+    vm->sp = sp;
+    vm_copy(vm, val);
+    return vm->stack[sp];
+}
+
+void aot_syscall(vm_t* vm, int sp, int index) {
+    vm->sp = sp;
+    vm_syscall(vm, index);
+    if(vm->pc == vm->errjmp) {
+        longjmp(aot_catch, 1);
+    }
+}
+
+// Slow path of aot_invoke, same checks as invoke in vm_exec
+void aot_enter(vm_t* vm, int sp, int size) {
+    vm->sp = sp;
+    if(sp + size > vm->stackSize && !vm_grow_stack(vm, sp + size)) {
+        aot_throw(vm, "Stack overflow");
+    }
+    if(vm->depth >= vm->stackLimit - 1) {
+        aot_throw(vm, "Stack overflow");
+    }
+}
+
+// Moves the arguments down to the frame of the caller (see tailcall in vm_exec),
+// returns the frame pointer of the callee
+int aot_tailcall(vm_t* vm, frame_t* frame, int sp, int mode, int size) {
+    int args = TAIL_ARGS(mode);
+    int count = (mode & TAIL_CALLEE_VIRTUAL) ? args + 1 : args;
+
+    int dest = frame->receiver + 1;
+    if(mode & TAIL_SELF_VIRTUAL) dest--;
+    if((mode & TAIL_KEEP) && !frame->keep) {
+        dest++;
+        frame->keep = true;
+    }
+
+    vm->sp = sp;
+    if(dest + count + size > vm->stackSize && !vm_grow_stack(vm, dest + count + size)) {
+        aot_throw(vm, "Stack overflow");
+    }
+    if(frame->level) {
+        vm->display[frame->level] = frame->saved;
+        frame->level = 0;
+    }
+
+    int src = sp - count;
+    for(int i = 0; i < count; i++) {
+        STACK(dest+i) = STACK(src+i);
+    }
+    frame->receiver = dest - args - 1 + count;
+    return dest + count;
+}
+
+void aot_arr(vm_t* vm, int sp, int count) {
+    val_t* arr = malloc(sizeof(val_t) * count);
+    for(int i = count; i > 0; i--) {
+        arr[count - i] = COPY_VAL(STACK(sp - i));
+        STACK(sp - i) = NULL_VAL;
+    }
+
+    obj_t* obj = obj_array_new(arr, count);
+    STACK(sp - count) = OBJ_VAL(obj);
+    vm->sp = sp - count + 1;
+    obj_append(vm, obj);
+}
+
+void aot_str(vm_t* vm, int sp, int count) {
+    char* str = malloc(sizeof(char) * (count+1));
+    for(int i = count; i > 0; i--) {
+        str[count - i] = (char)AS_INT32(STACK(sp - i));
+        STACK(sp - i) = 0;
+    }
+    str[count] = '\0';
+
+    obj_t* obj = obj_string_nocopy_new(str);
+    STACK(sp - count) = OBJ_VAL(obj);
+    vm->sp = sp - count + 1;
+    obj_append(vm, obj);
+}
+
+void aot_tostr(vm_t* vm, int sp) {
+    vm->sp = sp;
+    char* str = val_tostr(vm_pop(vm));
+    vm_register(vm, STRING_NOCOPY_VAL(str));
+}
+
+void aot_bounds(vm_t* vm, int sp) {
+    vm->sp = sp;
+    aot_throw(vm, "Index out of bounds");
+}
+
+void aot_divzero(vm_t* vm, int sp) {
+    vm->sp = sp;
+    aot_throw(vm, "Division by zero");
+}
+
+void aot_getsub(vm_t* vm, int sp) {
+    vm->sp = sp;
+    int idx = AS_INT32(vm_pop(vm));
+    obj_array_t* arr = AS_ARRAY(vm_pop(vm));
+    if(!IN_ARRAY(arr, idx)) aot_throw(vm, "Index out of bounds");
+    vm_copy(vm, arr->data[idx]);
+}
+
+void aot_setsub(vm_t* vm, int sp) {
+    vm->sp = sp;
+    int idx = AS_INT32(vm_pop(vm));
+    val_t obj = vm_pop(vm);
+    val_t val = vm_pop(vm);
+    if(!IN_ARRAY(AS_ARRAY(obj), idx)) aot_throw(vm, "Index out of bounds");
+
+    obj = COPY_VAL(obj);
+    obj_array_t* arr = AS_ARRAY(obj);
+    val_free(arr->data[idx]);
+    arr->data[idx] = val;
+    vm_register(vm, obj);
+}
+
+void aot_append(vm_t* vm, int sp) {
+    vm->sp = sp;
+    obj_array_t* arr2 = AS_ARRAY(vm_pop(vm));
+    obj_array_t* arr1 = AS_ARRAY(vm_pop(vm));
+
+    size_t len = arr1->len + arr2->len;
+    val_t* arr3 = malloc(sizeof(val_t) * len);
+    for(size_t i = 0; i < arr1->len; i++) {
+        arr3[i] = val_copy(arr1->data[i]);
+    }
+    for(size_t i = 0; i < arr2->len; i++) {
+        arr3[i+arr1->len] = val_copy(arr2->data[i]);
+    }
+
+    obj_t* newObj = obj_array_new(arr3, len);
+    vm_push(vm, OBJ_VAL(newObj));
+    obj_append(vm, newObj);
+}
+
+void aot_cons(vm_t* vm, int sp) {
+    vm->sp = sp;
+    val_t val = vm_pop(vm);
+    val_t obj = COPY_VAL(vm_pop(vm));
+
+    obj_array_t* arr = AS_ARRAY(obj);
+    arr->len += 1;
+    size_t allocSz = sizeof(val_t) * arr->len;
+    arr->data = (arr->len == 1) ? malloc(allocSz) : realloc(arr->data, allocSz);
+    arr->data[arr->len-1] = COPY_VAL(val);
+
+    vm_push(vm, obj);
+    obj_append(vm, AS_OBJ(obj));
+}
+
+void aot_ssetsub(vm_t* vm, int sp) {
+    vm->sp = sp;
+    int idx = AS_INT32(vm_pop(vm));
+    val_t obj = vm_pop(vm);
+    val_t val = vm_pop(vm);
+    if(!IN_STRING(AS_STRING(obj), idx)) aot_throw(vm, "Index out of bounds");
+
+    obj = COPY_VAL(obj);
+    AS_STRING(obj)[idx] = (char)AS_INT32(val);
+    vm_register(vm, obj);
+}
+
+void aot_sappend(vm_t* vm, int sp) {
+    vm->sp = sp;
+    char* str2 = AS_STRING(vm_pop(vm));
+    char* str1 = AS_STRING(vm_pop(vm));
+    size_t len1 = strlen(str1);
+    size_t len2 = strlen(str2);
+    char* data = malloc(sizeof(char) * (len1 + len2 + 1));
+    memcpy(data, str1, len1);
+    memcpy(data + len1, str2, len2 + 1);
+
+    obj_t* newObj = obj_string_nocopy_new(data);
+    vm_push(vm, OBJ_VAL(newObj));
+    obj_append(vm, newObj);
+}
+
+void aot_scons(vm_t* vm, int sp) {
+    vm->sp = sp;
+    val_t val = vm_pop(vm);
+    char* str = AS_STRING(vm_pop(vm));
+    size_t len = strlen(str);
+    char* newStr = malloc(sizeof(char) * (len+2));
+    memcpy(newStr, str, len);
+    newStr[len] = (char)AS_INT32(val);
+    newStr[len+1] = '\0';
+
+    obj_t* newObj = obj_string_nocopy_new(newStr);
+    vm_push(vm, OBJ_VAL(newObj));
+    obj_append(vm, newObj);
+}
+
+void aot_class(vm_t* vm, int sp, int fields) {
+    vm->sp = sp;
+    obj_t* obj = obj_class_new(fields);
+    vm_push(vm, OBJ_VAL(obj));
+    obj_append(vm, obj);
+}
@@ -0,0 +1,119 @@
+/**
+ * aot.h
+ * Copyright (C) 2017 Alexander Koch
+ * Runtime of programs translated to C
+ *
+ * tools/aot.c translates bytecode into a C translation unit, that is
+ * compiled and linked with the runtime (vm, lib, ...) into a native binary.
+ * Every function becomes a C function, jumps become gotos.
+ * Stack slots become C locals, unless they are read from other frames
+ * (globals of the toplevel code, variables of functions with nested functions).
+ * The locals are written to the value stack before anything can run the GC,
+ * so the stack looks the same to the GC and the syscalls as in the VM.
+ *
+ * The helpers below implement the instructions that work on objects,
+ * calls and returns on the value stack (vm->sp), like vm_exec does.
+ */
+
+#ifndef aot_h
+#define aot_h
+
+#include "../vm/vm.h"
+
+// Translated function, frame is shared by tail calls
+typedef void (*aot_func_t)(vm_t* vm, frame_t* frame, int fp);
+
+// Value stack of the VM, may move when it grows
+#define STACK(i) (vm->stack[i])
+
+// Unboxing (A) and boxing (V) of int, float and bool values (see val.c)
+typedef union {
+    val_t bits64;
+    uint32_t bits32[2];
+    double num;
+} aot_bits_t;
+
+static inline int32_t aot_int(val_t v) { aot_bits_t d; d.bits64 = v; return d.bits32[0]; }
+static inline val_t aot_int_val(int32_t i) { aot_bits_t d; d.bits32[0] = i; d.bits32[1] = 0; return d.bits64; }
+static inline double aot_num(val_t v) { aot_bits_t d; d.bits64 = v; return d.num; }
+static inline val_t aot_num_val(double n) { aot_bits_t d; d.num = n; return d.bits64; }
+
+#define AI(v) aot_int(v)
+#define VI(i) aot_int_val(i)
+#define AF(v) aot_num(v)
+#define VF(n) aot_num_val(n)
+#define AB(v) ((v) == TRUE_VAL)
+#define VB(b) ((b) ? TRUE_VAL : FALSE_VAL)
+
+// Runs the toplevel code, size is its maximum stack depth
+void aot_run(vm_t* vm, aot_func_t toplevel, int size, int argc, char** argv);
+
+// Pushes a copy of an object at sp (see COPY in vm.c), returns it
+val_t aot_copy(vm_t* vm, int sp, val_t val);
+
+// Calls. The arguments are on the stack, below sp.
+void aot_syscall(vm_t* vm, int sp, int index);
+void aot_enter(vm_t* vm, int sp, int size);
+int aot_tailcall(vm_t* vm, frame_t* frame, int sp, int mode, int size);
+
+// Inlined into every call site, the checks are in aot_enter
+static inline void aot_invoke(vm_t* vm, frame_t* frame, int sp, int args, int size) {
+    if(sp + size > vm->stackSize || vm->depth >= vm->stackLimit - 1) {
+        aot_enter(vm, sp, size);
+    }
+    vm->depth++;
+    frame->receiver = sp - args - 1;
+    frame->keep = false;
+    frame->level = 0;
+}
+
+static inline void aot_ret(vm_t* vm, frame_t* frame, val_t ret) {
+    int sp = frame->receiver + 1;
+    if(frame->level) vm->display[frame->level] = frame->saved;
+
+    if(frame->keep) {
+        val_t clazz = STACK(sp-1);
+        STACK(sp-1) = ret;
+        STACK(sp) = clazz;
+    } else {
+        STACK(sp) = ret;
+    }
+    vm->depth--;
+}
+
+// Void functions return nothing, a method leaves its class in place
+static inline void aot_retvoid(vm_t* vm, frame_t* frame) {
+    if(frame->level) vm->display[frame->level] = frame->saved;
+    vm->depth--;
+}
+
+static inline void aot_retvirtual(vm_t* vm, frame_t* frame, val_t ret) {
+    int sp = frame->receiver + 1;
+    if(frame->level) vm->display[frame->level] = frame->saved;
+    if(frame->keep) sp--;
+
+    val_t clazz = STACK(sp-1);
+    STACK(sp-1) = ret;
+    STACK(sp) = clazz;
+    vm->depth--;
+}
+
+// Throws, if a subscript is out of bounds (sgetsub is inlined)
+// or an integer is divided by zero
+void aot_bounds(vm_t* vm, int sp);
+void aot_divzero(vm_t* vm, int sp);
+
+// Object instructions, the operands are on the stack, below sp
+void aot_arr(vm_t* vm, int sp, int count);
+void aot_str(vm_t* vm, int sp, int count);
+void aot_tostr(vm_t* vm, int sp);
+void aot_getsub(vm_t* vm, int sp);
+void aot_setsub(vm_t* vm, int sp);
+void aot_append(vm_t* vm, int sp);
+void aot_cons(vm_t* vm, int sp);
+void aot_ssetsub(vm_t* vm, int sp);
+void aot_sappend(vm_t* vm, int sp);
+void aot_scons(vm_t* vm, int sp);
+void aot_class(vm_t* vm, int sp, int fields);
+
+#endif
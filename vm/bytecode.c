@@ -73,15 +73,292 @@ const char* op2str(opcode_t code) {
         case OP_LEN: return "len";
         case OP_CONS: return "cons";
         case OP_APPEND: return "append";
+        case OP_SGETSUB: return "sgetsub";
+        case OP_SSETSUB: return "ssetsub";
+        case OP_SLEN: return "slen";
+        case OP_SCONS: return "scons";
+        case OP_SAPPEND: return "sappend";
         case OP_UPVAL: return "upval";
         case OP_UPSTORE: return "upstore";
         case OP_CLASS: return "class";
         case OP_SETFIELD: return "setfield";
         case OP_GETFIELD: return "getfield";
+        case OP_IADDLK: return "iaddlk";
+        case OP_ISUBLK: return "isublk";
+        case OP_ILTLK: return "iltlk";
+        case OP_LOAD2: return "load2";
+        case OP_LDFIELD: return "ldfield";
+        case OP_STOREJMP: return "storejmp";
+        case OP_JIEQ: return "jieq";
+        case OP_JINE: return "jine";
+        case OP_JILT: return "jilt";
+        case OP_JIGT: return "jigt";
+        case OP_JILE: return "jile";
+        case OP_JIGE: return "jige";
+        case OP_JFEQ: return "jfeq";
+        case OP_JFNE: return "jfne";
+        case OP_JFLT: return "jflt";
+        case OP_JFGT: return "jfgt";
+        case OP_JFLE: return "jfle";
+        case OP_JFGE: return "jfge";
+        case OP_JIEQK: return "jieqk";
+        case OP_JINEK: return "jinek";
+        case OP_JILTK: return "jiltk";
+        case OP_JIGTK: return "jigtk";
+        case OP_JILEK: return "jilek";
+        case OP_JIGEK: return "jigek";
+        case OP_INCL: return "incl";
+        case OP_GINC: return "ginc";
+        case OP_ADDL: return "addl";
+        case OP_JIEQLK: return "jieqlk";
+        case OP_JINELK: return "jinelk";
+        case OP_JILTLK: return "jiltlk";
+        case OP_JIGTLK: return "jigtlk";
+        case OP_JILELK: return "jilelk";
+        case OP_JIGELK: return "jigelk";
+        case OP_TAILCALL: return "tailcall";
+        case OP_ENTER: return "enter";
+        case OP_BORROW: return "borrow";
+        case OP_GBORROW: return "gborrow";
+        case OP_BORROW0: return "borrow0";
+        case OP_STFIELD: return "stfield";
+        case OP_CATCH: return "catch";
+        case OP_RETVOID: return "retvoid";
+        case OP_FORL: return "forl";
+        case OP_FORIN: return "forin";
+        case OP_SWITCH: return "switch";
+        case OP_CASE: return "case";
+        case OP_PUSHK: return "pushk";
         default: return "undefined";
     }
 }
 
+operand_t op_operands(opcode_t code) {
+    switch(code) {
+        case OP_PUSH:
+        case OP_LDLIB: return OPERAND_VAL;
+
+        case OP_STORE:
+        case OP_LOAD:
+        case OP_GSTORE:
+        case OP_GLOAD:
+        case OP_RESERVE:
+        case OP_JMP:
+        case OP_JMPF:
+        case OP_ARR:
+        case OP_STR:
+        case OP_CLASS:
+        case OP_SETFIELD:
+        case OP_GETFIELD:
+        case OP_LDFIELD:
+        case OP_JIEQ:
+        case OP_JINE:
+        case OP_JILT:
+        case OP_JIGT:
+        case OP_JILE:
+        case OP_JIGE:
+        case OP_JFEQ:
+        case OP_JFNE:
+        case OP_JFLT:
+        case OP_JFGT:
+        case OP_JFLE:
+        case OP_JFGE:
+        case OP_ENTER:
+        case OP_BORROW:
+        case OP_GBORROW:
+        case OP_STFIELD:
+        case OP_CATCH:
+        case OP_CASE:
+        case OP_PUSHK: return OPERAND_INT;
+
+        case OP_SYSCALL:
+        case OP_INVOKE:
+        case OP_UPVAL:
+        case OP_UPSTORE:
+        case OP_IADDLK:
+        case OP_ISUBLK:
+        case OP_ILTLK:
+        case OP_LOAD2:
+        case OP_STOREJMP:
+        case OP_JIEQK:
+        case OP_JINEK:
+        case OP_JILTK:
+        case OP_JIGTK:
+        case OP_JILEK:
+        case OP_JIGEK:
+        case OP_INCL:
+        case OP_GINC:
+        case OP_ADDL:
+        case OP_JIEQLK:
+        case OP_JINELK:
+        case OP_JILTLK:
+        case OP_JIGTLK:
+        case OP_JILELK:
+        case OP_JIGELK:
+        case OP_TAILCALL:
+        case OP_FORL:
+        case OP_FORIN:
+        case OP_SWITCH: return OPERAND_INT2;
+        default: return OPERAND_NONE;
+    }
+}
+
+// Opcodes that carry a bytecode address as their first operand
+bool op_has_address(opcode_t code) {
+    switch(code) {
+        case OP_INVOKE:
+        case OP_JMP:
+        case OP_JMPF:
+        case OP_STOREJMP:
+        case OP_JIEQ:
+        case OP_JINE:
+        case OP_JILT:
+        case OP_JIGT:
+        case OP_JILE:
+        case OP_JIGE:
+        case OP_JFEQ:
+        case OP_JFNE:
+        case OP_JFLT:
+        case OP_JFGT:
+        case OP_JFLE:
+        case OP_JFGE:
+        case OP_JIEQK:
+        case OP_JINEK:
+        case OP_JILTK:
+        case OP_JIGTK:
+        case OP_JILEK:
+        case OP_JIGEK:
+        case OP_JIEQLK:
+        case OP_JINELK:
+        case OP_JILTLK:
+        case OP_JIGTLK:
+        case OP_JILELK:
+        case OP_JIGELK:
+        case OP_TAILCALL:
+        case OP_CATCH:
+        case OP_FORL:
+        case OP_FORIN:
+        case OP_CASE: return true;
+        default: return false;
+    }
+}
+
+// Stack effect of an instruction
+int op_stack_effect(code_t* instr) {
+    switch(instr->op) {
+        case OP_PUSH:
+        case OP_PUSHK:
+        case OP_LOAD:
+        case OP_GLOAD:
+        case OP_LDARG0:
+        case OP_UPVAL:
+        case OP_CLASS:
+        case OP_IADDLK:
+        case OP_ISUBLK:
+        case OP_ILTLK:
+        case OP_LDFIELD:
+        case OP_BORROW:
+        case OP_GBORROW:
+        case OP_BORROW0:
+        case OP_CATCH: return 1;
+        case OP_LOAD2: return 2;
+        case OP_SETSUB:
+        case OP_SSETSUB:
+        case OP_JIEQ:
+        case OP_JINE:
+        case OP_JILT:
+        case OP_JIGT:
+        case OP_JILE:
+        case OP_JIGE:
+        case OP_JFEQ:
+        case OP_JFNE:
+        case OP_JFLT:
+        case OP_JFGT:
+        case OP_JFLE:
+        case OP_JFGE: return -2;
+        case OP_INVOKE:
+        case OP_SYSCALL: return -CALL_ARGS(instr->b) + ((instr->b & CALL_VOID) ? 0 : 1);
+        case OP_ARR:
+        case OP_STR: return -instr->a + 1;
+        case OP_RESERVE: return instr->a;
+        case OP_BITNOT:
+        case OP_IMINUS:
+        case OP_I2F:
+        case OP_FMINUS:
+        case OP_F2I:
+        case OP_NOT:
+        case OP_B2I:
+        case OP_TOSTR:
+        case OP_LEN:
+        case OP_SLEN:
+        case OP_GETFIELD:
+        case OP_LDLIB:
+        case OP_INCL:
+        case OP_GINC:
+        case OP_ADDL:
+        case OP_JIEQLK:
+        case OP_JINELK:
+        case OP_JILTLK:
+        case OP_JIGTLK:
+        case OP_JILELK:
+        case OP_JIGELK:
+        case OP_JMP:
+        case OP_TAILCALL:
+        case OP_ENTER:
+        case OP_RETVOID:
+        case OP_FORL:
+        case OP_FORIN:
+        case OP_CASE:
+        case OP_HLT: return 0;
+        default: return -1;
+    }
+}
+
+// Instructions, after which execution does not continue with the next one
+bool op_is_terminator(opcode_t op) {
+    switch(op) {
+        case OP_HLT:
+        case OP_RET:
+        case OP_RETVIRTUAL:
+        case OP_RETVOID:
+        case OP_JMP:
+        case OP_STOREJMP:
+        case OP_TAILCALL:
+        case OP_SWITCH:
+        case OP_CASE: return true;
+        default: return false;
+    }
+}
+
+void code_print(code_t* instr) {
+    printf("%s", op2str(instr->op));
+    switch(op_operands(instr->op)) {
+        case OPERAND_VAL: {
+            printf(", ");
+            val_print(instr->v);
+            break;
+        }
+        case OPERAND_INT: printf(", %d", instr->a); break;
+        case OPERAND_INT2: {
+            if(instr->op >= OP_JIEQLK && instr->op <= OP_JIGELK) {
+                printf(", %d, %d:%d", instr->a, SLOT_OF(instr->b), IMM_OF(instr->b));
+                break;
+            }
+            if(instr->op == OP_TAILCALL) {
+                printf(", %d, %d, %d", instr->a, TAIL_ARGS(instr->b), instr->b >> 8);
+                break;
+            }
+            if((instr->op == OP_INVOKE || instr->op == OP_SYSCALL) && (instr->b & CALL_VOID)) {
+                printf(", %d, %d, void", instr->a, CALL_ARGS(instr->b));
+                break;
+            }
+            printf(", %d, %d", instr->a, instr->b);
+            break;
+        }
+        default: break;
+    }
+}
+
 instruction_t* instruction_new(opcode_t op) {
     instruction_t* ins = malloc(sizeof(*ins));
     ins->op = op;
@@ -225,9 +502,8 @@ bool emit_tok2op(vector_t* buffer, token_type_t tok, datatype_t* type) {
     return op == -1 ? false : true;
 }
 
-void emit_syscall(vector_t* buffer, size_t index) {
-    val_t v1 = INT32_VAL(index);
-    insert_v1(buffer, OP_SYSCALL, v1);
+void emit_syscall(vector_t* buffer, size_t index, size_t args) {
+    insert_v2(buffer, OP_SYSCALL, INT32_VAL(index), INT32_VAL(args));
 }
 
 void emit_invoke(vector_t* buffer, size_t address, size_t args) {
@@ -248,18 +524,30 @@ void emit_load(vector_t* buffer, int address, bool global) {
     insert_v1(buffer, global ? OP_GLOAD : OP_LOAD, INT32_VAL(address));
 }
 
-void emit_load_upval(vector_t* buffer, int depth, int address) {
-    insert_v2(buffer, OP_UPVAL, INT32_VAL(depth), INT32_VAL(address));
+void emit_load_upval(vector_t* buffer, int level, int address) {
+    insert_v2(buffer, OP_UPVAL, INT32_VAL(level), INT32_VAL(address));
+}
+
+void emit_store_upval(vector_t* buffer, int level, int address) {
+    insert_v2(buffer, OP_UPSTORE, INT32_VAL(level), INT32_VAL(address));
+}
+
+void emit_enter(vector_t* buffer, int level) {
+    insert_v1(buffer, OP_ENTER, INT32_VAL(level));
 }
 
-void emit_store_upval(vector_t* buffer, int depth, int address) {
-    insert_v2(buffer, OP_UPSTORE, INT32_VAL(depth), INT32_VAL(address));
+void emit_catch(vector_t* buffer, int address) {
+    insert_v1(buffer, OP_CATCH, INT32_VAL(address));
 }
 
 void emit_class_setfield(vector_t* buffer, int address) {
     insert_v1(buffer, OP_SETFIELD, INT32_VAL(address));
 }
 
+void emit_class_stfield(vector_t* buffer, int address) {
+    insert_v1(buffer, OP_STFIELD, INT32_VAL(address));
+}
+
 void emit_class_getfield(vector_t* buffer, int address) {
     insert_v1(buffer, OP_GETFIELD, INT32_VAL(address));
 }
@@ -297,6 +585,94 @@ val_t* emit_jmpf(vector_t* buffer, int address) {
     return GEN_JMP_REF();
 }
 
+/**
+ * Try to cast a comparison token to a compare-and-jump opcode.
+ * If the cast fails, -1 is returned.
+ */
+int getJmpOp(token_type_t tok, datatype_t* dt) {
+    type_t type = dt->type;
+    bool integer = (type == DATA_INT || type == DATA_CHAR);
+    bool number = (type == DATA_FLOAT);
+    if(!integer && !number) return -1;
+
+    switch(tok) {
+        case TOKEN_EQUAL: return integer ? OP_JIEQ : OP_JFEQ;
+        case TOKEN_NEQUAL: return integer ? OP_JINE : OP_JFNE;
+        case TOKEN_LESS: return integer ? OP_JILT : OP_JFLT;
+        case TOKEN_GREATER: return integer ? OP_JIGT : OP_JFGT;
+        case TOKEN_LEQUAL: return integer ? OP_JILE : OP_JFLE;
+        case TOKEN_GEQUAL: return integer ? OP_JIGE : OP_JFGE;
+        default: return -1;
+    }
+}
+
+val_t* emit_cmp_jmpf(vector_t* buffer, token_type_t tok, datatype_t* type, int address) {
+    int op = getJmpOp(tok, type);
+    if(op == -1) return 0;
+
+    insert_v1(buffer, op, INT32_VAL(address));
+    return GEN_JMP_REF();
+}
+
+val_t* emit_cmp_jmpf_k(vector_t* buffer, token_type_t tok, int k, int address) {
+    int op = -1;
+    switch(tok) {
+        case TOKEN_EQUAL: op = OP_JIEQK; break;
+        case TOKEN_NEQUAL: op = OP_JINEK; break;
+        case TOKEN_LESS: op = OP_JILTK; break;
+        case TOKEN_GREATER: op = OP_JIGTK; break;
+        case TOKEN_LEQUAL: op = OP_JILEK; break;
+        case TOKEN_GEQUAL: op = OP_JIGEK; break;
+        default: return 0;
+    }
+
+    insert_v2(buffer, op, INT32_VAL(address), INT32_VAL(k));
+    return GEN_JMP_REF();
+}
+
+void emit_inc(vector_t* buffer, int address, int k, bool global) {
+    insert_v2(buffer, global ? OP_GINC : OP_INCL, INT32_VAL(address), INT32_VAL(k));
+}
+
+void emit_add_local(vector_t* buffer, int address, int other) {
+    insert_v2(buffer, OP_ADDL, INT32_VAL(address), INT32_VAL(other));
+}
+
+val_t* emit_cmp_local_jmpf(vector_t* buffer, token_type_t tok, int address, int k, int jmp) {
+    if(!FITS_IMM16(address) || !FITS_IMM16(k)) return 0;
+
+    int op = -1;
+    switch(tok) {
+        case TOKEN_EQUAL: op = OP_JIEQLK; break;
+        case TOKEN_NEQUAL: op = OP_JINELK; break;
+        case TOKEN_LESS: op = OP_JILTLK; break;
+        case TOKEN_GREATER: op = OP_JIGTLK; break;
+        case TOKEN_LEQUAL: op = OP_JILELK; break;
+        case TOKEN_GEQUAL: op = OP_JIGELK; break;
+        default: return 0;
+    }
+
+    insert_v2(buffer, op, INT32_VAL(jmp), INT32_VAL(SLOT_IMM(address, k)));
+    return GEN_JMP_REF();
+}
+
+void emit_for_range(vector_t* buffer, int address, int jmp) {
+    insert_v2(buffer, OP_FORL, INT32_VAL(jmp), INT32_VAL(address));
+}
+
+void emit_for_each(vector_t* buffer, int address, int jmp) {
+    insert_v2(buffer, OP_FORIN, INT32_VAL(jmp), INT32_VAL(address));
+}
+
+void emit_switch(vector_t* buffer, int low, int count) {
+    insert_v2(buffer, OP_SWITCH, INT32_VAL(low), INT32_VAL(count));
+}
+
+val_t* emit_case(vector_t* buffer, int address) {
+    insert_v1(buffer, OP_CASE, INT32_VAL(address));
+    return GEN_JMP_REF();
+}
+
 void bytecode_buffer_free(vector_t* buffer) {
     if(buffer) {
         for(size_t i = 0; i < vector_size(buffer); i++) {
@@ -308,3 +684,610 @@ void bytecode_buffer_free(vector_t* buffer) {
         vector_free(buffer);
     }
 }
+
+// Walks the code from the entries of the worklist (pc, depth, function)
+static bool depths_walk(bytecode_t* bytecode, int* work, int count, int* depth, int* func, int* frame) {
+    int size = bytecode->size;
+    bool success = true;
+    while(count > 0 && success) {
+        int entry = work[--count];
+        int d = work[--count];
+        int pc = work[--count];
+
+        while(pc >= 0 && pc < size) {
+            if(depth[pc] != -1) {
+                success = depth[pc] == d && func[pc] == entry;
+                break;
+            }
+
+            code_t* instr = &bytecode->code[pc];
+            depth[pc] = d;
+            func[pc] = entry;
+
+            int next = d + op_stack_effect(instr);
+            if(next < 0) {
+                success = false;
+                break;
+            }
+            if(d > frame[entry]) frame[entry] = d;
+            if(next > frame[entry]) frame[entry] = next;
+
+            // Every instruction is visited once, so the worklist can not overflow
+            if(op_has_address(instr->op) && instr->op != OP_CATCH) {
+                bool call = instr->op == OP_INVOKE || instr->op == OP_TAILCALL;
+                work[count++] = instr->a;
+                work[count++] = call ? 0 : next;
+                work[count++] = call ? instr->a : entry;
+            }
+
+            // The entries of a jump table are visited with the switch,
+            // only their targets are added
+            if(instr->op == OP_SWITCH) {
+                for(int i = pc + 1; i <= pc + instr->b + 1; i++) {
+                    if(depth[i] != -1) {
+                        success = depth[i] == next && func[i] == entry;
+                        if(!success) break;
+                        continue;
+                    }
+                    depth[i] = next;
+                    func[i] = entry;
+                    work[count++] = bytecode->code[i].a;
+                    work[count++] = next;
+                    work[count++] = entry;
+                }
+            }
+
+            if(op_is_terminator(instr->op)) break;
+            d = next;
+            pc++;
+        }
+    }
+    return success;
+}
+
+// Stack depths by abstract interpretation (see bytecode.h)
+bool bytecode_depths(bytecode_t* bytecode, int* depth, int* func, int* frame) {
+    int size = bytecode->size;
+    int* work = malloc(sizeof(int) * (size + 1) * 3);
+
+    for(int i = 0; i < size; i++) {
+        depth[i] = -1;
+        func[i] = 0;
+        frame[i] = 0;
+    }
+
+    // Entries: pc, depth, function
+    work[0] = 0;
+    work[1] = 0;
+    work[2] = 0;
+    bool success = depths_walk(bytecode, work, 3, depth, func, frame);
+
+    // Handlers are only entered by unwinding, once their guarded code is reached.
+    // Handlers of try blocks within handlers are reached in the next round.
+    int count = 1;
+    while(success && count > 0) {
+        count = 0;
+        for(int pc = 0; pc < size; pc++) {
+            code_t* instr = &bytecode->code[pc];
+            if(instr->op == OP_CATCH && depth[pc] == -1 && depth[instr->a] != -1) {
+                work[count++] = pc;
+                work[count++] = depth[instr->a];
+                work[count++] = func[instr->a];
+            }
+        }
+        success = depths_walk(bytecode, work, count, depth, func, frame);
+    }
+
+    free(work);
+    return success;
+}
+
+// Local slots accessed by an instruction, returns their count
+// (the first and the last of a range of slots)
+static int op_slots(code_t* instr, int* slots) {
+    switch(instr->op) {
+        case OP_STORE:
+        case OP_LOAD:
+        case OP_BORROW:
+        case OP_IADDLK:
+        case OP_ISUBLK:
+        case OP_ILTLK:
+        case OP_INCL: slots[0] = instr->a; return 1;
+        case OP_LOAD2:
+        case OP_ADDL: slots[0] = instr->a; slots[1] = instr->b; return 2;
+        case OP_STOREJMP: slots[0] = instr->b; return 1;
+        case OP_FORL: slots[0] = instr->b; slots[1] = instr->b + 1; return 2;
+        case OP_FORIN: slots[0] = instr->b; slots[1] = instr->b + 2; return 2;
+        default: break;
+    }
+    if(instr->op >= OP_JIEQLK && instr->op <= OP_JIGELK) {
+        slots[0] = SLOT_OF(instr->b);
+        return 1;
+    }
+    return 0;
+}
+
+// Instructions, that access the receiver of a method
+static bool op_uses_receiver(opcode_t op) {
+    switch(op) {
+        case OP_LDARG0:
+        case OP_SETARG0:
+        case OP_LDFIELD:
+        case OP_BORROW0:
+        case OP_STFIELD:
+        case OP_RETVIRTUAL: return true;
+        default: return false;
+    }
+}
+
+// Valid argument count of invoke and syscall (see CALL_VOID)
+static bool call_args_valid(int b) {
+    return b >= 0 && (b & ~(CALL_VOID | CALL_ARGS(~0))) == 0;
+}
+
+// Records whether the function at entry returns nothing,
+// returns false if it was recorded differently before
+static bool same_result(int* results, int entry, bool none) {
+    if(results[entry] != -1 && results[entry] != none) return false;
+    results[entry] = none;
+    return true;
+}
+
+verifier_t* verifier_new(size_t size) {
+    verifier_t* verifier = malloc(sizeof(*verifier));
+    verifier->depth = malloc(sizeof(int) * (size + 1));
+    verifier->func = malloc(sizeof(int) * (size + 1));
+    verifier->args = malloc(sizeof(int) * (size + 1));
+    verifier->results = malloc(sizeof(int) * (size + 1));
+    verifier->method = malloc(sizeof(bool) * (size + 1));
+    return verifier;
+}
+
+void verifier_free(verifier_t* verifier) {
+    if(verifier) {
+        free(verifier->depth);
+        free(verifier->func);
+        free(verifier->args);
+        free(verifier->results);
+        free(verifier->method);
+        free(verifier);
+    }
+}
+
+static void verifier_grow(verifier_t* verifier, size_t size) {
+    verifier->depth = realloc(verifier->depth, sizeof(int) * (size + 1));
+    verifier->func = realloc(verifier->func, sizeof(int) * (size + 1));
+    verifier->args = realloc(verifier->args, sizeof(int) * (size + 1));
+    verifier->results = realloc(verifier->results, sizeof(int) * (size + 1));
+    verifier->method = realloc(verifier->method, sizeof(bool) * (size + 1));
+}
+
+// Checks the instructions from base on on their own:
+// opcodes, addresses, constants, jump tables and exception handlers
+static const char* verify_instructions(bytecode_t* bytecode, int base) {
+    code_t* code = bytecode->code;
+    int size = bytecode->size;
+
+    // The error handler of the VM is the last instruction
+    if(size <= base || code[size-1].op != OP_HLT) {
+        return "Code does not end with hlt";
+    }
+    for(int i = base; i < size; i++) {
+        if((unsigned)code[i].op >= OP_COUNT) return "Invalid opcode";
+        if(op_has_address(code[i].op) && (code[i].a < 0 || code[i].a >= size)) {
+            return "Jump target out of range";
+        }
+        // Appended code is a function of its own, only its calls leave it
+        bool call = code[i].op == OP_INVOKE || code[i].op == OP_TAILCALL;
+        if(base > 0 && op_has_address(code[i].op) && !call && code[i].a < base) {
+            return "Jump target out of range";
+        }
+        if(code[i].op == OP_PUSHK && (code[i].a < 0 || code[i].a >= bytecode->constantCount)) {
+            return "Constant out of range";
+        }
+    }
+
+    // Jump tables are followed by their entries, the last one (default) included
+    for(int i = base; i < size; i++) {
+        if(code[i].op != OP_SWITCH) continue;
+        if(code[i].b < 1 || code[i].b > size - i - 2) return "Invalid jump table";
+        for(int j = i + 1; j <= i + code[i].b + 1; j++) {
+            if(code[j].op != OP_CASE) return "Invalid jump table";
+        }
+    }
+
+    // Handlers guard the code before them and are only entered by unwinding.
+    // The handler table only covers the loaded code.
+    for(int i = base; i < size; i++) {
+        if(code[i].op == OP_CATCH) {
+            if(base > 0 || code[i].a >= i || (i > 0 && !op_is_terminator(code[i-1].op))) return "Invalid exception handler";
+        } else if(op_has_address(code[i].op) && code[code[i].a].op == OP_CATCH) {
+            return "Invalid exception handler";
+        }
+    }
+    return 0;
+}
+
+// Records the argument count, the result and the receiver of the function,
+// that the instruction at pc calls or returns from.
+// Calls and returns have to agree on the result.
+static const char* verify_calls(bytecode_t* bytecode, verifier_t* verifier, int pc) {
+    code_t* instr = &bytecode->code[pc];
+    int* func = verifier->func;
+    int* args = verifier->args;
+    int* results = verifier->results;
+
+    if(instr->op == OP_INVOKE || instr->op == OP_TAILCALL) {
+        bool invoke = instr->op == OP_INVOKE;
+        int count = invoke ? CALL_ARGS(instr->b) : TAIL_ARGS(instr->b);
+        bool none = invoke && (instr->b & CALL_VOID);
+        if(invoke && !call_args_valid(instr->b)) return "Invalid argument count";
+        if(args[instr->a] != -1 && args[instr->a] != count) return "Calls with different argument counts";
+        if(!same_result(results, instr->a, none)) return "Calls with different results";
+        // A tail call returns the result of the callee
+        if(!invoke && !same_result(results, func[pc], false)) return "Calls with different results";
+        args[instr->a] = count;
+    } else if(op_uses_receiver(instr->op) || instr->op == OP_RET || instr->op == OP_RETVOID) {
+        if(func[pc] == 0) return "Return or receiver outside of a function";
+        if(!op_uses_receiver(instr->op) || instr->op == OP_RETVIRTUAL) {
+            if(!same_result(results, func[pc], instr->op == OP_RETVOID)) return "Calls with different results";
+        }
+        if(op_uses_receiver(instr->op)) verifier->method[func[pc]] = true;
+    }
+    return 0;
+}
+
+// Adds the frame of the function of an enter instruction to its display level
+static const char* verify_display(bytecode_t* bytecode, verifier_t* verifier, int* frame, int pc) {
+    code_t* instr = &bytecode->code[pc];
+    if(instr->op != OP_ENTER) return 0;
+    if(instr->a < 1 || instr->a >= DISPLAY_SIZE) return "Invalid display level";
+
+    int entry = verifier->func[pc];
+    if(-verifier->args[entry] < verifier->lo[instr->a]) verifier->lo[instr->a] = -verifier->args[entry];
+    if(frame[entry] > verifier->hi[instr->a]) verifier->hi[instr->a] = frame[entry];
+    return 0;
+}
+
+// Checks the operands of the instruction at pc, once the functions are known
+static const char* verify_operands(bytecode_t* bytecode, verifier_t* verifier, int* frame, int pc) {
+    code_t* instr = &bytecode->code[pc];
+    int d = verifier->depth[pc];
+    int entry = verifier->func[pc];
+    int* args = verifier->args;
+
+    int slots[2];
+    int count = op_slots(instr, slots);
+    for(int i = 0; i < count; i++) {
+        if(slots[i] < -args[entry] || slots[i] >= frame[entry]) return "Local slot out of range";
+    }
+
+    switch(instr->op) {
+        case OP_GSTORE:
+        case OP_GLOAD:
+        case OP_GBORROW:
+        case OP_GINC: {
+            if(instr->a < 0 || instr->a >= frame[0]) return "Global slot out of range";
+            break;
+        }
+        case OP_UPVAL:
+        case OP_UPSTORE: {
+            int level = instr->a;
+            if(level < 1 || level >= DISPLAY_SIZE || instr->b < verifier->lo[level] || instr->b >= verifier->hi[level]) {
+                return "Upvalue out of range";
+            }
+            break;
+        }
+        case OP_SYSCALL: {
+            // The flag has to match the native, it pushes its result itself
+            if(instr->a < 0 || instr->a >= SYSCALL_COUNT || !call_args_valid(instr->b)
+                || CALL_ARGS(instr->b) > d || ((instr->b & CALL_VOID) != 0) != syscall_void(instr->a)) {
+                return "Invalid syscall";
+            }
+            break;
+        }
+        case OP_INVOKE: {
+            // Methods expect the receiver below the arguments
+            int count = CALL_ARGS(instr->b) + (verifier->method[instr->a] ? 1 : 0);
+            if(count > d) return "Missing arguments of a call";
+            break;
+        }
+        case OP_TAILCALL: {
+            int count = TAIL_ARGS(instr->b) + ((instr->b & TAIL_CALLEE_VIRTUAL) ? 1 : 0);
+            if(count > d) return "Missing arguments of a call";
+            break;
+        }
+        case OP_ARR:
+        case OP_STR: {
+            if(instr->a < 0 || instr->a > d) return "Invalid element count";
+            break;
+        }
+        case OP_CLASS: {
+            if(instr->a < 0 || instr->a > CLASS_FIELDS) return "Invalid class field";
+            break;
+        }
+        case OP_SETFIELD:
+        case OP_GETFIELD:
+        case OP_LDFIELD:
+        case OP_STFIELD: {
+            // The class is only known at runtime, the VM checks the index
+            if(instr->a < 0) return "Invalid class field";
+            break;
+        }
+        default: break;
+    }
+    return 0;
+}
+
+const char* bytecode_verify(bytecode_t* bytecode, verifier_t* verifier, int* frame) {
+    int size = bytecode->size;
+    const char* error = verify_instructions(bytecode, 0);
+    if(error) return error;
+    if(!bytecode_depths(bytecode, verifier->depth, verifier->func, frame)) {
+        return "Inconsistent or negative stack depths";
+    }
+
+    for(int i = 0; i < size; i++) {
+        verifier->args[i] = -1;
+        verifier->results[i] = -1;
+        verifier->method[i] = false;
+    }
+    verifier->args[0] = 0;
+    for(int i = 0; i < DISPLAY_SIZE; i++) {
+        verifier->lo[i] = 0;
+        verifier->hi[i] = 0;
+    }
+
+    // Functions, the frames of every display level, then the operands
+    for(int pc = 0; pc < size && !error; pc++) {
+        if(verifier->depth[pc] != -1) error = verify_calls(bytecode, verifier, pc);
+    }
+    for(int pc = 0; pc < size && !error; pc++) {
+        if(verifier->depth[pc] != -1) error = verify_display(bytecode, verifier, frame, pc);
+    }
+    for(int pc = 0; pc < size && !error; pc++) {
+        if(verifier->depth[pc] != -1) error = verify_operands(bytecode, verifier, frame, pc);
+    }
+    return error;
+}
+
+const char* bytecode_verify_append(bytecode_t* bytecode, verifier_t* verifier, int* frame, int base, int* calls, int count) {
+    int size = bytecode->size;
+    const char* error = verify_instructions(bytecode, base);
+    if(error) return error;
+
+    verifier_grow(verifier, size);
+    int* depth = verifier->depth;
+    int* func = verifier->func;
+    for(int i = base; i < size; i++) {
+        depth[i] = -1;
+        func[i] = 0;
+        frame[i] = 0;
+        verifier->args[i] = -1;
+        verifier->results[i] = -1;
+        verifier->method[i] = false;
+    }
+
+    // Calls leave the new code only to verified functions,
+    // so the walk does not enter the code before base
+    for(int pc = base; pc < size; pc++) {
+        code_t* instr = &bytecode->code[pc];
+        if((instr->op == OP_INVOKE || instr->op == OP_TAILCALL) && instr->a < base
+            && (depth[instr->a] == -1 || func[instr->a] != instr->a)) {
+            return "Call of an unknown function";
+        }
+    }
+    for(int i = 0; i < count; i++) {
+        code_t* instr = &bytecode->code[calls[i]];
+        if(calls[i] < 0 || calls[i] >= base || (instr->op != OP_INVOKE && instr->op != OP_TAILCALL) || instr->a != base) {
+            return "Invalid call of appended code";
+        }
+    }
+
+    int* work = malloc(sizeof(int) * (size - base + 1) * 3);
+    work[0] = base;
+    work[1] = 0;
+    work[2] = base;
+    bool success = depths_walk(bytecode, work, 3, depth, func, frame);
+    free(work);
+    if(!success) return "Inconsistent or negative stack depths";
+
+    // The same checks as above, for the new function and its calls.
+    // A dropped function does not widen the display levels.
+    int lo[DISPLAY_SIZE];
+    int hi[DISPLAY_SIZE];
+    memcpy(lo, verifier->lo, sizeof(lo));
+    memcpy(hi, verifier->hi, sizeof(hi));
+    for(int i = 0; i < count && !error; i++) {
+        if(depth[calls[i]] != -1) error = verify_calls(bytecode, verifier, calls[i]);
+    }
+    for(int pc = base; pc < size && !error; pc++) {
+        if(depth[pc] != -1) error = verify_calls(bytecode, verifier, pc);
+    }
+    for(int pc = base; pc < size && !error; pc++) {
+        if(depth[pc] != -1) error = verify_display(bytecode, verifier, frame, pc);
+    }
+    for(int i = 0; i < count && !error; i++) {
+        if(depth[calls[i]] != -1) error = verify_operands(bytecode, verifier, frame, calls[i]);
+    }
+    for(int pc = base; pc < size && !error; pc++) {
+        if(depth[pc] != -1) error = verify_operands(bytecode, verifier, frame, pc);
+    }
+    if(error) {
+        memcpy(verifier->lo, lo, sizeof(lo));
+        memcpy(verifier->hi, hi, sizeof(hi));
+    }
+    return error;
+}
+
+// Collects the handler table (see handler_t), returns the number of entries.
+// Handlers follow their guarded code, so inner ones come first in pc order.
+// The code of nested functions within the guarded code is left out.
+static int bytecode_handlers(bytecode_t* bytecode, int* depth, int* func, handler_t* out) {
+    int count = 0;
+    for(int h = 0; h < (int)bytecode->size; h++) {
+        code_t* instr = &bytecode->code[h];
+        if(instr->op != OP_CATCH || depth[h] == -1) continue;
+
+        int start = -1;
+        for(int pc = instr->a; pc <= h; pc++) {
+            bool guarded = pc < h && (depth[pc] == -1 || func[pc] == func[h]);
+            if(guarded && start == -1) {
+                start = pc;
+            } else if(!guarded && start != -1) {
+                if(out) {
+                    out[count].start = start;
+                    out[count].end = pc;
+                    out[count].pc = h;
+                    out[count].depth = depth[instr->a];
+                }
+                count++;
+                start = -1;
+            }
+        }
+    }
+    return count;
+}
+
+// Cache line size used for aligning the code array
+#define CODE_ALIGN 64
+
+// Index of the string in the constant pool, it is added if new
+static int bytecode_intern(bytecode_t* bytecode, hashmap_t* index, val_t str) {
+    void* found = 0;
+    if(hashmap_get(index, AS_STRING(str), &found) == HMAP_OK) {
+        return (int)(intptr_t)found - 1;
+    }
+
+    int k = bytecode->constantCount++;
+    bytecode->constants = realloc(bytecode->constants, sizeof(val_t) * bytecode->constantCount);
+    bytecode->constants[k] = val_permanent(val_copy(str));
+    hashmap_set(index, AS_STRING(bytecode->constants[k]), (void*)(intptr_t)(k + 1));
+    return k;
+}
+
+// Allocates the code for size instructions, the first count are moved over.
+// Aligned to a cache line, the raw pointer is kept for freeing.
+static void bytecode_alloc(bytecode_t* bytecode, size_t size, size_t count) {
+    void* mem = malloc(sizeof(code_t) * size + CODE_ALIGN);
+    uintptr_t addr = ((uintptr_t)mem + CODE_ALIGN - 1) & ~(uintptr_t)(CODE_ALIGN - 1);
+    if(count > 0) {
+        memcpy((code_t*)addr, bytecode->code, sizeof(code_t) * count);
+        free(bytecode->mem);
+    }
+    bytecode->mem = mem;
+    bytecode->code = (code_t*)addr;
+    bytecode->size = size;
+}
+
+// Packs the buffer into the code from base on,
+// returns false if an integer operand is not an integer
+static bool bytecode_pack(bytecode_t* bytecode, vector_t* buffer, size_t base, hashmap_t* index) {
+    bool typed = true;
+    for(size_t i = 0; i < vector_size(buffer); i++) {
+        instruction_t* instr = vector_get(buffer, i);
+        code_t* code = &bytecode->code[base + i];
+        code->op = instr->op;
+        code->v = 0;
+
+        if(instr->op == OP_PUSH && IS_STRING(instr->v1)) {
+            code->op = OP_PUSHK;
+            code->a = bytecode_intern(bytecode, index, instr->v1);
+            continue;
+        }
+
+        switch(op_operands(instr->op)) {
+            case OPERAND_VAL: code->v = val_copy(instr->v1); break;
+            case OPERAND_INT2: {
+                if(!IS_INT32(instr->v2)) typed = false;
+                code->b = AS_INT32(instr->v2);
+            } // fallthrough
+            case OPERAND_INT: {
+                if(!IS_INT32(instr->v1)) typed = false;
+                code->a = AS_INT32(instr->v1);
+                break;
+            }
+            default: break;
+        }
+    }
+    return typed;
+}
+
+bytecode_t* bytecode_load(vector_t* buffer) {
+    bytecode_t* bytecode = malloc(sizeof(*bytecode));
+    bytecode_alloc(bytecode, vector_size(buffer), 0);
+    bytecode->constants = 0;
+    bytecode->constantCount = 0;
+    hashmap_t* index = hashmap_new();
+    bool typed = bytecode_pack(bytecode, buffer, 0, index);
+    hashmap_free(index);
+
+    // Maximum stack depth of every function
+    verifier_t* verifier = verifier_new(bytecode->size);
+    bytecode->frame = malloc(sizeof(int) * (bytecode->size + 1));
+    bytecode->error = typed ? bytecode_verify(bytecode, verifier, bytecode->frame) : "Operand is not an integer";
+    bytecode->handlers = 0;
+    bytecode->handlerCount = 0;
+    if(bytecode->error) {
+        free(bytecode->frame);
+        bytecode->frame = 0;
+    } else {
+        int count = bytecode_handlers(bytecode, verifier->depth, verifier->func, 0);
+        if(count > 0) {
+            bytecode->handlers = malloc(sizeof(handler_t) * count);
+            bytecode->handlerCount = bytecode_handlers(bytecode, verifier->depth, verifier->func, bytecode->handlers);
+        }
+    }
+    verifier_free(verifier);
+    return bytecode;
+}
+
+bool bytecode_append(bytecode_t* bytecode, vector_t* buffer) {
+    size_t base = bytecode->size;
+    bytecode_alloc(bytecode, base + vector_size(buffer), base);
+
+    // Equal strings share the constants of the loaded code
+    hashmap_t* index = hashmap_new();
+    for(int i = 0; i < bytecode->constantCount; i++) {
+        hashmap_set(index, AS_STRING(bytecode->constants[i]), (void*)(intptr_t)(i + 1));
+    }
+    bool typed = bytecode_pack(bytecode, buffer, base, index);
+    hashmap_free(index);
+    return typed;
+}
+
+void bytecode_truncate(bytecode_t* bytecode, size_t size) {
+    for(size_t i = size; i < bytecode->size; i++) {
+        code_t* code = &bytecode->code[i];
+        if(op_operands(code->op) == OPERAND_VAL) val_free(code->v);
+    }
+    bytecode->size = size;
+}
+
+instruction_t* code_unpack(code_t* code) {
+    instruction_t* instr = instruction_new(code->op);
+    switch(op_operands(code->op)) {
+        case OPERAND_VAL: instr->v1 = val_copy(code->v); break;
+        case OPERAND_INT2: instr->v2 = INT32_VAL(code->b); // fallthrough
+        case OPERAND_INT: instr->v1 = INT32_VAL(code->a); break;
+        default: break;
+    }
+    return instr;
+}
+
+void bytecode_free(bytecode_t* bytecode) {
+    if(bytecode) {
+        for(size_t i = 0; i < bytecode->size; i++) {
+            code_t* code = &bytecode->code[i];
+            if(op_operands(code->op) == OPERAND_VAL) val_free(code->v);
+        }
+        for(int i = 0; i < bytecode->constantCount; i++) {
+            val_release(bytecode->constants[i]);
+        }
+        free(bytecode->constants);
+        free(bytecode->mem);
+        free(bytecode->frame);
+        free(bytecode->handlers);
+        free(bytecode);
+    }
+}
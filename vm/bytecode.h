@@ -14,6 +14,15 @@
  *
  * Also the compiler-specific helper functions are defined below.
  * For instruction lists a vector_t should be used (see adt/vector.h).
+ *
+ * Before execution the vector_t is loaded into a bytecode_t:
+ * one contiguous, cache-aligned array of packed code_t instructions
+ * with the operands decoded into native integers.
+ *
+ * code
+ * |- op   (or handler address, if threaded)
+ * |- v    (push / ldlib)
+ * |- a, b (everything else)
  */
 
 #ifndef bytecode_h
@@ -22,6 +31,7 @@
 #include "../core/mem.h"
 #include "../lexis/lexer.h"
 #include "../adt/vector.h"
+#include "../adt/hashmap.h"
 #include "../parser/ast.h"
 #include "../vm/val.h"
 
@@ -104,12 +114,20 @@ typedef enum {
     OP_BOR,
 
     // Subscript
+    // Array
     OP_GETSUB,
     OP_SETSUB,
     OP_LEN,
     OP_APPEND,
     OP_CONS,
 
+    // String (char[])
+    OP_SGETSUB,
+    OP_SSETSUB,
+    OP_SLEN,
+    OP_SAPPEND,
+    OP_SCONS,
+
     // Upval
     OP_UPVAL,
     OP_UPSTORE,
@@ -117,9 +135,110 @@ typedef enum {
     // Class
     OP_CLASS,
     OP_SETFIELD,
-    OP_GETFIELD
+    OP_GETFIELD,
+
+    // Superinstructions (see compiler/optimizer.c)
+    OP_IADDLK,
+    OP_ISUBLK,
+    OP_ILTLK,
+    OP_LOAD2,
+    OP_LDFIELD,
+    OP_STOREJMP,
+
+    // Compare and jump if false
+    OP_JIEQ,
+    OP_JINE,
+    OP_JILT,
+    OP_JIGT,
+    OP_JILE,
+    OP_JIGE,
+    OP_JFEQ,
+    OP_JFNE,
+    OP_JFLT,
+    OP_JFGT,
+    OP_JFLE,
+    OP_JFGE,
+    OP_JIEQK,
+    OP_JINEK,
+    OP_JILTK,
+    OP_JIGTK,
+    OP_JILEK,
+    OP_JIGEK,
+
+    // Local slot operations
+    OP_INCL,
+    OP_GINC,
+    OP_ADDL,
+    OP_JIEQLK,
+    OP_JINELK,
+    OP_JILTLK,
+    OP_JIGTLK,
+    OP_JILELK,
+    OP_JIGELK,
+
+    // Tail call
+    OP_TAILCALL,
+
+    // Display of nested functions
+    OP_ENTER,
+
+    // Method calls: the receiver is passed without a copy
+    // and its fields are changed in place
+    OP_BORROW,
+    OP_GBORROW,
+    OP_BORROW0,
+    OP_STFIELD,
+
+    // Start of an exception handler (see handler_t)
+    OP_CATCH,
+
+    // Return of a void function, nothing is pushed (see CALL_VOID)
+    OP_RETVOID,
+
+    // Loop step of a for loop over consecutive local slots (see eval_for)
+    OP_FORL,
+    OP_FORIN,
+
+    // Jump table: switch is followed by its entries (case), the last one is the default
+    OP_SWITCH,
+    OP_CASE,
+
+    // Push of a string constant, indexed into the constant pool (see bytecode_load)
+    OP_PUSHK,
+
+    // Number of opcodes, always last
+    OP_COUNT
 } opcode_t;
 
+// Slot and 16-bit immediate packed into one operand (jixxlk)
+#define SLOT_IMM(slot, k) ((int32_t)(((uint32_t)(slot) << 16) | (uint16_t)(k)))
+#define SLOT_OF(x) ((x) >> 16)
+#define IMM_OF(x) ((int16_t)((x) & 0xFFFF))
+#define FITS_IMM16(x) ((x) >= INT16_MIN && (x) <= INT16_MAX)
+
+// Argument count and mode of a tail call, packed into the second operand
+#define TAIL_SELF_VIRTUAL 0x100     // Called from a class method
+#define TAIL_CALLEE_VIRTUAL 0x200   // Calls a class method (receiver below the arguments)
+#define TAIL_KEEP 0x400             // Return the class of the caller instead
+#define TAIL_ARGS(x) ((x) & 0xFF)
+
+// Calls of void functions and natives push no result (invoke, syscall),
+// flagged in the argument count
+#define CALL_VOID 0x100
+#define CALL_ARGS(x) ((x) & 0xFF)
+
+// Maximum nesting level of functions (see enter, upval)
+#define DISPLAY_SIZE 16
+
+// Maximum number of fields of a class (see class)
+#define CLASS_FIELDS 4096
+
+// Number of syscalls (see system_methods in vm.c)
+#define SYSCALL_COUNT 28
+
+// Syscalls without a result, they push nothing (see system_methods in vm.c)
+bool syscall_void(int index);
+
 // Instruction definition
 typedef struct {
     opcode_t op;
@@ -127,8 +246,66 @@ typedef struct {
     val_t v2;
 } instruction_t;
 
+// Operand layout of an opcode in the packed stream
+typedef enum {
+    OPERAND_NONE,
+    OPERAND_INT,
+    OPERAND_INT2,
+    OPERAND_VAL
+} operand_t;
+
+// Packed instruction definition
+// When threaded (see vm.c), op is replaced by the address of its handler.
+typedef struct {
+    union {
+        opcode_t op;
+        const void* handler;
+    };
+    union {
+        val_t v;
+        struct {
+            int32_t a;
+            int32_t b;
+        };
+    };
+} code_t;
+
+// Exception handler: code in [start, end) is guarded by the handler at pc.
+// A thrown exception unwinds to depth (relative to fp), pushes the exception
+// and continues at pc. The table is only read when something is thrown.
+typedef struct {
+    int start;
+    int end;
+    int pc;
+    int depth;
+} handler_t;
+
+// Loaded program, owns its constants.
+// String literals are interned into the constants pool (pushk),
+// they are permanent and shared by every execution of the instruction.
+// frame holds the maximum stack depth of every function, indexed by its entry
+// (toplevel code at 0), so the VM checks the stack size once per call.
+// It is NULL if the code did not pass the verifier, error tells why.
+// handlers are ordered innermost first.
+typedef struct {
+    code_t* code;
+    size_t size;
+    void* mem;
+    int* frame;
+    const char* error;
+    handler_t* handlers;
+    int handlerCount;
+    val_t* constants;
+    int constantCount;
+} bytecode_t;
+
 // Helper functions
 const char* op2str(opcode_t code);
+operand_t op_operands(opcode_t code);
+bool op_has_address(opcode_t code);
+int op_stack_effect(code_t* instr);
+bool op_is_terminator(opcode_t op);
+void code_print(code_t* instr);
 
 /**
  * Insert one opcode and one or two values.
@@ -148,14 +325,17 @@ void emit_char(vector_t* buffer, char c);
 void emit_pop(vector_t* buffer);
 void emit_op(vector_t* buffer, opcode_t op);
 bool emit_tok2op(vector_t* buffer, token_type_t tok, datatype_t* type);
-void emit_syscall(vector_t* buffer, size_t index);
+void emit_syscall(vector_t* buffer, size_t index, size_t args);
 void emit_invoke(vector_t* buffer, size_t address, size_t args);
 void emit_return(vector_t* buffer);
 void emit_store(vector_t* buffer, int address, bool global);
 void emit_load(vector_t* buffer, int address, bool global);
-void emit_load_upval(vector_t* buffer, int depth, int address);
-void emit_store_upval(vector_t* buffer, int depth, int address);
+void emit_load_upval(vector_t* buffer, int level, int address);
+void emit_store_upval(vector_t* buffer, int level, int address);
+void emit_enter(vector_t* buffer, int level);
+void emit_catch(vector_t* buffer, int address);
 void emit_class_setfield(vector_t* buffer, int address);
+void emit_class_stfield(vector_t* buffer, int address);
 void emit_class_getfield(vector_t* buffer, int address);
 void emit_reserve(vector_t* buffer, size_t sz);
 void emit_string_merge(vector_t* buffer, size_t sz);
@@ -172,10 +352,122 @@ val_t* emit_class(vector_t* buffer, int fields);
 val_t* emit_jmp(vector_t* buffer, int address);
 val_t* emit_jmpf(vector_t* buffer, int address);
 
+/**
+ * Compare and jump if false.
+ * Fuses a comparison and a following jmpf into one instruction.
+ * The immediate variant compares an integer against the constant k.
+ * If there is no such instruction for the operator and the datatype,
+ * nothing is emitted and NULL returned.
+ */
+val_t* emit_cmp_jmpf(vector_t* buffer, token_type_t tok, datatype_t* type, int address);
+val_t* emit_cmp_jmpf_k(vector_t* buffer, token_type_t tok, int k, int address);
+
+/**
+ * Local slot operations, used for counters.
+ * emit_inc: slot += k, emit_add_local: slot += other slot (both locals)
+ * emit_cmp_local_jmpf: compare a local slot with k and jump if false.
+ * The slot and k have to fit into 16 bit, otherwise NULL is returned.
+ */
+void emit_inc(vector_t* buffer, int address, int k, bool global);
+void emit_add_local(vector_t* buffer, int address, int other);
+val_t* emit_cmp_local_jmpf(vector_t* buffer, token_type_t tok, int address, int k, int jmp);
+
+/**
+ * For loops, the step jumps back to the body at jmp.
+ * emit_for_range: slot += 1, loop while slot < slot+1
+ * emit_for_each: slot+1 += 1, loop while it indexes the array in slot,
+ * the element is stored in slot+2
+ */
+void emit_for_range(vector_t* buffer, int address, int jmp);
+void emit_for_each(vector_t* buffer, int address, int jmp);
+
+/**
+ * Jump table over the keys low ... low+count-1, followed by count+1
+ * entries (emit_case); the value on the stack selects one, others the last.
+ * emit_case returns the reference of the address.
+ */
+void emit_switch(vector_t* buffer, int low, int count);
+val_t* emit_case(vector_t* buffer, int address);
+
 /**
  * Free a list/vector of instructions.
  * Always use this.
  */
 void bytecode_buffer_free(vector_t* buffer);
 
+/**
+ * Load step:
+ * Converts a list of instructions into a packed bytecode_t.
+ * Constants are copied, so the buffer can be freed independently.
+ * Pushes of strings become pushk, equal strings share one constant.
+ * The result is verified (see bytecode_verify).
+ */
+bytecode_t* bytecode_load(vector_t* buffer);
+void bytecode_free(bytecode_t* bytecode);
+
+/**
+ * Code generated at runtime (see tier.h):
+ * bytecode_append packs the buffer behind the loaded code, which may move.
+ * Nothing is verified, returns false if an integer operand is not an integer.
+ * bytecode_truncate removes the code from size on again.
+ * code_unpack converts a packed instruction back (pushk stays pushk).
+ */
+bool bytecode_append(bytecode_t* bytecode, vector_t* buffer);
+void bytecode_truncate(bytecode_t* bytecode, size_t size);
+instruction_t* code_unpack(code_t* code);
+
+/**
+ * Computes the stack depth before every instruction (-1 if unreachable)
+ * and the entry of the function it belongs to (0 for the toplevel code).
+ * The toplevel code and every invoked function start with an empty frame,
+ * frame[entry] is set to the maximum depth of the function.
+ * A handler (catch a) starts with the depth of a, once a is reached.
+ * Returns false, if an instruction is reached with different depths.
+ */
+bool bytecode_depths(bytecode_t* bytecode, int* depth, int* func, int* frame);
+
+/**
+ * verifier_t - results of the verifier, kept to verify code appended later
+ *
+ * @depth Stack depth of every instruction (see bytecode_depths)
+ * @func Entry of the function of every instruction
+ * @args Argument count of every function, by entry
+ * @results Whether a function returns nothing, by entry (-1 if it never returns)
+ * @method Whether a function accesses its receiver, by entry
+ * @lo Lowest slot of the frames of every display level
+ * @hi Frame size of every display level
+ */
+typedef struct verifier_t {
+    int* depth;
+    int* func;
+    int* args;
+    int* results;
+    bool* method;
+    int lo[DISPLAY_SIZE];
+    int hi[DISPLAY_SIZE];
+} verifier_t;
+
+verifier_t* verifier_new(size_t size);
+void verifier_free(verifier_t* verifier);
+
+/**
+ * Verifier, runs once in the load step.
+ * Checks the stack depths (see above), opcodes, jump and call targets,
+ * argument counts, results of calls, local and global slots, syscalls, display levels and constants,
+ * so the VMs execute the code without validating the instructions.
+ * Only array and string indices are checked at runtime.
+ * frame is set like by bytecode_depths.
+ * Returns NULL for valid code, otherwise the reason.
+ */
+const char* bytecode_verify(bytecode_t* bytecode, verifier_t* verifier, int* frame);
+
+/**
+ * Verifies the code appended at base (see bytecode_append) as one function,
+ * the code before has been verified with the verifier.
+ * calls are the count instructions before base, that were redirected to it.
+ * Only the new code and the calls are checked, with the same rules as above.
+ * frame has to hold the new code, the verifier grows with it.
+ */
+const char* bytecode_verify_append(bytecode_t* bytecode, verifier_t* verifier, int* frame, int base, int* calls, int count);
+
 #endif
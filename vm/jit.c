@@ -0,0 +1,854 @@
+// Copyright (C) 2017 Alexander Koch
+#define _DEFAULT_SOURCE
+#include "jit.h"
+
+#if defined(JIT) && defined(__x86_64__) && defined(__linux__)
+
+#include <stddef.h>
+#include <setjmp.h>
+#include <sys/mman.h>
+
+// Register usage of the native code:
+// rbx = vm->stack, r12 = &stack[fp], r13 = fp, r14 = call frames left, r15 = vm.
+// rax, rcx, rdx, rsi, rdi, xmm0 and xmm1 are scratch registers.
+enum {
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15
+};
+
+// Condition codes
+enum {
+    CC_B = 0x2, CC_AE, CC_E, CC_NE, CC_BE, CC_A,
+    CC_P = 0xa, CC_NP, CC_L, CC_GE, CC_LE, CC_G
+};
+
+// Opcodes, two byte opcodes start with 0x0F
+#define X_ADD 0x03
+#define X_SUB 0x2B
+#define X_AND 0x23
+#define X_OR 0x0B
+#define X_XOR 0x33
+#define X_CMP 0x3B
+#define X_IMUL 0x0FAF
+#define X_LOAD 0x8B
+#define X_STORE 0x89
+#define X_LEA 0x8D
+#define X_MOVSD_LOAD 0x0F10
+#define X_MOVSD_STORE 0x0F11
+#define X_ADDSD 0x0F58
+#define X_MULSD 0x0F59
+#define X_SUBSD 0x0F5C
+#define X_DIVSD 0x0F5E
+#define X_UCOMISD 0x0F2E
+#define X_CVTTSD2SI 0x0F2C
+
+typedef val_t (*jit_trampoline_t)(vm_t* vm, void* code, int64_t fp, int64_t frames);
+
+struct jit_t {
+    bytecode_t* bytecode;
+    opcode_t* ops;
+    int* depth;
+    int* func;
+    bool* compilable;
+    int* counter;
+
+    // Native code of every function, by entry
+    void** entry;
+
+    // Native offset of every instruction and the jumps to patch,
+    // while a function is compiled
+    int* label;
+    int* patches;
+    int patchCount;
+
+    uint8_t* mem;
+    size_t used;
+    bool full;
+    jit_trampoline_t trampoline;
+
+    // Exceptions return to jit_call
+    jmp_buf env;
+};
+
+// Emitter
+
+static void emit8(jit_t* jit, int b) {
+    if(jit->used < JIT_CODE_SIZE) {
+        jit->mem[jit->used] = (uint8_t)b;
+    }
+    jit->used++;
+}
+
+static void emit32(jit_t* jit, int32_t v) {
+    uint32_t u = (uint32_t)v;
+    for(int i = 0; i < 4; i++) {
+        emit8(jit, (u >> (i * 8)) & 0xff);
+    }
+}
+
+static void emit64(jit_t* jit, uint64_t v) {
+    for(int i = 0; i < 8; i++) {
+        emit8(jit, (v >> (i * 8)) & 0xff);
+    }
+}
+
+static void emit_x86_op(jit_t* jit, int prefix, bool wide, int op, int reg, int rm) {
+    if(prefix) emit8(jit, prefix);
+    int rex = (wide ? 8 : 0) | ((reg >> 3) << 2) | (rm >> 3);
+    if(rex) emit8(jit, 0x40 | rex);
+    if(op > 0xff) emit8(jit, op >> 8);
+    emit8(jit, op & 0xff);
+}
+
+// op reg, [base+disp]
+static void emit_mem(jit_t* jit, int prefix, bool wide, int op, int reg, int base, int32_t disp) {
+    emit_x86_op(jit, prefix, wide, op, reg, base);
+    emit8(jit, 0x80 | (reg & 7) << 3 | (base & 7));
+    if((base & 7) == RSP) emit8(jit, 0x24);
+    emit32(jit, disp);
+}
+
+// op reg, rm
+static void emit_reg(jit_t* jit, int prefix, bool wide, int op, int reg, int rm) {
+    emit_x86_op(jit, prefix, wide, op, reg, rm);
+    emit8(jit, 0xC0 | (reg & 7) << 3 | (rm & 7));
+}
+
+static void emit_imm64(jit_t* jit, int reg, uint64_t v) {
+    emit8(jit, 0x48 | (reg >> 3));
+    emit8(jit, 0xB8 + (reg & 7));
+    emit64(jit, v);
+}
+
+static void emit_call(jit_t* jit, void* fn) {
+    emit_imm64(jit, RAX, (uint64_t)(uintptr_t)fn);
+    emit8(jit, 0xFF);
+    emit8(jit, 0xD0);
+}
+
+static void emit_setcc(jit_t* jit, int cc, int reg) {
+    emit8(jit, 0x0F);
+    emit8(jit, 0x90 | cc);
+    emit8(jit, 0xC0 | reg);
+}
+
+// Forward jump over a few bytes, see patch8
+static int emit_jcc8(jit_t* jit, int cc) {
+    emit8(jit, cc < 0 ? 0xEB : 0x70 | cc);
+    emit8(jit, 0);
+    return jit->used;
+}
+
+static void patch8(jit_t* jit, int pos) {
+    int rel = jit->used - pos;
+    assert(rel < 128);
+    if(pos <= JIT_CODE_SIZE) jit->mem[pos-1] = (uint8_t)rel;
+}
+
+// Jump to an instruction, patched after the function is emitted
+static void emit_jump(jit_t* jit, int cc, int target) {
+    if(cc < 0) {
+        emit8(jit, 0xE9);
+    } else {
+        emit8(jit, 0x0F);
+        emit8(jit, 0x80 | cc);
+    }
+    jit->patches[jit->patchCount++] = jit->used;
+    jit->patches[jit->patchCount++] = target;
+    emit32(jit, 0);
+}
+
+// Boxes the flag in al as a boolean into [r12+disp]
+static void emit_box_bool(jit_t* jit, int32_t disp) {
+    emit_reg(jit, 0, false, 0x0FB6, RAX, RAX);
+    emit_imm64(jit, RCX, FALSE_VAL);
+    emit_reg(jit, 0, true, 0x09, RCX, RAX);
+    emit_mem(jit, 0, true, X_STORE, RAX, R12, disp);
+}
+
+// Compares [r12+disp] to true
+static void emit_test_bool(jit_t* jit, int32_t disp) {
+    emit_mem(jit, 0, true, X_LOAD, RAX, R12, disp);
+    emit_imm64(jit, RCX, TRUE_VAL);
+    emit_reg(jit, 0, true, 0x39, RCX, RAX);
+}
+
+// Writes sp, fp and pc back to the VM before a helper call.
+// The value stack below the depth is valid.
+static void emit_sync(jit_t* jit, int depth, int pc) {
+    emit_mem(jit, 0, false, X_LEA, RAX, R13, depth);
+    emit_mem(jit, 0, false, X_STORE, RAX, R15, offsetof(vm_t, sp));
+    emit_mem(jit, 0, false, X_STORE, R13, R15, offsetof(vm_t, fp));
+    emit_mem(jit, 0, false, 0xC7, 0, R15, offsetof(vm_t, pc));
+    emit32(jit, pc);
+}
+
+// Reloads the stack, which may have moved during a helper call
+static void emit_reload(jit_t* jit) {
+    emit_mem(jit, 0, true, X_LOAD, RBX, R15, offsetof(vm_t, stack));
+    // lea r12, [rbx+r13*8]
+    emit8(jit, 0x4E);
+    emit8(jit, 0x8D);
+    emit8(jit, 0x24);
+    emit8(jit, 0xEB);
+}
+
+// Helpers
+
+// Exceptions are caught at the call of the native code (see invoke in vm_exec)
+static void jit_overflow(vm_t* vm) {
+    vm_raise(vm, "Stack overflow");
+    longjmp(vm->jit->env, 1);
+}
+
+static void jit_divzero(vm_t* vm) {
+    vm_raise(vm, "Division by zero");
+    longjmp(vm->jit->env, 1);
+}
+
+static void jit_grow(vm_t* vm, int size) {
+    if(!vm_grow_stack(vm, size)) {
+        jit_overflow(vm);
+    }
+}
+
+static void jit_syscall(vm_t* vm, int index) {
+    vm_syscall(vm, index);
+    if(vm->pc == vm->errjmp) {
+        longjmp(vm->jit->env, 1);
+    }
+}
+
+// Pushes the value at [base+disp], objects are copied (see COPY in vm.c)
+static void emit_copy(jit_t* jit, int base, int32_t disp, int depth, int pc) {
+    emit_mem(jit, 0, true, X_LOAD, RSI, base, disp);
+    emit_reg(jit, 0, true, X_STORE, RSI, RAX);
+    emit_imm64(jit, RCX, QNAN | SIGN_BIT);
+    emit_reg(jit, 0, true, 0x21, RCX, RAX);
+    emit_reg(jit, 0, true, 0x39, RCX, RAX);
+    int obj = emit_jcc8(jit, CC_E);
+    emit_mem(jit, 0, true, X_STORE, RSI, R12, depth * 8);
+    int done = emit_jcc8(jit, -1);
+    patch8(jit, obj);
+    emit_sync(jit, depth, pc);
+    emit_reg(jit, 0, true, X_STORE, R15, RDI);
+    emit_call(jit, vm_copy);
+    emit_reload(jit);
+    patch8(jit, done);
+}
+
+// Condition of the integer compare
+static int int_cc(opcode_t op) {
+    switch(op) {
+        case OP_IEQ: case OP_JIEQ: case OP_JIEQK: case OP_JIEQLK: return CC_E;
+        case OP_INE: case OP_JINE: case OP_JINEK: case OP_JINELK: return CC_NE;
+        case OP_ILT: case OP_JILT: case OP_JILTK: case OP_JILTLK: return CC_L;
+        case OP_IGT: case OP_JIGT: case OP_JIGTK: case OP_JIGTLK: return CC_G;
+        case OP_ILE: case OP_JILE: case OP_JILEK: case OP_JILELK: return CC_LE;
+        default: return CC_GE;
+    }
+}
+
+// Float compare of a and b (slots at disp).
+// Returns the condition, NaN compares as unordered (CF = ZF = PF = 1):
+// lt and le compare b to a, so only eq and ne need the parity flag.
+static int emit_fcmp(jit_t* jit, opcode_t op, int32_t a, int32_t b) {
+    bool swap = op == OP_FLT || op == OP_FLE || op == OP_JFLT || op == OP_JFLE;
+    emit_mem(jit, 0xF2, false, X_MOVSD_LOAD, 0, R12, swap ? b : a);
+    emit_mem(jit, 0x66, false, X_UCOMISD, 0, R12, swap ? a : b);
+    switch(op) {
+        case OP_FLT: case OP_JFLT:
+        case OP_FGT: case OP_JFGT: return CC_A;
+        case OP_FLE: case OP_JFLE:
+        case OP_FGE: case OP_JFGE: return CC_AE;
+        case OP_FEQ: case OP_JFEQ: return CC_E;
+        default: return CC_NE;
+    }
+}
+
+// Instructions with a template
+static bool jit_supported(opcode_t op) {
+    switch(op) {
+        case OP_PUSH: case OP_PUSHK: case OP_POP: case OP_STORE: case OP_LOAD:
+        case OP_GSTORE: case OP_GLOAD: case OP_RESERVE:
+        case OP_SYSCALL: case OP_INVOKE: case OP_RET: case OP_RETVOID:
+        case OP_JMP: case OP_JMPF:
+        case OP_NOT: case OP_B2I: case OP_BAND: case OP_BOR:
+        case OP_BEQ: case OP_BNE:
+        case OP_IADDLK: case OP_ISUBLK: case OP_ILTLK:
+        case OP_LOAD2: case OP_STOREJMP:
+        case OP_INCL: case OP_GINC: case OP_ADDL: case OP_FORL:
+        case OP_SWITCH: case OP_CASE: return true;
+        default:
+            return (op >= OP_IADD && op <= OP_F2I)
+                || (op >= OP_IEQ && op <= OP_FGE)
+                || (op >= OP_JIEQ && op <= OP_JIGEK)
+                || (op >= OP_JIEQLK && op <= OP_JIGELK);
+    }
+}
+
+static void jit_instr(jit_t* jit, int pc) {
+    opcode_t op = jit->ops[pc];
+    code_t* instr = &jit->bytecode->code[pc];
+    int d = jit->depth[pc];
+
+    // Slots relative to the stack pointer
+    #define TOP(k) ((d + (k)) * 8)
+    #define SLOT(k) ((k) * 8)
+
+    switch(op) {
+        case OP_PUSH:
+        case OP_PUSHK: {
+            // Strings are permanent constants (pushk), nothing is copied
+            val_t v = op == OP_PUSHK ? jit->bytecode->constants[instr->a] : instr->v;
+            emit_imm64(jit, RAX, v);
+            emit_mem(jit, 0, true, X_STORE, RAX, R12, TOP(0));
+            break;
+        }
+        case OP_POP:
+        case OP_RESERVE: break;
+        case OP_STORE:
+        case OP_GSTORE: {
+            emit_mem(jit, 0, true, X_LOAD, RAX, R12, TOP(-1));
+            if(op == OP_STORE) {
+                emit_mem(jit, 0, true, X_STORE, RAX, R12, SLOT(instr->a));
+            } else {
+                emit_mem(jit, 0, true, X_STORE, RAX, RBX, SLOT(instr->a));
+            }
+            break;
+        }
+        case OP_LOAD: emit_copy(jit, R12, SLOT(instr->a), d, pc+1); break;
+        case OP_GLOAD: emit_copy(jit, RBX, SLOT(instr->a), d, pc+1); break;
+        case OP_LOAD2: {
+            emit_copy(jit, R12, SLOT(instr->a), d, pc+1);
+            emit_copy(jit, R12, SLOT(instr->b), d+1, pc+1);
+            break;
+        }
+        case OP_IADD:
+        case OP_ISUB:
+        case OP_IMUL:
+        case OP_BITAND:
+        case OP_BITOR:
+        case OP_BITXOR: {
+            int x = op == OP_IADD ? X_ADD : op == OP_ISUB ? X_SUB : op == OP_IMUL ? X_IMUL
+                : op == OP_BITAND ? X_AND : op == OP_BITOR ? X_OR : X_XOR;
+            emit_mem(jit, 0, false, X_LOAD, RAX, R12, TOP(-2));
+            emit_mem(jit, 0, false, x, RAX, R12, TOP(-1));
+            emit_mem(jit, 0, true, X_STORE, RAX, R12, TOP(-2));
+            break;
+        }
+        case OP_IDIV:
+        case OP_MOD: {
+            // cmp dword [b], 0
+            emit_mem(jit, 0, false, 0x83, 7, R12, TOP(-1));
+            emit8(jit, 0);
+            int nonzero = emit_jcc8(jit, CC_NE);
+            emit_sync(jit, d, pc+1);
+            emit_reg(jit, 0, true, X_STORE, R15, RDI);
+            emit_call(jit, jit_divzero);
+            patch8(jit, nonzero);
+
+            // cdq; idiv dword [b]
+            emit_mem(jit, 0, false, X_LOAD, RAX, R12, TOP(-2));
+            emit8(jit, 0x99);
+            emit_mem(jit, 0, false, 0xF7, 7, R12, TOP(-1));
+            emit_mem(jit, 0, true, X_STORE, op == OP_IDIV ? RAX : RDX, R12, TOP(-2));
+            break;
+        }
+        case OP_BITL:
+        case OP_BITR: {
+            // shl / sar eax, cl
+            emit_mem(jit, 0, false, X_LOAD, RAX, R12, TOP(-2));
+            emit_mem(jit, 0, false, X_LOAD, RCX, R12, TOP(-1));
+            emit_reg(jit, 0, false, 0xD3, op == OP_BITL ? 4 : 7, RAX);
+            emit_mem(jit, 0, true, X_STORE, RAX, R12, TOP(-2));
+            break;
+        }
+        case OP_BITNOT:
+        case OP_IMINUS: {
+            // not / neg eax
+            emit_mem(jit, 0, false, X_LOAD, RAX, R12, TOP(-1));
+            emit_reg(jit, 0, false, 0xF7, op == OP_BITNOT ? 2 : 3, RAX);
+            emit_mem(jit, 0, true, X_STORE, RAX, R12, TOP(-1));
+            break;
+        }
+        case OP_I2F: {
+            // cvtsi2sd xmm0, eax
+            emit_mem(jit, 0, false, X_LOAD, RAX, R12, TOP(-1));
+            emit_reg(jit, 0xF2, false, 0x0F2A, 0, RAX);
+            emit_mem(jit, 0xF2, false, X_MOVSD_STORE, 0, R12, TOP(-1));
+            break;
+        }
+        case OP_FADD:
+        case OP_FSUB:
+        case OP_FMUL:
+        case OP_FDIV: {
+            int x = op == OP_FADD ? X_ADDSD : op == OP_FSUB ? X_SUBSD : op == OP_FMUL ? X_MULSD : X_DIVSD;
+            emit_mem(jit, 0xF2, false, X_MOVSD_LOAD, 0, R12, TOP(-2));
+            emit_mem(jit, 0xF2, false, x, 0, R12, TOP(-1));
+            emit_mem(jit, 0xF2, false, X_MOVSD_STORE, 0, R12, TOP(-2));
+            break;
+        }
+        case OP_FMINUS: {
+            // btc rax, 63
+            emit_mem(jit, 0, true, X_LOAD, RAX, R12, TOP(-1));
+            emit_reg(jit, 0, true, 0x0FBA, 7, RAX);
+            emit8(jit, 63);
+            emit_mem(jit, 0, true, X_STORE, RAX, R12, TOP(-1));
+            break;
+        }
+        case OP_F2I: {
+            emit_mem(jit, 0xF2, false, X_CVTTSD2SI, RAX, R12, TOP(-1));
+            emit_mem(jit, 0, true, X_STORE, RAX, R12, TOP(-1));
+            break;
+        }
+        case OP_NOT: {
+            emit_test_bool(jit, TOP(-1));
+            emit_setcc(jit, CC_NE, RAX);
+            emit_box_bool(jit, TOP(-1));
+            break;
+        }
+        case OP_B2I: {
+            emit_test_bool(jit, TOP(-1));
+            emit_setcc(jit, CC_E, RAX);
+            emit_reg(jit, 0, false, 0x0FB6, RAX, RAX);
+            emit_mem(jit, 0, true, X_STORE, RAX, R12, TOP(-1));
+            break;
+        }
+        case OP_BEQ:
+        case OP_BNE:
+        case OP_BAND:
+        case OP_BOR: {
+            emit_test_bool(jit, TOP(-2));
+            emit_setcc(jit, CC_E, RDX);
+            emit_test_bool(jit, TOP(-1));
+            emit_setcc(jit, CC_E, RAX);
+            if(op == OP_BEQ || op == OP_BNE) {
+                // cmp dl, al
+                emit_reg(jit, 0, false, 0x38, RAX, RDX);
+                emit_setcc(jit, op == OP_BEQ ? CC_E : CC_NE, RAX);
+            } else {
+                // and / or al, dl
+                emit_reg(jit, 0, false, op == OP_BAND ? 0x20 : 0x08, RDX, RAX);
+            }
+            emit_box_bool(jit, TOP(-2));
+            break;
+        }
+        case OP_IEQ:
+        case OP_INE:
+        case OP_ILT:
+        case OP_IGT:
+        case OP_ILE:
+        case OP_IGE: {
+            emit_mem(jit, 0, false, X_LOAD, RAX, R12, TOP(-2));
+            emit_mem(jit, 0, false, X_CMP, RAX, R12, TOP(-1));
+            emit_setcc(jit, int_cc(op), RAX);
+            emit_box_bool(jit, TOP(-2));
+            break;
+        }
+        case OP_FEQ:
+        case OP_FNE:
+        case OP_FLT:
+        case OP_FGT:
+        case OP_FLE:
+        case OP_FGE: {
+            int cc = emit_fcmp(jit, op, TOP(-2), TOP(-1));
+            emit_setcc(jit, cc, RAX);
+            if(op == OP_FEQ) {
+                // and al, cl
+                emit_setcc(jit, CC_NP, RCX);
+                emit_reg(jit, 0, false, 0x20, RCX, RAX);
+            } else if(op == OP_FNE) {
+                // or al, cl
+                emit_setcc(jit, CC_P, RCX);
+                emit_reg(jit, 0, false, 0x08, RCX, RAX);
+            }
+            emit_box_bool(jit, TOP(-2));
+            break;
+        }
+        case OP_IADDLK:
+        case OP_ISUBLK:
+        case OP_ILTLK: {
+            // add / sub / cmp eax, imm32
+            emit_mem(jit, 0, false, X_LOAD, RAX, R12, SLOT(instr->a));
+            emit8(jit, op == OP_IADDLK ? 0x05 : op == OP_ISUBLK ? 0x2D : 0x3D);
+            emit32(jit, instr->b);
+            if(op == OP_ILTLK) {
+                emit_setcc(jit, CC_L, RAX);
+                emit_box_bool(jit, TOP(0));
+            } else {
+                emit_mem(jit, 0, true, X_STORE, RAX, R12, TOP(0));
+            }
+            break;
+        }
+        case OP_INCL:
+        case OP_GINC:
+        case OP_ADDL: {
+            int base = op == OP_GINC ? RBX : R12;
+            emit_mem(jit, 0, false, X_LOAD, RAX, base, SLOT(instr->a));
+            if(op == OP_ADDL) {
+                emit_mem(jit, 0, false, X_ADD, RAX, R12, SLOT(instr->b));
+            } else {
+                emit8(jit, 0x05);
+                emit32(jit, instr->b);
+            }
+            emit_mem(jit, 0, true, X_STORE, RAX, base, SLOT(instr->a));
+            break;
+        }
+        case OP_FORL: {
+            // add eax, 1; store it; cmp eax, [limit]; jl body
+            emit_mem(jit, 0, false, X_LOAD, RAX, R12, SLOT(instr->b));
+            emit8(jit, 0x05);
+            emit32(jit, 1);
+            emit_mem(jit, 0, false, X_STORE, RAX, R12, SLOT(instr->b));
+            emit_mem(jit, 0, false, X_CMP, RAX, R12, SLOT(instr->b + 1));
+            emit_jump(jit, CC_L, instr->a);
+            break;
+        }
+        case OP_SWITCH: {
+            // sub eax, low; cmp eax, count; jae default
+            code_t* table = instr + 1;
+            emit_mem(jit, 0, false, X_LOAD, RAX, R12, TOP(-1));
+            emit8(jit, 0x2D);
+            emit32(jit, instr->a);
+            emit8(jit, 0x3D);
+            emit32(jit, instr->b);
+            emit_jump(jit, CC_AE, table[instr->b].a);
+
+            // Entries are offsets relative to their end (see jit_function):
+            // lea rcx, [rip+14]; lea rcx, [rcx+rax*4]; movsxd rax, [rcx];
+            // lea rax, [rcx+rax+4]; jmp rax
+            static const uint8_t dispatch[] = {
+                0x48, 0x8D, 0x0D, 0x0E, 0x00, 0x00, 0x00,
+                0x48, 0x8D, 0x0C, 0x81,
+                0x48, 0x63, 0x01,
+                0x48, 0x8D, 0x44, 0x01, 0x04,
+                0xFF, 0xE0
+            };
+            for(size_t i = 0; i < sizeof(dispatch); i++) emit8(jit, dispatch[i]);
+            for(int i = 0; i < instr->b; i++) {
+                jit->patches[jit->patchCount++] = jit->used;
+                jit->patches[jit->patchCount++] = table[i].a;
+                emit32(jit, 0);
+            }
+            break;
+        }
+        case OP_CASE: break; // Read by the switch
+        case OP_JMP: emit_jump(jit, -1, instr->a); break;
+        case OP_JMPF: {
+            emit_test_bool(jit, TOP(-1));
+            emit_jump(jit, CC_NE, instr->a);
+            break;
+        }
+        case OP_STOREJMP: {
+            emit_mem(jit, 0, true, X_LOAD, RAX, R12, TOP(-1));
+            emit_mem(jit, 0, true, X_STORE, RAX, R12, SLOT(instr->b));
+            emit_jump(jit, -1, instr->a);
+            break;
+        }
+        case OP_JIEQ:
+        case OP_JINE:
+        case OP_JILT:
+        case OP_JIGT:
+        case OP_JILE:
+        case OP_JIGE: {
+            emit_mem(jit, 0, false, X_LOAD, RAX, R12, TOP(-2));
+            emit_mem(jit, 0, false, X_CMP, RAX, R12, TOP(-1));
+            emit_jump(jit, int_cc(op) ^ 1, instr->a);
+            break;
+        }
+        case OP_JIEQK:
+        case OP_JINEK:
+        case OP_JILTK:
+        case OP_JIGTK:
+        case OP_JILEK:
+        case OP_JIGEK:
+        case OP_JIEQLK:
+        case OP_JINELK:
+        case OP_JILTLK:
+        case OP_JIGTLK:
+        case OP_JILELK:
+        case OP_JIGELK: {
+            // cmp dword [slot], imm32
+            bool local = op >= OP_JIEQLK;
+            emit_mem(jit, 0, false, 0x81, 7, R12, local ? SLOT(SLOT_OF(instr->b)) : TOP(-1));
+            emit32(jit, local ? IMM_OF(instr->b) : instr->b);
+            emit_jump(jit, int_cc(op) ^ 1, instr->a);
+            break;
+        }
+        case OP_JFEQ:
+        case OP_JFNE:
+        case OP_JFLT:
+        case OP_JFGT:
+        case OP_JFLE:
+        case OP_JFGE: {
+            int cc = emit_fcmp(jit, op, TOP(-2), TOP(-1));
+            if(op == OP_JFEQ) {
+                emit_jump(jit, CC_NE, instr->a);
+                emit_jump(jit, CC_P, instr->a);
+            } else if(op == OP_JFNE) {
+                int skip = emit_jcc8(jit, CC_P);
+                emit_jump(jit, CC_E, instr->a);
+                patch8(jit, skip);
+            } else {
+                emit_jump(jit, cc ^ 1, instr->a);
+            }
+            break;
+        }
+        case OP_SYSCALL: {
+            emit_sync(jit, d, pc+1);
+            emit_reg(jit, 0, true, X_STORE, R15, RDI);
+            emit8(jit, 0xBE);
+            emit32(jit, instr->a);
+            emit_call(jit, jit_syscall);
+            emit_reload(jit);
+            break;
+        }
+        case OP_INVOKE: {
+            int address = instr->a;
+            int args = CALL_ARGS(instr->b);
+
+            // Same checks as the interpreter: stack space, then call frames
+            emit_mem(jit, 0, false, X_LEA, RAX, R13, d + jit->bytecode->frame[address]);
+            emit_mem(jit, 0, false, X_CMP, RAX, R15, offsetof(vm_t, stackSize));
+            int fits = emit_jcc8(jit, CC_LE);
+            emit_sync(jit, d, pc+1);
+            emit_reg(jit, 0, true, X_STORE, R15, RDI);
+            emit_mem(jit, 0, false, X_LEA, RSI, R13, d + jit->bytecode->frame[address]);
+            emit_call(jit, jit_grow);
+            emit_reload(jit);
+            patch8(jit, fits);
+
+            // sub r14, 1
+            emit_reg(jit, 0, true, 0x83, 5, R14);
+            emit8(jit, 1);
+            int left = emit_jcc8(jit, CC_AE);
+            emit_sync(jit, d, pc+1);
+            emit_reg(jit, 0, true, X_STORE, R15, RDI);
+            emit_call(jit, jit_overflow);
+            patch8(jit, left);
+
+            // add r13, d; call [entry]; sub r13, d
+            emit_reg(jit, 0, true, 0x81, 0, R13);
+            emit32(jit, d);
+            emit_reload(jit);
+            emit_imm64(jit, RAX, (uint64_t)(uintptr_t)&jit->entry[address]);
+            emit8(jit, 0xFF);
+            emit8(jit, 0x10);
+            emit_reg(jit, 0, true, 0x81, 5, R13);
+            emit32(jit, d);
+            emit_reload(jit);
+
+            // add r14, 1
+            emit_reg(jit, 0, true, 0x83, 0, R14);
+            emit8(jit, 1);
+            if(!(instr->b & CALL_VOID)) {
+                emit_mem(jit, 0, true, X_STORE, RAX, R12, TOP(-args));
+            }
+            break;
+        }
+        case OP_RET: {
+            // add rsp, 8; ret
+            emit_mem(jit, 0, true, X_LOAD, RAX, R12, TOP(-1));
+            emit_reg(jit, 0, true, 0x83, 0, RSP);
+            emit8(jit, 8);
+            emit8(jit, 0xC3);
+            break;
+        }
+        case OP_RETVOID: {
+            // Nothing is returned, rax is ignored by the caller
+            emit_reg(jit, 0, true, 0x83, 0, RSP);
+            emit8(jit, 8);
+            emit8(jit, 0xC3);
+            break;
+        }
+        default: assert(0); break;
+    }
+
+    #undef TOP
+    #undef SLOT
+}
+
+// Compiles the function at entry and every function it invokes
+static void jit_function(jit_t* jit, int entry) {
+    if(jit->entry[entry]) return;
+    jit->entry[entry] = jit->mem + jit->used;
+    jit->patchCount = 0;
+
+    // Keeps the native stack aligned for helper calls: sub rsp, 8
+    emit_reg(jit, 0, true, 0x83, 5, RSP);
+    emit8(jit, 8);
+
+    int size = jit->bytecode->size;
+    for(int pc = entry; pc < size; pc++) {
+        if(jit->func[pc] != entry || jit->depth[pc] == -1) continue;
+        jit->label[pc] = jit->used;
+        jit_instr(jit, pc);
+    }
+
+    for(int i = 0; i < jit->patchCount; i += 2) {
+        int pos = jit->patches[i];
+        int32_t rel = jit->label[jit->patches[i+1]] - (pos + 4);
+        if(pos + 4 <= JIT_CODE_SIZE) memcpy(&jit->mem[pos], &rel, 4);
+    }
+
+    for(int pc = entry; pc < size; pc++) {
+        if(jit->func[pc] == entry && jit->depth[pc] != -1 && jit->ops[pc] == OP_INVOKE) {
+            jit_function(jit, jit->bytecode->code[pc].a);
+        }
+    }
+}
+
+static bool jit_compile(jit_t* jit, int address) {
+    size_t start = jit->used;
+    mprotect(jit->mem, JIT_CODE_SIZE, PROT_READ | PROT_WRITE);
+    jit_function(jit, address);
+
+    // Out of space, drop the functions of this run
+    if(jit->used > JIT_CODE_SIZE) {
+        for(size_t i = 0; i < jit->bytecode->size; i++) {
+            if((uint8_t*)jit->entry[i] >= jit->mem + start) {
+                jit->entry[i] = 0;
+            }
+        }
+        jit->used = start;
+        jit->full = true;
+    }
+    mprotect(jit->mem, JIT_CODE_SIZE, PROT_READ | PROT_EXEC);
+    return jit->entry[address] != 0;
+}
+
+// Entry from C: saves the callee saved registers,
+// sets up the registers of the native code and calls it
+static void jit_emit_trampoline(jit_t* jit) {
+    static const uint8_t prologue[] = {
+        0x53,                   // push rbx
+        0x55,                   // push rbp
+        0x41, 0x54,             // push r12
+        0x41, 0x55,             // push r13
+        0x41, 0x56,             // push r14
+        0x41, 0x57,             // push r15
+        0x48, 0x83, 0xEC, 0x08, // sub rsp, 8
+        0x49, 0x89, 0xFF,       // mov r15, rdi
+        0x49, 0x89, 0xD5,       // mov r13, rdx
+        0x49, 0x89, 0xCE        // mov r14, rcx
+    };
+    static const uint8_t epilogue[] = {
+        0xFF, 0xD6,             // call rsi
+        0x48, 0x83, 0xC4, 0x08, // add rsp, 8
+        0x41, 0x5F,             // pop r15
+        0x41, 0x5E,             // pop r14
+        0x41, 0x5D,             // pop r13
+        0x41, 0x5C,             // pop r12
+        0x5D,                   // pop rbp
+        0x5B,                   // pop rbx
+        0xC3                    // ret
+    };
+
+    jit->trampoline = (jit_trampoline_t)(jit->mem + jit->used);
+    for(size_t i = 0; i < sizeof(prologue); i++) emit8(jit, prologue[i]);
+    emit_reload(jit);
+    for(size_t i = 0; i < sizeof(epilogue); i++) emit8(jit, epilogue[i]);
+}
+
+jit_t* jit_new(bytecode_t* bytecode) {
+    void* mem = mmap(0, JIT_CODE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(mem == MAP_FAILED) return 0;
+
+    size_t size = bytecode->size;
+    jit_t* jit = malloc(sizeof(*jit));
+    memset(jit, 0, sizeof(*jit));
+    jit->bytecode = bytecode;
+    jit->mem = mem;
+    jit->ops = malloc(sizeof(opcode_t) * size);
+    jit->depth = malloc(sizeof(int) * (size + 1));
+    jit->func = malloc(sizeof(int) * (size + 1));
+    jit->compilable = malloc(sizeof(bool) * size);
+    jit->counter = malloc(sizeof(int) * size);
+    jit->entry = malloc(sizeof(void*) * size);
+    jit->label = malloc(sizeof(int) * size);
+    jit->patches = malloc(sizeof(int) * size * 4);
+    memset(jit->counter, 0, sizeof(int) * size);
+    memset(jit->entry, 0, sizeof(void*) * size);
+
+    int* frame = malloc(sizeof(int) * (size + 1));
+    bytecode_depths(bytecode, jit->depth, jit->func, frame);
+    free(frame);
+
+    // Functions, whose instructions all have a template
+    for(size_t i = 0; i < size; i++) {
+        jit->ops[i] = bytecode->code[i].op;
+        jit->compilable[i] = i > 0 && jit->func[i] == (int)i;
+    }
+    for(size_t i = 0; i < size; i++) {
+        if(jit->depth[i] != -1 && !jit_supported(jit->ops[i])) {
+            jit->compilable[jit->func[i]] = false;
+        }
+    }
+
+    // ... and whose callees can be compiled as well
+    bool changed = true;
+    while(changed) {
+        changed = false;
+        for(size_t i = 0; i < size; i++) {
+            int entry = jit->func[i];
+            if(jit->depth[i] != -1 && jit->ops[i] == OP_INVOKE
+                && jit->compilable[entry] && !jit->compilable[bytecode->code[i].a]) {
+                jit->compilable[entry] = false;
+                changed = true;
+            }
+        }
+    }
+
+    jit_emit_trampoline(jit);
+    mprotect(jit->mem, JIT_CODE_SIZE, PROT_READ | PROT_EXEC);
+    return jit;
+}
+
+void jit_free(jit_t* jit) {
+    if(!jit) return;
+    munmap(jit->mem, JIT_CODE_SIZE);
+    free(jit->ops);
+    free(jit->depth);
+    free(jit->func);
+    free(jit->compilable);
+    free(jit->counter);
+    free(jit->entry);
+    free(jit->label);
+    free(jit->patches);
+    free(jit);
+}
+
+bool jit_hot(jit_t* jit, int address) {
+    if(jit->entry[address]) return true;
+    if(jit->full || !jit->compilable[address]) return false;
+    if(++jit->counter[address] < JIT_THRESHOLD) return false;
+    return jit_compile(jit, address);
+}
+
+bool jit_call(jit_t* jit, vm_t* vm, int address, int fp, val_t* result) {
+    if(setjmp(jit->env)) return false;
+
+    // The callee gets the frame below the current one
+    int frames = vm->stackLimit - 2 - vm->depth;
+    *result = jit->trampoline(vm, jit->entry[address], fp, frames);
+    return true;
+}
+
+#else
+
+jit_t* jit_new(bytecode_t* bytecode) {
+    return 0;
+}
+
+void jit_free(jit_t* jit) {}
+
+bool jit_hot(jit_t* jit, int address) {
+    return false;
+}
+
+bool jit_call(jit_t* jit, vm_t* vm, int address, int fp, val_t* result) {
+    return false;
+}
+
+#endif
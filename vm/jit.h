@@ -0,0 +1,53 @@
+/**
+ * jit.h
+ * Copyright (C) 2017 Alexander Koch
+ * Baseline template JIT for x86-64 Linux hosts
+ *
+ * Functions that are invoked often are translated to native code,
+ * by stitching together a machine code template for every instruction.
+ * The value stack and the calling convention stay the same, so the
+ * interpreter and the native code share the stack and the GC.
+ * The stack depth of every instruction is known (see bytecode_depths),
+ * so stack slots are addressed relative to the frame pointer
+ * and the stack pointer only needs to be written back for helper calls.
+ *
+ * A function is compiled if all of its instructions have a template
+ * and all functions it invokes can be compiled as well, so native code
+ * never returns to the interpreter in the middle of a frame.
+ * Syscalls, object copies (GC) and exceptions call the C helpers of the VM.
+ *
+ * Build with -DJIT. On other hosts jit_new returns NULL,
+ * so everything runs on the interpreter.
+ */
+
+#ifndef jit_h
+#define jit_h
+
+#include "../vm/vm.h"
+
+// Number of calls after which a function is compiled
+#ifndef JIT_THRESHOLD
+#define JIT_THRESHOLD 64
+#endif
+
+// Size of the executable buffer, no more code is compiled once it is full
+#define JIT_CODE_SIZE (1 << 20)
+
+typedef struct jit_t jit_t;
+
+// The opcodes are read on creation, before the code is threaded
+jit_t* jit_new(bytecode_t* bytecode);
+void jit_free(jit_t* jit);
+
+// Counts a call of the function at address,
+// returns true if it has native code
+bool jit_hot(jit_t* jit, int address);
+
+// Runs the native code of the function at address.
+// The arguments are on top of the stack, fp is the frame pointer of the callee.
+// The result of a void function (see CALL_VOID) is undefined.
+// Returns false if an exception was thrown. It is either left in vm->exception
+// for the handlers of the caller (see vm_unwind), or the VM was reset by vm_throw.
+bool jit_call(jit_t* jit, vm_t* vm, int address, int fp, val_t* result);
+
+#endif
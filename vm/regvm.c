@@ -0,0 +1,1085 @@
+// Copyright (C) 2017 Alexander Koch
+#include "regvm.h"
+
+const char* regop2str(regop_t op) {
+    switch(op) {
+        case R_HLT: return "hlt";
+        case R_MOV: return "mov";
+        case R_COPY: return "copy";
+        case R_LOADK: return "loadk";
+        case R_GLOAD: return "gload";
+        case R_GSTORE: return "gstore";
+        case R_UPVAL: return "upval";
+        case R_UPSTORE: return "upstore";
+        case R_LDARG0: return "ldarg0";
+        case R_SETARG0: return "setarg0";
+        case R_IADD: return "iadd";
+        case R_ISUB: return "isub";
+        case R_IMUL: return "imul";
+        case R_IDIV: return "idiv";
+        case R_MOD: return "mod";
+        case R_BITL: return "bitl";
+        case R_BITR: return "bitr";
+        case R_BITAND: return "bitand";
+        case R_BITOR: return "bitor";
+        case R_BITXOR: return "bitxor";
+        case R_IADDK: return "iaddk";
+        case R_ISUBK: return "isubk";
+        case R_BITNOT: return "bitnot";
+        case R_IMINUS: return "iminus";
+        case R_I2F: return "i2f";
+        case R_FADD: return "fadd";
+        case R_FSUB: return "fsub";
+        case R_FMUL: return "fmul";
+        case R_FDIV: return "fdiv";
+        case R_FMINUS: return "fminus";
+        case R_F2I: return "f2i";
+        case R_NOT: return "not";
+        case R_B2I: return "b2i";
+        case R_BEQ: return "beq";
+        case R_IEQ: return "ieq";
+        case R_FEQ: return "feq";
+        case R_BNE: return "bne";
+        case R_INE: return "ine";
+        case R_FNE: return "fne";
+        case R_ILT: return "ilt";
+        case R_IGT: return "igt";
+        case R_ILE: return "ile";
+        case R_IGE: return "ige";
+        case R_FLT: return "flt";
+        case R_FGT: return "fgt";
+        case R_FLE: return "fle";
+        case R_FGE: return "fge";
+        case R_BAND: return "band";
+        case R_BOR: return "bor";
+        case R_JMP: return "jmp";
+        case R_JMPF: return "jmpf";
+        case R_JIEQ: return "jieq";
+        case R_JINE: return "jine";
+        case R_JILT: return "jilt";
+        case R_JIGT: return "jigt";
+        case R_JILE: return "jile";
+        case R_JIGE: return "jige";
+        case R_JFEQ: return "jfeq";
+        case R_JFNE: return "jfne";
+        case R_JFLT: return "jflt";
+        case R_JFGT: return "jfgt";
+        case R_JFLE: return "jfle";
+        case R_JFGE: return "jfge";
+        case R_JIEQK: return "jieqk";
+        case R_JINEK: return "jinek";
+        case R_JILTK: return "jiltk";
+        case R_JIGTK: return "jigtk";
+        case R_JILEK: return "jilek";
+        case R_JIGEK: return "jigek";
+        case R_CALL: return "call";
+        case R_RET: return "ret";
+        case R_RETVIRTUAL: return "retvirtual";
+        case R_RETVOID: return "retvoid";
+        case R_SYSCALL: return "syscall";
+        case R_ARR: return "arr";
+        case R_STR: return "str";
+        case R_TOSTR: return "tostr";
+        case R_GETSUB: return "getsub";
+        case R_SETSUB: return "setsub";
+        case R_LEN: return "len";
+        case R_APPEND: return "append";
+        case R_CONS: return "cons";
+        case R_SGETSUB: return "sgetsub";
+        case R_SSETSUB: return "ssetsub";
+        case R_SLEN: return "slen";
+        case R_SAPPEND: return "sappend";
+        case R_SCONS: return "scons";
+        case R_CLASS: return "class";
+        case R_SETFIELD: return "setfield";
+        case R_GETFIELD: return "getfield";
+        case R_LDFIELD: return "ldfield";
+        case R_INCL: return "incl";
+        case R_GINC: return "ginc";
+        case R_ADDL: return "addl";
+        case R_FORL: return "forl";
+        case R_FORIN: return "forin";
+        case R_SWITCH: return "switch";
+        case R_CASE: return "case";
+        case R_TAILCALL: return "tailcall";
+        case R_ENTER: return "enter";
+        case R_GBORROW: return "gborrow";
+        case R_BORROW0: return "borrow0";
+        case R_STFIELD: return "stfield";
+        default: return "unknown";
+    }
+}
+
+// Slots are printed as rN, immediates as #k, addresses and counts as @x
+void reg_print(reg_t* instr) {
+    printf("%s", regop2str(instr->op));
+    switch(instr->op) {
+        case R_HLT:
+        case R_RETVOID: break;
+        case R_LOADK: printf(" r%d, ", instr->a); val_print(instr->v); break;
+        case R_GLOAD:
+        case R_GBORROW: printf(" r%d, @%d", instr->a, instr->x); break;
+        case R_BORROW0: printf(" r%d", instr->a); break;
+        case R_STFIELD: printf(" @%d, r%d", instr->x, instr->b); break;
+        case R_GSTORE: printf(" @%d, r%d", instr->x, instr->b); break;
+        case R_UPVAL: printf(" r%d, @%d, %d", instr->a, instr->x, instr->b); break;
+        case R_UPSTORE: printf(" @%d, %d, r%d", instr->x, instr->a, instr->b); break;
+        case R_LDARG0:
+        case R_CLASS:
+        case R_LDFIELD: printf(" r%d, @%d", instr->a, instr->x); break;
+        case R_SETARG0:
+        case R_RET:
+        case R_RETVIRTUAL: printf(" r%d", instr->b); break;
+        case R_IADDK:
+        case R_ISUBK: printf(" r%d, r%d, #%d", instr->a, instr->b, instr->k); break;
+        case R_JMP: printf(" @%d", instr->x); break;
+        case R_JMPF: printf(" r%d, @%d", instr->b, instr->x); break;
+        case R_CALL: printf(" r%d, %d, @%d", instr->a, instr->b, instr->x); break;
+        case R_TAILCALL: printf(" r%d, %d, %d, @%d", instr->a, TAIL_ARGS(instr->b), instr->b >> 8, instr->x); break;
+        case R_SYSCALL: printf(" r%d, %d, @%d", instr->a, instr->b, instr->x); break;
+        case R_ENTER: printf(" %d", instr->x); break;
+        case R_ARR:
+        case R_STR: printf(" r%d, @%d", instr->a, instr->x); break;
+        case R_SETFIELD:
+        case R_GETFIELD: printf(" r%d, r%d, @%d", instr->a, instr->b, instr->x); break;
+        case R_INCL: printf(" r%d, #%d", instr->a, instr->k); break;
+        case R_GINC: printf(" @%d, #%d", instr->x, instr->k); break;
+        case R_FORL:
+        case R_FORIN: printf(" r%d, @%d", instr->a, instr->x); break;
+        case R_SWITCH: printf(" r%d, #%d, %d", instr->b, instr->k, instr->x); break;
+        case R_CASE: printf(" @%d", instr->x); break;
+        case R_ADDL:
+        case R_MOV:
+        case R_COPY:
+        case R_TOSTR:
+        case R_LEN:
+        case R_SLEN:
+        case R_BITNOT:
+        case R_IMINUS:
+        case R_I2F:
+        case R_FMINUS:
+        case R_F2I:
+        case R_NOT:
+        case R_B2I: printf(" r%d, r%d", instr->a, instr->b); break;
+        default: {
+            if(instr->op >= R_JIEQ && instr->op <= R_JFGE) {
+                printf(" r%d, r%d, @%d", instr->b, instr->c, instr->x);
+            } else if(instr->op >= R_JIEQK && instr->op <= R_JIGEK) {
+                printf(" r%d, #%d, @%d", instr->b, instr->k, instr->x);
+            } else {
+                printf(" r%d, r%d, r%d", instr->a, instr->b, instr->c);
+            }
+            break;
+        }
+    }
+}
+
+// Constant objects belong to the bytecode
+void regcode_free(regcode_t* regcode) {
+    free(regcode->code);
+    free(regcode);
+}
+
+// Handler addresses of regvm_exec, exported for threading
+static void** handlers = 0;
+static size_t handler_count = 0;
+
+void regvm_exec(vm_t* vm, regcode_t* regcode) {
+    static void* dispatch_table[] = {
+        &&code_hlt,
+        &&code_mov,
+        &&code_copy,
+        &&code_loadk,
+        &&code_gload,
+        &&code_gstore,
+        &&code_upval,
+        &&code_upstore,
+        &&code_ldarg0,
+        &&code_setarg0,
+        &&code_iadd,
+        &&code_isub,
+        &&code_imul,
+        &&code_idiv,
+        &&code_mod,
+        &&code_bitl,
+        &&code_bitr,
+        &&code_bitand,
+        &&code_bitor,
+        &&code_bitxor,
+        &&code_iaddk,
+        &&code_isubk,
+        &&code_bitnot,
+        &&code_iminus,
+        &&code_i2f,
+        &&code_fadd,
+        &&code_fsub,
+        &&code_fmul,
+        &&code_fdiv,
+        &&code_fminus,
+        &&code_f2i,
+        &&code_not,
+        &&code_b2i,
+        &&code_beq,
+        &&code_ieq,
+        &&code_feq,
+        &&code_bne,
+        &&code_ine,
+        &&code_fne,
+        &&code_ilt,
+        &&code_igt,
+        &&code_ile,
+        &&code_ige,
+        &&code_flt,
+        &&code_fgt,
+        &&code_fle,
+        &&code_fge,
+        &&code_band,
+        &&code_bor,
+        &&code_jmp,
+        &&code_jmpf,
+        &&code_jieq,
+        &&code_jine,
+        &&code_jilt,
+        &&code_jigt,
+        &&code_jile,
+        &&code_jige,
+        &&code_jfeq,
+        &&code_jfne,
+        &&code_jflt,
+        &&code_jfgt,
+        &&code_jfle,
+        &&code_jfge,
+        &&code_jieqk,
+        &&code_jinek,
+        &&code_jiltk,
+        &&code_jigtk,
+        &&code_jilek,
+        &&code_jigek,
+        &&code_call,
+        &&code_ret,
+        &&code_retvirtual,
+        &&code_retvoid,
+        &&code_syscall,
+        &&code_arr,
+        &&code_str,
+        &&code_tostr,
+        &&code_getsub,
+        &&code_setsub,
+        &&code_len,
+        &&code_append,
+        &&code_cons,
+        &&code_sgetsub,
+        &&code_ssetsub,
+        &&code_slen,
+        &&code_sappend,
+        &&code_scons,
+        &&code_class,
+        &&code_setfield,
+        &&code_getfield,
+        &&code_ldfield,
+        &&code_incl,
+        &&code_ginc,
+        &&code_addl,
+        &&code_forl,
+        &&code_forin,
+        &&code_switch,
+        &&code_case,
+        &&code_tailcall,
+        &&code_enter,
+        &&code_gborrow,
+        &&code_borrow0,
+        &&code_stfield
+    };
+
+    // Export the handlers, if there is nothing to execute
+    if(!regcode) {
+        handlers = dispatch_table;
+        handler_count = sizeof(dispatch_table) / sizeof(dispatch_table[0]);
+        return;
+    }
+
+    // Set the jmp position if an error occurs
+    vm->errjmp = regcode->size-1;
+
+    reg_t* code = regcode->code;
+    reg_t* instr = 0;
+    int pc = vm->pc;
+    int fp = vm->fp;
+    frame_t* frame = &vm->frames[vm->depth];
+    val_t* stack = vm->stack;
+
+    if(fp + regcode->frame > vm->stackSize && !vm_grow_stack(vm, fp + regcode->frame)) {
+        vm_throw(vm, "Stack overflow");
+        return;
+    }
+    stack = vm->stack;
+
+    // Frame slot access
+    #define R(x) stack[fp+(x)]
+
+    // Everything below the live slots is visible to the GC and the syscalls
+    #define SAVE(live) vm->sp = fp + (live); vm->pc = pc; vm->fp = fp; vm->depth = frame - vm->frames
+
+    // Stack and frames may be moved when they grow (or by a syscall)
+    #define RELOAD() stack = vm->stack; frame = &vm->frames[vm->depth]
+
+    // Copy a value into a slot, register a copied object
+    #define COPY(slot, val) { \
+        val_t copied = (val); \
+        if(IS_OBJ(copied) && !IS_PERMANENT(copied)) { \
+            obj_t* newObj = COPY_OBJ(AS_OBJ(copied)); \
+            R(slot) = OBJ_VAL(newObj); \
+            SAVE(instr->live); \
+            obj_append(vm, newObj); \
+        } else { \
+            R(slot) = copied; \
+        } \
+    }
+    #define REGISTER(slot, obj) { \
+        R(slot) = OBJ_VAL(obj); \
+        SAVE(instr->live); \
+        obj_append(vm, obj); \
+    }
+
+    // Throws, if a subscript is out of bounds
+    #define BOUNDS(x) \
+        if(!(x)) { SAVE(instr->live); vm_throw(vm, "Index out of bounds"); return; }
+
+    // Throws, if a field index is not below the field count of the class
+    #define FIELD(cls, x) \
+        if((unsigned int)(x) >= (cls)->field_count) { SAVE(instr->live); vm_throw(vm, "Field out of range"); return; }
+
+    // Throws, if an integer is divided by zero
+    #define DIVISOR(x) \
+        if(!(x)) { SAVE(instr->live); vm_throw(vm, "Division by zero"); return; }
+
+    #define FETCH() instr = &code[pc++]
+#ifndef NO_THREADED
+    #define DISPATCH() \
+        FETCH(); \
+        goto *instr->handler
+#else
+    #define DISPATCH() \
+        FETCH(); \
+        goto *dispatch_table[instr->op]
+#endif
+
+    // Dispatch and run
+    DISPATCH();
+    code_hlt: {
+        vm->pc = pc;
+        vm->fp = fp;
+        vm->depth = frame - vm->frames;
+        return;
+    }
+    code_mov: {
+        R(instr->a) = R(instr->b);
+        DISPATCH();
+    }
+    code_copy: {
+        COPY(instr->a, R(instr->b));
+        DISPATCH();
+    }
+    code_loadk: {
+        COPY(instr->a, instr->v);
+        DISPATCH();
+    }
+    code_gload: {
+        COPY(instr->a, stack[instr->x]);
+        DISPATCH();
+    }
+    code_gstore: {
+        stack[instr->x] = R(instr->b);
+        DISPATCH();
+    }
+    code_upval: {
+        COPY(instr->a, stack[vm->display[instr->x] + instr->b]);
+        DISPATCH();
+    }
+    code_upstore: {
+        stack[vm->display[instr->x] + instr->a] = R(instr->b);
+        DISPATCH();
+    }
+    code_ldarg0: {
+        COPY(instr->a, stack[frame->receiver]);
+        DISPATCH();
+    }
+    code_setarg0: {
+        stack[frame->receiver] = R(instr->b);
+        DISPATCH();
+    }
+    code_iadd: {
+        R(instr->a) = INT32_VAL(AS_INT32(R(instr->b)) + AS_INT32(R(instr->c)));
+        DISPATCH();
+    }
+    code_isub: {
+        R(instr->a) = INT32_VAL(AS_INT32(R(instr->b)) - AS_INT32(R(instr->c)));
+        DISPATCH();
+    }
+    code_imul: {
+        R(instr->a) = INT32_VAL(AS_INT32(R(instr->b)) * AS_INT32(R(instr->c)));
+        DISPATCH();
+    }
+    code_idiv: {
+        DIVISOR(AS_INT32(R(instr->c)) != 0);
+        R(instr->a) = INT32_VAL(AS_INT32(R(instr->b)) / AS_INT32(R(instr->c)));
+        DISPATCH();
+    }
+    code_mod: {
+        DIVISOR(AS_INT32(R(instr->c)) != 0);
+        R(instr->a) = INT32_VAL(AS_INT32(R(instr->b)) % AS_INT32(R(instr->c)));
+        DISPATCH();
+    }
+    code_bitl: {
+        R(instr->a) = INT32_VAL(AS_INT32(R(instr->b)) << AS_INT32(R(instr->c)));
+        DISPATCH();
+    }
+    code_bitr: {
+        R(instr->a) = INT32_VAL(AS_INT32(R(instr->b)) >> AS_INT32(R(instr->c)));
+        DISPATCH();
+    }
+    code_bitand: {
+        R(instr->a) = INT32_VAL(AS_INT32(R(instr->b)) & AS_INT32(R(instr->c)));
+        DISPATCH();
+    }
+    code_bitor: {
+        R(instr->a) = INT32_VAL(AS_INT32(R(instr->b)) | AS_INT32(R(instr->c)));
+        DISPATCH();
+    }
+    code_bitxor: {
+        R(instr->a) = INT32_VAL(AS_INT32(R(instr->b)) ^ AS_INT32(R(instr->c)));
+        DISPATCH();
+    }
+    code_iaddk: {
+        R(instr->a) = INT32_VAL(AS_INT32(R(instr->b)) + instr->k);
+        DISPATCH();
+    }
+    code_isubk: {
+        R(instr->a) = INT32_VAL(AS_INT32(R(instr->b)) - instr->k);
+        DISPATCH();
+    }
+    code_bitnot: {
+        R(instr->a) = INT32_VAL(~AS_INT32(R(instr->b)));
+        DISPATCH();
+    }
+    code_iminus: {
+        R(instr->a) = INT32_VAL(-AS_INT32(R(instr->b)));
+        DISPATCH();
+    }
+    code_i2f: {
+        R(instr->a) = NUM_VAL(AS_INT32(R(instr->b)));
+        DISPATCH();
+    }
+    code_fadd: {
+        R(instr->a) = NUM_VAL(AS_NUM(R(instr->b)) + AS_NUM(R(instr->c)));
+        DISPATCH();
+    }
+    code_fsub: {
+        R(instr->a) = NUM_VAL(AS_NUM(R(instr->b)) - AS_NUM(R(instr->c)));
+        DISPATCH();
+    }
+    code_fmul: {
+        R(instr->a) = NUM_VAL(AS_NUM(R(instr->b)) * AS_NUM(R(instr->c)));
+        DISPATCH();
+    }
+    code_fdiv: {
+        R(instr->a) = NUM_VAL(AS_NUM(R(instr->b)) / AS_NUM(R(instr->c)));
+        DISPATCH();
+    }
+    code_fminus: {
+        R(instr->a) = NUM_VAL(-AS_NUM(R(instr->b)));
+        DISPATCH();
+    }
+    code_f2i: {
+        R(instr->a) = INT32_VAL((int)AS_NUM(R(instr->b)));
+        DISPATCH();
+    }
+    code_not: {
+        R(instr->a) = BOOL_VAL(!AS_BOOL(R(instr->b)));
+        DISPATCH();
+    }
+    code_b2i: {
+        R(instr->a) = INT32_VAL(AS_BOOL(R(instr->b)));
+        DISPATCH();
+    }
+    code_beq: {
+        R(instr->a) = BOOL_VAL(AS_BOOL(R(instr->b)) == AS_BOOL(R(instr->c)));
+        DISPATCH();
+    }
+    code_ieq: {
+        R(instr->a) = BOOL_VAL(AS_INT32(R(instr->b)) == AS_INT32(R(instr->c)));
+        DISPATCH();
+    }
+    code_feq: {
+        R(instr->a) = BOOL_VAL(AS_NUM(R(instr->b)) == AS_NUM(R(instr->c)));
+        DISPATCH();
+    }
+    code_bne: {
+        R(instr->a) = BOOL_VAL(AS_BOOL(R(instr->b)) != AS_BOOL(R(instr->c)));
+        DISPATCH();
+    }
+    code_ine: {
+        R(instr->a) = BOOL_VAL(AS_INT32(R(instr->b)) != AS_INT32(R(instr->c)));
+        DISPATCH();
+    }
+    code_fne: {
+        R(instr->a) = BOOL_VAL(AS_NUM(R(instr->b)) != AS_NUM(R(instr->c)));
+        DISPATCH();
+    }
+    code_ilt: {
+        R(instr->a) = BOOL_VAL(AS_INT32(R(instr->b)) < AS_INT32(R(instr->c)));
+        DISPATCH();
+    }
+    code_igt: {
+        R(instr->a) = BOOL_VAL(AS_INT32(R(instr->b)) > AS_INT32(R(instr->c)));
+        DISPATCH();
+    }
+    code_ile: {
+        R(instr->a) = BOOL_VAL(AS_INT32(R(instr->b)) <= AS_INT32(R(instr->c)));
+        DISPATCH();
+    }
+    code_ige: {
+        R(instr->a) = BOOL_VAL(AS_INT32(R(instr->b)) >= AS_INT32(R(instr->c)));
+        DISPATCH();
+    }
+    code_flt: {
+        R(instr->a) = BOOL_VAL(AS_NUM(R(instr->b)) < AS_NUM(R(instr->c)));
+        DISPATCH();
+    }
+    code_fgt: {
+        R(instr->a) = BOOL_VAL(AS_NUM(R(instr->b)) > AS_NUM(R(instr->c)));
+        DISPATCH();
+    }
+    code_fle: {
+        R(instr->a) = BOOL_VAL(AS_NUM(R(instr->b)) <= AS_NUM(R(instr->c)));
+        DISPATCH();
+    }
+    code_fge: {
+        R(instr->a) = BOOL_VAL(AS_NUM(R(instr->b)) >= AS_NUM(R(instr->c)));
+        DISPATCH();
+    }
+    code_band: {
+        R(instr->a) = BOOL_VAL(AS_BOOL(R(instr->b)) && AS_BOOL(R(instr->c)));
+        DISPATCH();
+    }
+    code_bor: {
+        R(instr->a) = BOOL_VAL(AS_BOOL(R(instr->b)) || AS_BOOL(R(instr->c)));
+        DISPATCH();
+    }
+    code_jmp: {
+        pc = instr->x;
+        DISPATCH();
+    }
+    code_jmpf: {
+        if(!AS_BOOL(R(instr->b))) {
+            pc = instr->x;
+        }
+        DISPATCH();
+    }
+    code_jieq: {
+        if(!(AS_INT32(R(instr->b)) == AS_INT32(R(instr->c)))) {
+            pc = instr->x;
+        }
+        DISPATCH();
+    }
+    code_jine: {
+        if(!(AS_INT32(R(instr->b)) != AS_INT32(R(instr->c)))) {
+            pc = instr->x;
+        }
+        DISPATCH();
+    }
+    code_jilt: {
+        if(!(AS_INT32(R(instr->b)) < AS_INT32(R(instr->c)))) {
+            pc = instr->x;
+        }
+        DISPATCH();
+    }
+    code_jigt: {
+        if(!(AS_INT32(R(instr->b)) > AS_INT32(R(instr->c)))) {
+            pc = instr->x;
+        }
+        DISPATCH();
+    }
+    code_jile: {
+        if(!(AS_INT32(R(instr->b)) <= AS_INT32(R(instr->c)))) {
+            pc = instr->x;
+        }
+        DISPATCH();
+    }
+    code_jige: {
+        if(!(AS_INT32(R(instr->b)) >= AS_INT32(R(instr->c)))) {
+            pc = instr->x;
+        }
+        DISPATCH();
+    }
+    code_jfeq: {
+        if(!(AS_NUM(R(instr->b)) == AS_NUM(R(instr->c)))) {
+            pc = instr->x;
+        }
+        DISPATCH();
+    }
+    code_jfne: {
+        if(!(AS_NUM(R(instr->b)) != AS_NUM(R(instr->c)))) {
+            pc = instr->x;
+        }
+        DISPATCH();
+    }
+    code_jflt: {
+        if(!(AS_NUM(R(instr->b)) < AS_NUM(R(instr->c)))) {
+            pc = instr->x;
+        }
+        DISPATCH();
+    }
+    code_jfgt: {
+        if(!(AS_NUM(R(instr->b)) > AS_NUM(R(instr->c)))) {
+            pc = instr->x;
+        }
+        DISPATCH();
+    }
+    code_jfle: {
+        if(!(AS_NUM(R(instr->b)) <= AS_NUM(R(instr->c)))) {
+            pc = instr->x;
+        }
+        DISPATCH();
+    }
+    code_jfge: {
+        if(!(AS_NUM(R(instr->b)) >= AS_NUM(R(instr->c)))) {
+            pc = instr->x;
+        }
+        DISPATCH();
+    }
+    code_jieqk: {
+        if(!(AS_INT32(R(instr->b)) == instr->k)) {
+            pc = instr->x;
+        }
+        DISPATCH();
+    }
+    code_jinek: {
+        if(!(AS_INT32(R(instr->b)) != instr->k)) {
+            pc = instr->x;
+        }
+        DISPATCH();
+    }
+    code_jiltk: {
+        if(!(AS_INT32(R(instr->b)) < instr->k)) {
+            pc = instr->x;
+        }
+        DISPATCH();
+    }
+    code_jigtk: {
+        if(!(AS_INT32(R(instr->b)) > instr->k)) {
+            pc = instr->x;
+        }
+        DISPATCH();
+    }
+    code_jilek: {
+        if(!(AS_INT32(R(instr->b)) <= instr->k)) {
+            pc = instr->x;
+        }
+        DISPATCH();
+    }
+    code_jigek: {
+        if(!(AS_INT32(R(instr->b)) >= instr->k)) {
+            pc = instr->x;
+        }
+        DISPATCH();
+    }
+    code_call: {
+        // Arguments are in the slots a .. a+b-1,
+        // the frame of the callee follows (see Bytecode.md).
+        // c is the number of slots used by the callee.
+        int callee = fp + instr->a + instr->b;
+        if(callee + instr->c > vm->stackSize) {
+            SAVE(instr->a + instr->b);
+            if(!vm_grow_stack(vm, callee + instr->c)) {
+                vm_throw(vm, "Stack overflow");
+                return;
+            }
+            RELOAD();
+        }
+        if(frame == &vm->frames[vm->frameSize-1]) {
+            SAVE(instr->a + instr->b);
+            if(!vm_grow_frames(vm)) {
+                vm_throw(vm, "Stack overflow");
+                return;
+            }
+            RELOAD();
+        }
+
+        frame++;
+        frame->pc = pc;
+        frame->fp = fp;
+        frame->receiver = fp + instr->a - 1;
+        frame->keep = false;
+        frame->level = 0;
+        fp = callee;
+        pc = instr->x;
+        DISPATCH();
+    }
+    code_ret: {
+        // The return value replaces the first argument
+        val_t ret = R(instr->b);
+        int dest = frame->receiver + 1;
+        bool keep = frame->keep;
+
+        pc = frame->pc;
+        fp = frame->fp;
+        if(frame->level) vm->display[frame->level] = frame->saved;
+        frame--;
+
+        // Tail called from a class method, return its class as well
+        if(keep) {
+            stack[dest] = stack[dest-1];
+            stack[dest-1] = ret;
+            DISPATCH();
+        }
+        stack[dest] = ret;
+        DISPATCH();
+    }
+    code_retvirtual: {
+        // The return value replaces the class, which is moved up by one
+        val_t ret = R(instr->b);
+        int dest = frame->receiver;
+
+        pc = frame->pc;
+        fp = frame->fp;
+        if(frame->level) vm->display[frame->level] = frame->saved;
+
+        // Tail called, the class of the first method is kept below
+        if(frame->keep) {
+            dest--;
+        }
+        frame--;
+        stack[dest+1] = stack[dest];
+        stack[dest] = ret;
+        DISPATCH();
+    }
+    code_retvoid: {
+        // Nothing is returned, the class of a method stays below the arguments
+        pc = frame->pc;
+        fp = frame->fp;
+        if(frame->level) vm->display[frame->level] = frame->saved;
+        frame--;
+        DISPATCH();
+    }
+    code_syscall: {
+        // The arguments are on top of the stack,
+        // the result replaces the first one (if any)
+        SAVE(instr->a + instr->b);
+        vm_syscall(vm, instr->x);
+        pc = vm->pc;
+        RELOAD();
+        DISPATCH();
+    }
+    code_arr: {
+        size_t elsz = instr->x;
+        val_t* arr = malloc(sizeof(val_t) * elsz);
+        for(size_t i = 0; i < elsz; i++) {
+            arr[i] = COPY_VAL(R(instr->a + i));
+            R(instr->a + i) = NULL_VAL;
+        }
+
+        obj_t* obj = obj_array_new(arr, elsz);
+        REGISTER(instr->a, obj);
+        DISPATCH();
+    }
+    code_str: {
+        size_t elsz = instr->x;
+        char* str = malloc(sizeof(char) * (elsz+1));
+        for(size_t i = 0; i < elsz; i++) {
+            str[i] = (char)AS_INT32(R(instr->a + i));
+            R(instr->a + i) = NULL_VAL;
+        }
+        str[elsz] = '\0';
+
+        obj_t* obj = obj_string_nocopy_new(str);
+        REGISTER(instr->a, obj);
+        DISPATCH();
+    }
+    code_tostr: {
+        char* str = val_tostr(R(instr->b));
+        val_t val = STRING_NOCOPY_VAL(str);
+        REGISTER(instr->a, AS_OBJ(val));
+        DISPATCH();
+    }
+    code_getsub: {
+        obj_array_t* arr = AS_ARRAY(R(instr->b));
+        int idx = AS_INT32(R(instr->c));
+        BOUNDS(IN_ARRAY(arr, idx));
+        COPY(instr->a, arr->data[idx]);
+        DISPATCH();
+    }
+    code_setsub: {
+        // a: value, b: object, c: key
+        val_t val = R(instr->a);
+        int idx = AS_INT32(R(instr->c));
+        BOUNDS(IN_ARRAY(AS_ARRAY(R(instr->b)), idx));
+        val_t obj = COPY_VAL(R(instr->b));
+
+        obj_array_t* arr = AS_ARRAY(obj);
+        val_free(arr->data[idx]);
+        arr->data[idx] = val;
+
+        // Register the copy and its content, same as vm_register
+        R(instr->a) = obj;
+        SAVE(instr->live);
+        val_append(vm, obj);
+        DISPATCH();
+    }
+    code_len: {
+        R(instr->a) = INT32_VAL(AS_ARRAY(R(instr->b))->len);
+        DISPATCH();
+    }
+    code_append: {
+        obj_array_t* arr1 = AS_ARRAY(R(instr->b));
+        obj_array_t* arr2 = AS_ARRAY(R(instr->c));
+
+        size_t len = arr1->len + arr2->len;
+        val_t* arr3 = malloc(sizeof(val_t) * len);
+
+        size_t i;
+        for(i = 0; i < arr1->len; i++) {
+            arr3[i] = val_copy(arr1->data[i]);
+        }
+        for(i = 0; i < arr2->len; i++) {
+            arr3[i+arr1->len] = val_copy(arr2->data[i]);
+        }
+
+        obj_t* newObj = obj_array_new(arr3, len);
+        REGISTER(instr->a, newObj);
+        DISPATCH();
+    }
+    code_cons: {
+        val_t obj = COPY_VAL(R(instr->b));
+        val_t val = R(instr->c);
+
+        obj_array_t* arr = AS_ARRAY(obj);
+        arr->len += 1;
+        size_t allocSz = sizeof(val_t) * arr->len;
+        arr->data = (arr->len == 1) ? malloc(allocSz) : realloc(arr->data, allocSz);
+        arr->data[arr->len-1] = COPY_VAL(val);
+
+        REGISTER(instr->a, AS_OBJ(obj));
+        DISPATCH();
+    }
+    code_sgetsub: {
+        char* str = AS_STRING(R(instr->b));
+        int idx = AS_INT32(R(instr->c));
+        BOUNDS(IN_STRING(str, idx));
+        R(instr->a) = INT32_VAL(str[idx]);
+        DISPATCH();
+    }
+    code_ssetsub: {
+        // a: value, b: object, c: key
+        val_t val = R(instr->a);
+        int idx = AS_INT32(R(instr->c));
+        BOUNDS(IN_STRING(AS_STRING(R(instr->b)), idx));
+        val_t obj = COPY_VAL(R(instr->b));
+        AS_STRING(obj)[idx] = (char)AS_INT32(val);
+
+        R(instr->a) = obj;
+        SAVE(instr->live);
+        val_append(vm, obj);
+        DISPATCH();
+    }
+    code_slen: {
+        R(instr->a) = INT32_VAL(strlen(AS_STRING(R(instr->b))));
+        DISPATCH();
+    }
+    code_sappend: {
+        char* str1 = AS_STRING(R(instr->b));
+        char* str2 = AS_STRING(R(instr->c));
+        size_t len1 = strlen(str1);
+        size_t len2 = strlen(str2);
+        char* data = malloc(sizeof(char) * (len1 + len2 + 1));
+        memcpy(data, str1, len1);
+        memcpy(data + len1, str2, len2 + 1);
+
+        obj_t* obj_ptr = obj_string_nocopy_new(data);
+        REGISTER(instr->a, obj_ptr);
+        DISPATCH();
+    }
+    code_scons: {
+        char* str = AS_STRING(R(instr->b));
+        size_t len = strlen(str);
+        char* newStr = malloc(sizeof(char) * (len+2));
+        memcpy(newStr, str, len);
+        newStr[len] = (char)AS_INT32(R(instr->c));
+        newStr[len+1] = '\0';
+
+        obj_t* obj_ptr = obj_string_nocopy_new(newStr);
+        REGISTER(instr->a, obj_ptr);
+        DISPATCH();
+    }
+    code_class: {
+        obj_t* obj = obj_class_new(instr->x);
+        REGISTER(instr->a, obj);
+        DISPATCH();
+    }
+    code_setfield: {
+        obj_class_t* cls = AS_CLASS(R(instr->a));
+        FIELD(cls, instr->x);
+        cls->fields[instr->x] = R(instr->b);
+        DISPATCH();
+    }
+    code_getfield: {
+        obj_class_t* cls = AS_CLASS(R(instr->b));
+        FIELD(cls, instr->x);
+        COPY(instr->a, cls->fields[instr->x]);
+        DISPATCH();
+    }
+    code_ldfield: {
+        obj_class_t* cls = AS_CLASS(stack[frame->receiver]);
+        FIELD(cls, instr->x);
+        COPY(instr->a, cls->fields[instr->x]);
+        DISPATCH();
+    }
+    code_incl: {
+        R(instr->a) = INT32_VAL(AS_INT32(R(instr->a)) + instr->k);
+        DISPATCH();
+    }
+    code_ginc: {
+        stack[instr->x] = INT32_VAL(AS_INT32(stack[instr->x]) + instr->k);
+        DISPATCH();
+    }
+    code_addl: {
+        R(instr->a) = INT32_VAL(AS_INT32(R(instr->a)) + AS_INT32(R(instr->b)));
+        DISPATCH();
+    }
+    code_forl: {
+        // Same as forl of the stack VM, the limit is in slot a+1
+        int i = AS_INT32(R(instr->a)) + 1;
+        R(instr->a) = INT32_VAL(i);
+        if(i < AS_INT32(R(instr->a+1))) {
+            pc = instr->x;
+        }
+        DISPATCH();
+    }
+    code_forin: {
+        obj_array_t* arr = AS_ARRAY(R(instr->a));
+        int i = AS_INT32(R(instr->a+1)) + 1;
+        R(instr->a+1) = INT32_VAL(i);
+        if(i < (int)arr->len) {
+            R(instr->a+2) = arr->data[i];
+            pc = instr->x;
+        }
+        DISPATCH();
+    }
+    code_switch: {
+        // Same as switch of the stack VM, the key is in slot b,
+        // the x+1 entries follow
+        uint32_t key = (uint32_t)AS_INT32(R(instr->b)) - (uint32_t)instr->k;
+        if(key > (uint32_t)instr->x) key = instr->x;
+        pc = code[pc + key].x;
+        DISPATCH();
+    }
+    code_case: {
+        pc = instr->x;
+        DISPATCH();
+    }
+    code_tailcall: {
+        // Same as the tailcall of the stack VM,
+        // the arguments (and the receiver) start at slot a.
+        int args = TAIL_ARGS(instr->b);
+        int mode = instr->b;
+        int count = (mode & TAIL_CALLEE_VIRTUAL) ? args + 1 : args;
+
+        int dest = frame->receiver + 1;
+        if(mode & TAIL_SELF_VIRTUAL) dest--;
+        if((mode & TAIL_KEEP) && !frame->keep) {
+            dest++;
+            frame->keep = true;
+        }
+
+        int callee = dest + count;
+        if(callee + instr->c > vm->stackSize) {
+            SAVE(instr->a + count);
+            if(!vm_grow_stack(vm, callee + instr->c)) {
+                vm_throw(vm, "Stack overflow");
+                return;
+            }
+            RELOAD();
+        }
+        if(frame->level) {
+            vm->display[frame->level] = frame->saved;
+            frame->level = 0;
+        }
+
+        int src = fp + instr->a;
+        for(int i = 0; i < count; i++) {
+            stack[dest+i] = stack[src+i];
+        }
+        frame->receiver = callee - args - 1;
+        fp = callee;
+        pc = instr->x;
+        DISPATCH();
+    }
+    code_enter: {
+        frame->level = instr->x;
+        frame->saved = vm->display[instr->x];
+        vm->display[instr->x] = fp;
+        DISPATCH();
+    }
+    code_gborrow: {
+        R(instr->a) = stack[instr->x];
+        DISPATCH();
+    }
+    code_borrow0: {
+        R(instr->a) = stack[frame->receiver];
+        DISPATCH();
+    }
+    code_stfield: {
+        obj_class_t* cls = AS_CLASS(stack[frame->receiver]);
+        FIELD(cls, instr->x);
+        cls->fields[instr->x] = R(instr->b);
+        DISPATCH();
+    }
+}
+
+void regvm_run(vm_t* vm, regcode_t* regcode) {
+    regvm_run_args(vm, regcode, 0, 0);
+}
+
+// Execute register code
+void regvm_run_args(vm_t* vm, regcode_t* regcode, int argc, char** argv) {
+    vm->pc = 0;
+    vm->fp = 0;
+    vm->sp = 0;
+    vm->depth = 0;
+    vm->argc = argc;
+    vm->argv = argv;
+    vm->maxObjects = 8;
+
+#ifndef NO_IR
+    printf("\nRegister code:\n");
+    for(size_t i = 0; i < regcode->size; i++) {
+        printf("  %.2d: ", (int)i);
+        reg_print(&regcode->code[i]);
+        putchar('\n');
+    }
+    printf("\nExecution:\n");
+#endif
+
+#ifndef NO_EXEC
+#ifndef NO_THREADED
+    // Replace the opcodes by their handler addresses and back afterwards
+    if(!handlers) regvm_exec(0, 0);
+    for(size_t i = 0; i < regcode->size; i++) {
+        regcode->code[i].handler = handlers[regcode->code[i].op];
+    }
+    regvm_exec(vm, regcode);
+    for(size_t i = 0; i < regcode->size; i++) {
+        for(size_t op = 0; op < handler_count; op++) {
+            if(regcode->code[i].handler == handlers[op]) {
+                regcode->code[i].op = op;
+                break;
+            }
+        }
+    }
+#else
+    regvm_exec(vm, regcode);
+#endif
+#endif
+
+    vm_clear(vm);
+}
@@ -0,0 +1,183 @@
+/**
+ * regvm.h
+ * Copyright (C) 2017 Alexander Koch
+ * Golem register-based virtual machine
+ *
+ * Alternative execution engine for three-address code.
+ * The instructions address the slots of the current frame directly
+ * (a, b, c are offsets to the frame pointer), instead of moving values
+ * over the stack. Frame layout, calling convention and syscalls are the
+ * same as for the stack VM (see vm.h and Bytecode.md).
+ *
+ * Register code is generated from the stack bytecode by compiler/regcode.c.
+ * Build with -DREGVM to run programs on this engine.
+ */
+
+#ifndef regvm_h
+#define regvm_h
+
+#include "../vm/vm.h"
+
+typedef enum {
+    R_HLT,
+    R_MOV,
+    R_COPY,
+    R_LOADK,
+    R_GLOAD,
+    R_GSTORE,
+    R_UPVAL,
+    R_UPSTORE,
+    R_LDARG0,
+    R_SETARG0,
+
+    R_IADD,
+    R_ISUB,
+    R_IMUL,
+    R_IDIV,
+    R_MOD,
+    R_BITL,
+    R_BITR,
+    R_BITAND,
+    R_BITOR,
+    R_BITXOR,
+    R_IADDK,
+    R_ISUBK,
+    R_BITNOT,
+    R_IMINUS,
+    R_I2F,
+
+    R_FADD,
+    R_FSUB,
+    R_FMUL,
+    R_FDIV,
+    R_FMINUS,
+    R_F2I,
+    R_NOT,
+    R_B2I,
+
+    R_BEQ,
+    R_IEQ,
+    R_FEQ,
+    R_BNE,
+    R_INE,
+    R_FNE,
+    R_ILT,
+    R_IGT,
+    R_ILE,
+    R_IGE,
+    R_FLT,
+    R_FGT,
+    R_FLE,
+    R_FGE,
+    R_BAND,
+    R_BOR,
+
+    R_JMP,
+    R_JMPF,
+    R_JIEQ,
+    R_JINE,
+    R_JILT,
+    R_JIGT,
+    R_JILE,
+    R_JIGE,
+    R_JFEQ,
+    R_JFNE,
+    R_JFLT,
+    R_JFGT,
+    R_JFLE,
+    R_JFGE,
+    R_JIEQK,
+    R_JINEK,
+    R_JILTK,
+    R_JIGTK,
+    R_JILEK,
+    R_JIGEK,
+
+    R_CALL,
+    R_RET,
+    R_RETVIRTUAL,
+    R_RETVOID,
+    R_SYSCALL,
+
+    R_ARR,
+    R_STR,
+    R_TOSTR,
+    R_GETSUB,
+    R_SETSUB,
+    R_LEN,
+    R_APPEND,
+    R_CONS,
+    R_SGETSUB,
+    R_SSETSUB,
+    R_SLEN,
+    R_SAPPEND,
+    R_SCONS,
+
+    R_CLASS,
+    R_SETFIELD,
+    R_GETFIELD,
+    R_LDFIELD,
+
+    R_INCL,
+    R_GINC,
+    R_ADDL,
+    R_FORL,
+    R_FORIN,
+    R_SWITCH,
+    R_CASE,
+
+    R_TAILCALL,
+    R_ENTER,
+
+    R_GBORROW,
+    R_BORROW0,
+    R_STFIELD
+} regop_t;
+
+/**
+ * reg_t - register instruction
+ *
+ * @op Opcode, replaced by the handler address before execution
+ * @a Destination slot
+ * @b First source slot
+ * @c Second source slot
+ * @live Number of frame slots in use, for the GC
+ * @x Address, count or index
+ * @k Integer immediate
+ * @v Constant
+ */
+typedef struct {
+    union {
+        regop_t op;
+        const void* handler;
+    };
+    int16_t a;
+    int16_t b;
+    int16_t c;
+    int16_t live;
+    int32_t x;
+    int32_t k;
+    val_t v;
+} reg_t;
+
+/**
+ * regcode_t - register code of a program
+ *
+ * @code Instructions
+ * @size Number of instructions
+ * @frame Slots used by the toplevel code
+ */
+typedef struct {
+    reg_t* code;
+    size_t size;
+    int frame;
+} regcode_t;
+
+const char* regop2str(regop_t op);
+void reg_print(reg_t* instr);
+void regcode_free(regcode_t* regcode);
+
+void regvm_run(vm_t* vm, regcode_t* regcode);
+void regvm_run_args(vm_t* vm, regcode_t* regcode, int argc, char** argv);
+
+#endif
@@ -0,0 +1,252 @@
+// Copyright (C) 2017 Alexander Koch
+#include <limits.h>
+#include "tier.h"
+#include "../compiler/optimizer.h"
+
+#ifndef NO_TIER
+
+tier_t* tier_new(bytecode_t* bytecode) {
+    size_t size = bytecode->size;
+    tier_t* tier = malloc(sizeof(*tier));
+    tier->hot = malloc(sizeof(int) * (size + 1));
+    tier->verifier = verifier_new(size);
+    tier->ops = malloc(sizeof(opcode_t) * (size + 1));
+
+    // The loaded code is valid, the tables are kept for the new bodies
+    int* frame = malloc(sizeof(int) * (size + 1));
+    bytecode_verify(bytecode, tier->verifier, frame);
+    free(frame);
+
+    for(size_t i = 0; i < size; i++) {
+        tier->hot[i] = TIER_THRESHOLD;
+        tier->ops[i] = bytecode->code[i].op;
+    }
+    return tier;
+}
+
+void tier_free(tier_t* tier) {
+    if(tier) {
+        free(tier->hot);
+        verifier_free(tier->verifier);
+        free(tier->ops);
+        free(tier);
+    }
+}
+
+// Instructions of inlined functions: no control flow
+// and nothing that depends on the frame (receiver, display)
+static bool tier_inlinable(opcode_t op) {
+    if(op_has_address(op) || op_is_terminator(op)) return false;
+    switch(op) {
+        case OP_LDARG0:
+        case OP_SETARG0:
+        case OP_LDFIELD:
+        case OP_STFIELD:
+        case OP_BORROW0:
+        case OP_ENTER:
+        case OP_UPVAL:
+        case OP_UPSTORE:
+        case OP_LDLIB: return false;
+        default: return true;
+    }
+}
+
+// Length of the function at callee without its return, if it can be inlined
+// into a call (void or not): straight code and at most TIER_INLINE_SIZE long.
+// Returns -1 otherwise.
+static int tier_leaf(tier_t* tier, bytecode_t* bytecode, int callee, bool none) {
+    int size = bytecode->size;
+    for(int pc = callee; pc < size && pc <= callee + TIER_INLINE_SIZE; pc++) {
+        if(tier->verifier->func[pc] != callee || tier->verifier->depth[pc] == -1) return -1;
+
+        opcode_t op = tier->ops[pc];
+        if(op == (none ? OP_RETVOID : OP_RET)) return pc - callee;
+        if(!tier_inlinable(op)) return -1;
+    }
+    return -1;
+}
+
+// Whether the function at entry has calls to inline and can be copied:
+// it starts at its entry and has no exception handlers.
+// Without calls to inline the optimizer passes would return the loaded code.
+static bool tier_worth(tier_t* tier, bytecode_t* bytecode, int entry) {
+    bool calls = false;
+    for(int pc = 0; pc < (int)bytecode->size; pc++) {
+        if(tier->verifier->func[pc] != entry || tier->verifier->depth[pc] == -1) continue;
+
+        opcode_t op = tier->ops[pc];
+        if(pc < entry || op == OP_CATCH) return false;
+        if(op == OP_INVOKE) {
+            code_t* instr = &bytecode->code[pc];
+            if(tier_leaf(tier, bytecode, instr->a, instr->b & CALL_VOID) >= 0) calls = true;
+        }
+    }
+    return calls;
+}
+
+// Moves the local slots of an inlined instruction into the frame of the caller
+// (the slots of op_slots in bytecode.c, without the jumps)
+static void tier_rebase(instruction_t* instr, int offset) {
+    switch(instr->op) {
+        case OP_LOAD2:
+        case OP_ADDL: instr->v2 = INT32_VAL(AS_INT32(instr->v2) + offset); // fallthrough
+        case OP_STORE:
+        case OP_LOAD:
+        case OP_BORROW:
+        case OP_IADDLK:
+        case OP_ISUBLK:
+        case OP_ILTLK:
+        case OP_INCL: instr->v1 = INT32_VAL(AS_INT32(instr->v1) + offset); break;
+        default: break;
+    }
+}
+
+// Replaces the call at pc by the body of its callee (see tier_leaf).
+// The arguments stay in their slots, the frame of the callee starts above them,
+// on return the result replaces the arguments.
+static void tier_inline(tier_t* tier, bytecode_t* bytecode, vector_t* out, int pc, int length) {
+    code_t* call = &bytecode->code[pc];
+    int callee = call->a;
+    int args = CALL_ARGS(call->b);
+    int d = tier->verifier->depth[pc];
+
+    // The last argument is still cached as the top of the stack (see vm_exec),
+    // slots are read from memory: spill it, like invoke does
+    if(args > 0 && tier->ops[callee] != OP_RESERVE) {
+        insert_v1(out, OP_RESERVE, INT32_VAL(0));
+    }
+    for(int i = 0; i < length; i++) {
+        instruction_t* instr = code_unpack(&bytecode->code[callee + i]);
+        tier_rebase(instr, d);
+        vector_push(out, instr);
+    }
+
+    // Depth of the callee at its return
+    int top = tier->verifier->depth[callee + length];
+    if(call->b & CALL_VOID) {
+        if(top + args > 0) insert_v1(out, OP_RESERVE, INT32_VAL(-(top + args)));
+    } else if(args > 0 || top > 1) {
+        insert_v1(out, OP_STORE, INT32_VAL(d - args));
+        if(top + args - 2 > 0) insert_v1(out, OP_RESERVE, INT32_VAL(-(top + args - 2)));
+    }
+}
+
+/**
+ * Generates the body of the function at entry with the calls inlined.
+ * Jumps within the body address the body, the calls are encoded
+ * as -(address + 1), so the optimizer passes leave them alone (see tier_relocate).
+ * Ends with hlt, like the loaded code. Returns NULL if a jump leaves the function.
+ */
+static vector_t* tier_body(tier_t* tier, bytecode_t* bytecode, int entry) {
+    int size = bytecode->size;
+    int* index = malloc(sizeof(int) * (size + 1));
+    vector_t* out = vector_new();
+
+    for(int pc = 0; pc < size; pc++) {
+        index[pc] = -1;
+        if(pc < entry || tier->verifier->func[pc] != entry || tier->verifier->depth[pc] == -1) continue;
+
+        index[pc] = vector_size(out);
+        code_t* code = &bytecode->code[pc];
+        if(code->op == OP_INVOKE) {
+            int length = tier_leaf(tier, bytecode, code->a, code->b & CALL_VOID);
+            if(length >= 0) {
+                tier_inline(tier, bytecode, out, pc, length);
+                continue;
+            }
+        }
+        vector_push(out, code_unpack(code));
+    }
+    emit_op(out, OP_HLT);
+
+    // Inlined code has no addresses, all of them are from the function
+    bool valid = true;
+    for(size_t i = 0; i < vector_size(out); i++) {
+        instruction_t* instr = vector_get(out, i);
+        if(!op_has_address(instr->op)) continue;
+
+        int address = AS_INT32(instr->v1);
+        if(instr->op == OP_INVOKE || instr->op == OP_TAILCALL) {
+            instr->v1 = INT32_VAL(-address - 1);
+        } else if(index[address] != -1) {
+            instr->v1 = INT32_VAL(index[address]);
+        } else {
+            valid = false;
+        }
+    }
+    free(index);
+
+    if(!valid) {
+        bytecode_buffer_free(out);
+        return 0;
+    }
+    return out;
+}
+
+// Converts the addresses of the body to code addresses, it is appended at base
+static void tier_relocate(vector_t* body, int base) {
+    for(size_t i = 0; i < vector_size(body); i++) {
+        instruction_t* instr = vector_get(body, i);
+        if(!op_has_address(instr->op)) continue;
+
+        int address = AS_INT32(instr->v1);
+        instr->v1 = INT32_VAL(address < 0 ? -address - 1 : base + address);
+    }
+}
+
+bool tier_up(tier_t* tier, bytecode_t* bytecode, int entry) {
+    // Tried once, the toplevel code is never called again
+    tier->hot[entry] = INT_MAX;
+    if(entry == 0 || !tier_worth(tier, bytecode, entry)) return false;
+
+    int size = bytecode->size;
+    for(int i = 0; i < size; i++) {
+        bytecode->code[i].op = tier->ops[i];
+    }
+
+    vector_t* body = tier_body(tier, bytecode, entry);
+    if(!body) return true;
+    optimize_jumps(body);
+    optimize_superinstructions(body);
+    tier_relocate(body, size);
+    bool typed = bytecode_append(bytecode, body);
+    bytecode_buffer_free(body);
+
+    // Every call continues in the new body, the old one may still run
+    int newSize = bytecode->size;
+    int* patched = malloc(sizeof(int) * (newSize + 1));
+    int count = 0;
+    for(int pc = 0; pc < newSize; pc++) {
+        code_t* instr = &bytecode->code[pc];
+        if((instr->op == OP_INVOKE || instr->op == OP_TAILCALL) && instr->a == entry) {
+            instr->a = size;
+            if(pc < size) patched[count++] = pc;
+        }
+    }
+
+    // Only the new body and the redirected calls are verified,
+    // the frames of the old code stay
+    bytecode->frame = realloc(bytecode->frame, sizeof(int) * (newSize + 1));
+    const char* error = typed
+        ? bytecode_verify_append(bytecode, tier->verifier, bytecode->frame, size, patched, count)
+        : "Operand is not an integer";
+    if(error) {
+        for(int i = 0; i < count; i++) {
+            bytecode->code[patched[i]].a = entry;
+        }
+        bytecode_truncate(bytecode, size);
+        free(patched);
+        return true;
+    }
+
+    tier->hot = realloc(tier->hot, sizeof(int) * (newSize + 1));
+    tier->ops = realloc(tier->ops, sizeof(opcode_t) * (newSize + 1));
+    for(int i = size; i < newSize; i++) {
+        tier->hot[i] = INT_MAX;
+        tier->ops[i] = bytecode->code[i].op;
+    }
+    free(patched);
+    return true;
+}
+
+#endif
@@ -0,0 +1,61 @@
+/**
+ * tier.h
+ * Copyright (C) 2017 Alexander Koch
+ * Second tier: re-optimization of hot functions at runtime
+ *
+ * vm_exec counts the calls of every function and the back edges (loop jumps)
+ * within it. When a function reaches TIER_THRESHOLD, its bytecode is generated
+ * again from the loaded code: small functions it invokes are inlined into the
+ * frame of the caller, then the jump and superinstruction passes of the
+ * optimizer run over the result (see optimizer.h).
+ *
+ * The new body is appended to the code (see bytecode_append) and every call
+ * of the function is redirected to it, so it runs from the next call on.
+ * Frames within the old body return there, it is never changed.
+ * The new body and the redirected calls are verified (see bytecode_verify_append),
+ * a body that fails is dropped.
+ *
+ * Only functions that call small functions are re-optimized, without
+ * inlining the passes would generate the same code again. Self-recursive
+ * functions and functions that only loop keep their code.
+ * Functions with exception handlers are kept as well, the handler table
+ * only covers the loaded code. The JIT (-DJIT) compiles hot functions
+ * to native code instead. Build with -DNO_TIER to disable it.
+ */
+
+#ifndef tier_h
+#define tier_h
+
+#include "../vm/vm.h"
+
+// Number of calls and loop iterations after which a function is re-optimized
+#ifndef TIER_THRESHOLD
+#define TIER_THRESHOLD 1000
+#endif
+
+// Maximum number of instructions of an inlined function
+#define TIER_INLINE_SIZE 16
+
+/**
+ * tier_t - counters of the second tier
+ *
+ * @hot Remaining count of every function, by entry
+ * @verifier Functions and stack depths of every instruction (see bytecode_verify)
+ * @ops Opcodes, the code is threaded while it runs
+ */
+typedef struct tier_t {
+    int* hot;
+    verifier_t* verifier;
+    opcode_t* ops;
+} tier_t;
+
+// The opcodes are read on creation, before the code is threaded
+tier_t* tier_new(bytecode_t* bytecode);
+void tier_free(tier_t* tier);
+
+// Re-optimizes the function at entry, once it is hot.
+// Returns true if the opcodes of the code were restored (unthreaded):
+// the code may have moved and has to be threaded again.
+bool tier_up(tier_t* tier, bytecode_t* bytecode, int entry);
+
+#endif
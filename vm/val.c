@@ -99,6 +99,7 @@ obj_t* obj_new() {
     obj->type = OBJ_NULL;
     obj->data = 0;
     obj->marked = 0;
+    obj->permanent = 0;
     obj->next = 0;
     return obj;
 }
@@ -175,12 +176,27 @@ void obj_free(obj_t* obj) {
 void val_free(val_t v1) {
     if(IS_OBJ(v1)) {
         obj_t* obj = AS_OBJ(v1);
-        if(obj) {
+        if(obj && !obj->permanent) {
             obj_free(obj);
         }
     }
 }
 
+val_t val_permanent(val_t v1) {
+    if(IS_OBJ(v1)) {
+        AS_OBJ(v1)->permanent = 1;
+    }
+    return v1;
+}
+
+// Frees a permanent object, only its owner (the bytecode) does this
+void val_release(val_t v1) {
+    if(IS_OBJ(v1)) {
+        AS_OBJ(v1)->permanent = 0;
+        val_free(v1);
+    }
+}
+
 char* val_tostr(val_t v1) {
     if(IS_INT32(v1)) {
         int v = AS_INT32(v1);
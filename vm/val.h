@@ -11,6 +11,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 #include "../core/mem.h"
 #include "../core/util.h"
 
@@ -72,6 +73,7 @@ typedef struct obj_t {
     obj_type_t type;
     void* data;
     unsigned char marked;
+    unsigned char permanent;
     struct obj_t* next;
 } obj_t;
 
@@ -118,6 +120,11 @@ void obj_free(obj_t* obj);
 #define IS_ARRAY(value) (IS_OBJ(value) && ((obj_t*)AS_OBJ(value))->type == OBJ_ARRAY)
 #define IS_CLASS(value) (IS_OBJ(value) && ((obj_t*)AS_OBJ(value))->type == OBJ_CLASS)
 
+// Bounds of a subscript. Strings keep no length,
+// so only the characters up to the index are scanned.
+#define IN_ARRAY(arr, idx) ((idx) >= 0 && (size_t)(idx) < (arr)->len)
+#define IN_STRING(str, idx) ((idx) >= 0 && !memchr((str), '\0', (size_t)(idx) + 1))
+
 // Interpreting
 
 #define AS_BOOL(value) ((value) == TRUE_VAL)
@@ -153,6 +160,13 @@ bool val_equal(val_t v1, val_t v2);
 val_t val_copy(val_t val);
 void val_free(val_t v1);
 
+// Constants of the loaded bytecode (see bytecode_load) are permanent:
+// they are pushed without copying, the GC never registers, marks or frees them.
+// Mutating instructions still work on a copy (COPY_VAL).
+#define IS_PERMANENT(value) (IS_OBJ(value) && ((obj_t*)AS_OBJ(value))->permanent)
+val_t val_permanent(val_t v1);
+void val_release(val_t v1);
+
 char* val_tostr(val_t v1);
 void val_print(val_t v1);
 
@@ -1,7 +1,15 @@
 // Copyright (C) 2017 Alexander Koch
 #include "vm.h"
 
+#ifdef JIT
+#include "jit.h"
+#endif
+#ifndef NO_TIER
+#include "tier.h"
+#endif
+
 void vm_gc(vm_t* vm);
+void vm_thread(bytecode_t* bytecode);
 
 extern void core_print(vm_t* vm);
 extern void core_println(vm_t* vm);
@@ -34,7 +42,7 @@ extern void math_prng(vm_t* vm);
 extern void io_readFile(vm_t* vm);
 extern void io_writeFile(vm_t* vm);
 
-static gvm_c_function system_methods[] = {
+static gvm_c_function system_methods[SYSCALL_COUNT + 1] = {
     core_print,            // 01
     core_println,          // 02
     core_getline,          // 03
@@ -68,27 +76,146 @@ static gvm_c_function system_methods[] = {
     0
 };
 
+// Natives declared void push no result, calls of them carry CALL_VOID
+bool syscall_void(int index) {
+    gvm_c_function func = system_methods[index];
+    return func == core_print || func == core_println || func == core_break || func == io_writeFile;
+}
+
 void vm_clear(vm_t* vm);
 
+// Direct threaded code is used by default:
+// at load time every opcode is replaced by the address of its handler.
+// Define NO_THREADED to dispatch indirectly through the dispatch table.
+// Tracing and profiling need the opcodes, so they always use the indirect mode.
+#if defined(TRACE) || defined(PROFILE)
+#define NO_THREADED
+#endif
+
+#ifdef PROFILE
+// Dynamic opcode pair counts, printed after execution
+static unsigned long op_pairs[OP_COUNT][OP_COUNT];
+
+void vm_profile_print() {
+    printf("\nOpcode pairs:\n");
+    for(int n = 0; n < 24; n++) {
+        unsigned long max = 0;
+        int first = 0, second = 0;
+        for(int i = 0; i < OP_COUNT; i++) {
+            for(int j = 0; j < OP_COUNT; j++) {
+                if(op_pairs[i][j] > max) {
+                    max = op_pairs[i][j];
+                    first = i;
+                    second = j;
+                }
+            }
+        }
+        if(max == 0) break;
+        printf("  %10lu: %s, %s\n", max, op2str(first), op2str(second));
+        op_pairs[first][second] = 0;
+    }
+}
+#endif
+
+// Handler addresses of vm_exec, exported for threading
+static void** handlers = 0;
+static size_t handler_count = 0;
+
 #define VM_ASSERT(x, msg) \
-    if(!(x)) { vm_throw(vm, msg); goto *dispatch_table[OP_HLT]; }
+    if(!(x)) { SAVE(); vm_raise(vm, msg); goto exception; }
+
+// Maximum length of an exception message
+#define MESSAGE_SIZE 256
+
+static void vm_raise_args(vm_t* vm, const char* format, va_list argptr) {
+    char message[MESSAGE_SIZE];
+    vsnprintf(message, sizeof(message), format, argptr);
+
+    // Instance of the class Exception of the core library,
+    // its only field is the message.
+    // Registered while referenced by the VM, so the GC keeps it.
+    obj_t* obj = obj_class_new(1);
+    obj_class_t* cls = obj->data;
+    cls->fields[0] = STRING_VAL(message);
+    vm->exception = OBJ_VAL(obj);
+    obj_append(vm, obj);
+}
 
-void vm_throw(vm_t* vm, const char* format, ...) {
-    printf("=> Exception thrown: ");
+/**
+ * vm_raise:
+ * Throws an exception, that may be caught by a handler (see vm_unwind).
+ * Nothing is printed, the caller continues with the unwinding.
+ */
+void vm_raise(vm_t* vm, const char* format, ...) {
     va_list argptr;
     va_start(argptr, format);
-    vfprintf(stdout, format, argptr);
+    vm_raise_args(vm, format, argptr);
     va_end(argptr);
+}
+
+/**
+ * vm_uncaught:
+ * Prints the thrown exception and resets the VM,
+ * it continues at errjmp, which halts.
+ */
+void vm_uncaught(vm_t* vm) {
+    obj_class_t* cls = AS_CLASS(vm->exception);
+    printf("=> Exception thrown: %s", AS_STRING(cls->fields[0]));
     printf("\nat: PC(%d), SP(%d), FP(%d)\n", vm->pc, vm->sp, vm->fp);
 
+    vm->exception = NULL_VAL;
     vm_clear(vm);
     vm->pc = vm->errjmp;
 }
 
+// Throws an exception, that is never caught
+void vm_throw(vm_t* vm, const char* format, ...) {
+    va_list argptr;
+    va_start(argptr, format);
+    vm_raise_args(vm, format, argptr);
+    va_end(argptr);
+    vm_uncaught(vm);
+}
+
+// Handler of the instruction at pc, the innermost one comes first
+static handler_t* vm_handler(bytecode_t* bytecode, int pc) {
+    for(int i = 0; i < bytecode->handlerCount; i++) {
+        handler_t* handler = &bytecode->handlers[i];
+        if(pc >= handler->start && pc < handler->end) return handler;
+    }
+    return 0;
+}
+
+/**
+ * vm_unwind:
+ * Searches the handler of the thrown exception in the handler table,
+ * for the instruction before vm->pc and then for the calls of every frame.
+ * The frames above the handler are removed, the VM continues at the handler.
+ * Returns false if there is none, the VM is left unchanged then.
+ */
+bool vm_unwind(vm_t* vm, bytecode_t* bytecode) {
+    int pc = vm->pc - 1;
+    for(int depth = vm->depth; depth >= 0; depth--) {
+        handler_t* handler = vm_handler(bytecode, pc);
+        if(handler) {
+            while(vm->depth > depth) {
+                frame_t* frame = &vm->frames[vm->depth--];
+                if(frame->level) vm->display[frame->level] = frame->saved;
+                vm->fp = frame->fp;
+            }
+            vm->pc = handler->pc;
+            vm->sp = vm->fp + handler->depth;
+            return true;
+        }
+        pc = vm->frames[depth].pc - 1;
+    }
+    return false;
+}
+
 void mark(val_t v) {
     if(IS_OBJ(v)) {
         obj_t* obj = AS_OBJ(v);
-        if(!obj->marked) {
+        if(!obj->marked && !obj->permanent) {
             obj->marked = 1;
 
             switch(obj->type) {
@@ -116,6 +243,7 @@ void markAll(vm_t* vm) {
     for(int i = 0; i < vm->sp; i++) {
         mark(vm->stack[i]);
     }
+    mark(vm->exception);
 }
 
 void sweep(vm_t* vm) {
@@ -154,8 +282,51 @@ void vm_gc(vm_t* vm) {
 #endif
 }
 
+// Allocates the stack and the frames,
+// which may grow up to stackLimit slots / frames
+void vm_init(vm_t* vm, int stackLimit) {
+    memset(vm, 0, sizeof(vm_t));
+    vm->slots = malloc(sizeof(val_t) * (STACK_SIZE+1));
+    vm->stack = vm->slots + 1;
+    vm->stackSize = STACK_SIZE;
+    vm->stackLimit = stackLimit;
+    vm->frames = malloc(sizeof(frame_t) * FRAME_SIZE);
+    vm->frameSize = FRAME_SIZE;
+    vm->exception = NULL_VAL;
+}
+
+void vm_free(vm_t* vm) {
+    free(vm->slots);
+    free(vm->frames);
+    vm->stack = 0;
+}
+
+// Grows the stack to at least size slots.
+// Returns false if the limit would be exceeded.
+bool vm_grow_stack(vm_t* vm, int size) {
+    if(size > vm->stackLimit) return false;
+
+    int newSize = vm->stackSize;
+    while(newSize < size) newSize *= 2;
+    if(newSize > vm->stackLimit) newSize = vm->stackLimit;
+
+    vm->slots = realloc(vm->slots, sizeof(val_t) * (newSize+1));
+    vm->stack = vm->slots + 1;
+    vm->stackSize = newSize;
+    return true;
+}
+
+// Doubles the number of call frames
+bool vm_grow_frames(vm_t* vm) {
+    if(vm->frameSize >= vm->stackLimit) return false;
+
+    vm->frameSize *= 2;
+    vm->frames = realloc(vm->frames, sizeof(frame_t) * vm->frameSize);
+    return true;
+}
+
 void vm_push(vm_t* vm, val_t val) {
-    if(vm->sp >= STACK_SIZE) {
+    if(vm->sp >= vm->stackSize && !vm_grow_stack(vm, vm->sp + 1)) {
         vm_throw(vm, "Stack overflow");
         return;
     }
@@ -170,6 +341,9 @@ val_t vm_pop(vm_t* vm) {
 void val_append(vm_t* vm, val_t v1);
 
 void obj_append(vm_t* vm, obj_t* obj) {
+    // Constants are owned by the bytecode
+    if(obj->permanent) return;
+
     if(vm->numObjects >= vm->maxObjects) {
         vm_gc(vm);
     }
@@ -206,6 +380,12 @@ void val_append(vm_t* vm, val_t v1) {
     }
 }
 
+// Calls the internal function at index,
+// the arguments are on top of the stack
+void vm_syscall(vm_t* vm, int index) {
+    system_methods[index](vm);
+}
+
 // Push and register in GC, if v1 is a ptr
 void vm_register(vm_t* vm, val_t v1) {
     vm_push(vm, v1);
@@ -213,39 +393,25 @@ void vm_register(vm_t* vm, val_t v1) {
 }
 
 // Just prints out instruction codes
-void vm_print_code(vm_t* vm, vector_t* buffer) {
+void vm_print_code(vm_t* vm, bytecode_t* bytecode) {
     vm->pc = 0;
     printf("\nImmediate code:\n");
 
-    instruction_t* instr = vector_get(buffer, vm->pc);
+    code_t* instr = &bytecode->code[vm->pc];
     while(instr->op != OP_HLT) {
-        printf("  %.2d: %s", vm->pc, op2str(instr->op));
-        if(instr->v1 != NULL_VAL) {
-            printf(", ");
-            val_print(instr->v1);
-        }
-        if(instr->v2 != NULL_VAL) {
-            printf(", ");
-            val_print(instr->v2);
-        }
+        printf("  %.2d: ", vm->pc);
+        code_print(instr);
         putchar('\n');
 
         vm->pc++;
-        instr = vector_get(buffer, vm->pc);
+        instr = &bytecode->code[vm->pc];
     }
     vm->pc = 0;
 }
 
-void vm_trace_print(vm_t* vm, instruction_t* instr) {
-    printf("  %.2d (SP:%.2d, FP:%.2d): %s", vm->pc, vm->sp, vm->fp, op2str(instr->op));
-    if(instr->v1 != NULL_VAL) {
-        printf(", ");
-        val_print(instr->v1);
-    }
-    if(instr->v2 != NULL_VAL) {
-        printf(", ");
-        val_print(instr->v2);
-    }
+void vm_trace_print(vm_t* vm, code_t* instr) {
+    printf("  %.2d (SP:%.2d, FP:%.2d): ", vm->pc, vm->sp, vm->fp);
+    code_print(instr);
     printf(" => STACK [");
 
     //int begin = vm->sp - 8;
@@ -270,7 +436,7 @@ void vm_trace_print(vm_t* vm, instruction_t* instr) {
 // Fast, optimized version for vm_register.
 // Use if value needs to be copied and pushed onto the stack.
 void vm_copy(vm_t* vm, val_t val) {
-    if(IS_OBJ(val)) {
+    if(IS_OBJ(val) && !IS_PERMANENT(val)) {
         obj_t* obj = AS_OBJ(val);
         obj_t* newObj = COPY_OBJ(obj);
 
@@ -282,7 +448,7 @@ void vm_copy(vm_t* vm, val_t val) {
 }
 
 // Processes a buffer instruction based on instruction / program counter (pc).
-void vm_exec(vm_t* vm, vector_t* buffer) {
+void vm_exec(vm_t* vm, bytecode_t* bytecode) {
     static void* dispatch_table[] = {
         &&code_hlt,
         &&code_push,
@@ -346,269 +512,533 @@ void vm_exec(vm_t* vm, vector_t* buffer) {
         &&code_len,
         &&code_append,
         &&code_cons,
+        &&code_sgetsub,
+        &&code_ssetsub,
+        &&code_slen,
+        &&code_sappend,
+        &&code_scons,
         &&code_upval,
         &&code_upstore,
         &&code_class,
         &&code_setfield,
-        &&code_getfield
+        &&code_getfield,
+        &&code_iaddlk,
+        &&code_isublk,
+        &&code_iltlk,
+        &&code_load2,
+        &&code_ldfield,
+        &&code_storejmp,
+        &&code_jieq,
+        &&code_jine,
+        &&code_jilt,
+        &&code_jigt,
+        &&code_jile,
+        &&code_jige,
+        &&code_jfeq,
+        &&code_jfne,
+        &&code_jflt,
+        &&code_jfgt,
+        &&code_jfle,
+        &&code_jfge,
+        &&code_jieqk,
+        &&code_jinek,
+        &&code_jiltk,
+        &&code_jigtk,
+        &&code_jilek,
+        &&code_jigek,
+        &&code_incl,
+        &&code_ginc,
+        &&code_addl,
+        &&code_jieqlk,
+        &&code_jinelk,
+        &&code_jiltlk,
+        &&code_jigtlk,
+        &&code_jilelk,
+        &&code_jigelk,
+        &&code_tailcall,
+        &&code_enter,
+        &&code_borrow,
+        &&code_gborrow,
+        &&code_borrow0,
+        &&code_stfield,
+        &&code_catch,
+        &&code_retvoid,
+        &&code_forl,
+        &&code_forin,
+        &&code_switch,
+        &&code_case,
+        &&code_pushk
     };
 
+    // Export the handlers, if there is nothing to execute
+    if(!bytecode) {
+        handlers = dispatch_table;
+        handler_count = sizeof(dispatch_table) / sizeof(dispatch_table[0]);
+        return;
+    }
+
     // Set the jmp position if an error occurs
-    vm->errjmp = vector_size(buffer)-1;
+    vm->errjmp = bytecode->size-1;
 
     // Create the tmp instruction
-    instruction_t* instr = 0;
+    code_t* code = bytecode->code;
+    code_t* instr = 0;
+    const val_t* constants = bytecode->constants;
+
+    // Stack space is checked once per frame, for the maximum depth
+    // of the function (see bytecode_depths). Pushes are unchecked.
+    const int* maxDepth = bytecode->frame;
+#ifndef NO_TIER
+    // Calls and back edges count down to the second tier (see tier.h)
+    int* hot = vm->tier->hot;
+    const int* owner = vm->tier->verifier->func;
+#endif
+    if(vm->sp + maxDepth[vm->pc] > vm->stackSize && !vm_grow_stack(vm, vm->sp + maxDepth[vm->pc])) {
+        vm_throw(vm, "Stack overflow");
+        return;
+    }
+
+    // Cached registers.
+    // pc, sp, fp and the current call frame are kept in locals,
+    // the top of the stack in tos.
+    // stack[sp-1] in memory may be stale, every slot below it is valid.
+    // The compiled code never modifies locals through the top of the stack,
+    // so slots are read directly. A write to a slot may hit stack[sp-1],
+    // so the top is spilled (or popped) before and filled afterwards.
+    // The registers are written back to vm_t by SAVE() before anything
+    // else can see the stack: syscalls, the GC and exceptions.
+    // Stack and frames may be moved when they grow (or by a syscall),
+    // the pointers are reloaded afterwards.
+    int pc = vm->pc;
+    int sp = vm->sp;
+    int fp = vm->fp;
+    frame_t* frame = &vm->frames[vm->depth];
+    val_t* stack = vm->stack;
+    val_t tos = stack[sp-1];
+
+    #define SPILL() stack[sp-1] = tos
+    #define FILL() tos = stack[sp-1]
+    #define SYNC() SPILL(); vm->sp = sp
+    #define SAVE() SYNC(); vm->pc = pc; vm->fp = fp; vm->depth = frame - vm->frames
+    #define RELOAD() stack = vm->stack; frame = &vm->frames[vm->depth]
+    #define RESTORE() pc = vm->pc; sp = vm->sp; fp = vm->fp; RELOAD(); FILL()
+
+    // Grows the stack to hold a frame of size slots at base
+    #define ENTER(base, size) \
+        if((base) + (size) > vm->stackSize) { \
+            SAVE(); \
+            if(!vm_grow_stack(vm, (base) + (size))) goto stack_overflow; \
+            RELOAD(); \
+        }
 
-#ifndef TRACE
-    #define FETCH() instr = buffer->data[vm->pc++]
+    #define PUSH(v) { \
+        val_t pushed = (v); \
+        SPILL(); \
+        tos = pushed; \
+        sp++; \
+    }
+    #define POP() ({ val_t popped = tos; sp--; FILL(); popped; })
+
+    // vm_copy / vm_register
+    #define COPY(v) { \
+        val_t copied = (v); \
+        if(IS_OBJ(copied) && !IS_PERMANENT(copied)) { \
+            obj_t* newObj = COPY_OBJ(AS_OBJ(copied)); \
+            PUSH(OBJ_VAL(newObj)); \
+            SYNC(); \
+            obj_append(vm, newObj); \
+        } else { \
+            PUSH(copied); \
+        } \
+    }
+    #define REGISTER(v) { \
+        val_t registered = (v); \
+        PUSH(registered); \
+        SYNC(); \
+        val_append(vm, registered); \
+    }
+
+    // Re-optimizes the function at entry, the code may move.
+    // The current instruction (pc-1) is kept.
+#ifndef NO_TIER
+#ifndef NO_THREADED
+    #define RETHREAD() vm_thread(bytecode)
 #else
-    #define FETCH() instr = buffer->data[vm->pc++]; \
+    #define RETHREAD()
+#endif
+    #define TIER_UP(entry) do { \
+        if(tier_up(vm->tier, bytecode, entry)) { \
+            RETHREAD(); \
+            code = bytecode->code; \
+            maxDepth = bytecode->frame; \
+            hot = vm->tier->hot; \
+            owner = vm->tier->verifier->func; \
+            instr = &code[pc-1]; \
+        } \
+    } while(0)
+    #define TIER_LOOP() do { \
+        if(--hot[owner[pc-1]] == 0) TIER_UP(owner[pc-1]); \
+    } while(0)
+#else
+    #define TIER_LOOP() do {} while(0)
+#endif
+
+#if defined(PROFILE)
+    #define FETCH() op_pairs[instr ? instr->op : 0][code[pc].op]++; \
+        instr = &code[pc++]
+#elif !defined(TRACE)
+    #define FETCH() instr = &code[pc++]
+#else
+    #define FETCH() instr = &code[pc++]; \
+        SAVE(); \
         vm_trace_print(vm, instr)
 #endif
 
     // DISPATCH -> jump to pc and increment pc afterwards
+#ifndef NO_THREADED
+    #define DISPATCH() \
+        FETCH(); \
+        goto *instr->handler
+#else
     #define DISPATCH() \
         FETCH(); \
         goto *dispatch_table[instr->op]
+#endif
 
     // Dispatch and run
     DISPATCH();
-    code_hlt: return;
+    stack_overflow: {
+        SAVE();
+        vm_raise(vm, "Stack overflow");
+        goto exception;
+    }
+    exception: {
+        // Thrown at vm->pc-1, the registers are saved
+        if(!vm_unwind(vm, bytecode)) {
+            vm_uncaught(vm);
+            return;
+        }
+        RESTORE();
+        DISPATCH();
+    }
+    code_hlt: {
+        SAVE();
+        return;
+    }
     code_push: {
-        vm_copy(vm, instr->v1);
+        COPY(instr->v);
+        DISPATCH();
+    }
+    code_pushk: {
+        // Constants are permanent, no copy
+        PUSH(constants[instr->a]);
         DISPATCH();
     }
     code_pop: {
-        vm_pop(vm);
+        sp--;
+        FILL();
         DISPATCH();
     }
     code_store: {
-        int offset = AS_INT32(instr->v1);
-        vm->stack[vm->fp+offset] = vm_pop(vm);
+        int offset = instr->a;
+        stack[fp+offset] = POP();
+        FILL();
         DISPATCH();
     }
     code_load: {
-        int offset = AS_INT32(instr->v1);
-        vm_copy(vm, vm->stack[vm->fp+offset]);
+        int offset = instr->a;
+        COPY(stack[fp+offset]);
         DISPATCH();
     }
     code_gstore: {
-        int offset = AS_INT32(instr->v1);
-        vm->stack[offset] = vm_pop(vm);
+        int offset = instr->a;
+        stack[offset] = POP();
+        FILL();
         DISPATCH();
     }
     code_gload: {
-        int offset = AS_INT32(instr->v1);
-        vm_copy(vm, vm->stack[offset]);
+        int offset = instr->a;
+        COPY(stack[offset]);
         DISPATCH();
     }
     code_ldarg0: {
-        int args = AS_INT32(vm->stack[vm->fp-3]);
-        vm_copy(vm, vm->stack[vm->fp-args-4]);
+        COPY(stack[frame->receiver]);
         DISPATCH();
     }
     code_setarg0: {
-        int args = AS_INT32(vm->stack[vm->fp-3]);
-        vm->stack[vm->fp-args-4] = vm_pop(vm);
+        stack[frame->receiver] = POP();
+        FILL();
         DISPATCH();
     }
     code_iadd: {
-        int v2 = AS_INT32(vm_pop(vm));
-        int v1 = AS_INT32(vm_pop(vm));
-        vm_push(vm, INT32_VAL(v1 + v2));
+        int v2 = AS_INT32(POP());
+        int v1 = AS_INT32(tos);
+        tos = INT32_VAL(v1 + v2);
         DISPATCH();
     }
     code_isub: {
-        int v2 = AS_INT32(vm_pop(vm));
-        int v1 = AS_INT32(vm_pop(vm));
-        vm_push(vm, INT32_VAL(v1 - v2));
+        int v2 = AS_INT32(POP());
+        int v1 = AS_INT32(tos);
+        tos = INT32_VAL(v1 - v2);
         DISPATCH();
     }
     code_imul: {
-        int v2 = AS_INT32(vm_pop(vm));
-        int v1 = AS_INT32(vm_pop(vm));
-        vm_push(vm, INT32_VAL(v1 * v2));
+        int v2 = AS_INT32(POP());
+        int v1 = AS_INT32(tos);
+        tos = INT32_VAL(v1 * v2);
         DISPATCH();
     }
     code_idiv: {
-        int v2 = AS_INT32(vm_pop(vm));
-        int v1 = AS_INT32(vm_pop(vm));
-        vm_push(vm, INT32_VAL(v1 / v2));
+        VM_ASSERT(AS_INT32(tos) != 0, "Division by zero");
+        int v2 = AS_INT32(POP());
+        int v1 = AS_INT32(tos);
+        tos = INT32_VAL(v1 / v2);
         DISPATCH();
     }
     code_mod: {
-        int v2 = AS_INT32(vm_pop(vm));
-        int v1 = AS_INT32(vm_pop(vm));
-        vm_push(vm, INT32_VAL(v1 % v2));
+        VM_ASSERT(AS_INT32(tos) != 0, "Division by zero");
+        int v2 = AS_INT32(POP());
+        int v1 = AS_INT32(tos);
+        tos = INT32_VAL(v1 % v2);
         DISPATCH();
     }
     code_bitl: {
-        int v2 = AS_INT32(vm_pop(vm));
-        int v1 = AS_INT32(vm_pop(vm));
-        vm_push(vm, INT32_VAL(v1 << v2));
+        int v2 = AS_INT32(POP());
+        int v1 = AS_INT32(tos);
+        tos = INT32_VAL(v1 << v2);
         DISPATCH();
     }
     code_bitr: {
-        int v2 = AS_INT32(vm_pop(vm));
-        int v1 = AS_INT32(vm_pop(vm));
-        vm_push(vm, INT32_VAL(v1 >> v2));
+        int v2 = AS_INT32(POP());
+        int v1 = AS_INT32(tos);
+        tos = INT32_VAL(v1 >> v2);
         DISPATCH();
     }
     code_bitand: {
-        int v2 = AS_INT32(vm_pop(vm));
-        int v1 = AS_INT32(vm_pop(vm));
-        vm_push(vm, INT32_VAL(v1 & v2));
+        int v2 = AS_INT32(POP());
+        int v1 = AS_INT32(tos);
+        tos = INT32_VAL(v1 & v2);
         DISPATCH();
     }
     code_bitor: {
-        int v2 = AS_INT32(vm_pop(vm));
-        int v1 = AS_INT32(vm_pop(vm));
-        vm_push(vm, INT32_VAL(v1 | v2));
+        int v2 = AS_INT32(POP());
+        int v1 = AS_INT32(tos);
+        tos = INT32_VAL(v1 | v2);
         DISPATCH();
     }
     code_bitxor: {
-        int v2 = AS_INT32(vm_pop(vm));
-        int v1 = AS_INT32(vm_pop(vm));
-        vm_push(vm, INT32_VAL(v1 ^ v2));
+        int v2 = AS_INT32(POP());
+        int v1 = AS_INT32(tos);
+        tos = INT32_VAL(v1 ^ v2);
         DISPATCH();
     }
     code_bitnot: {
-        int v1 = AS_INT32(vm_pop(vm));
-        vm_push(vm, INT32_VAL(~v1));
+        int v1 = AS_INT32(tos);
+        tos = INT32_VAL(~v1);
         DISPATCH();
     }
     code_iminus: {
-        int v1 = AS_INT32(vm_pop(vm));
-        vm_push(vm, INT32_VAL(-v1));
+        int v1 = AS_INT32(tos);
+        tos = INT32_VAL(-v1);
         DISPATCH();
     }
     code_i2f: {
-        int v1 = AS_INT32(vm_pop(vm));
-        vm_push(vm, NUM_VAL(v1));
+        int v1 = AS_INT32(tos);
+        tos = NUM_VAL(v1);
         DISPATCH();
     }
     code_fadd: {
-        double v2 = AS_NUM(vm_pop(vm));
-        double v1 = AS_NUM(vm_pop(vm));
-        vm_push(vm, NUM_VAL(v1 + v2));
+        double v2 = AS_NUM(POP());
+        double v1 = AS_NUM(tos);
+        tos = NUM_VAL(v1 + v2);
         DISPATCH();
     }
     code_fsub: {
-        double v2 = AS_NUM(vm_pop(vm));
-        double v1 = AS_NUM(vm_pop(vm));
-        vm_push(vm, NUM_VAL(v1 - v2));
+        double v2 = AS_NUM(POP());
+        double v1 = AS_NUM(tos);
+        tos = NUM_VAL(v1 - v2);
         DISPATCH();
     }
     code_fmul: {
-        double v2 = AS_NUM(vm_pop(vm));
-        double v1 = AS_NUM(vm_pop(vm));
-        vm_push(vm, NUM_VAL(v1 * v2));
+        double v2 = AS_NUM(POP());
+        double v1 = AS_NUM(tos);
+        tos = NUM_VAL(v1 * v2);
         DISPATCH();
     }
     code_fdiv: {
-        double v2 = AS_NUM(vm_pop(vm));
-        double v1 = AS_NUM(vm_pop(vm));
-        vm_push(vm, NUM_VAL(v1 / v2));
+        double v2 = AS_NUM(POP());
+        double v1 = AS_NUM(tos);
+        tos = NUM_VAL(v1 / v2);
         DISPATCH();
     }
     code_fminus: {
-        double v1 = AS_NUM(vm_pop(vm));
-        vm_push(vm, NUM_VAL(-v1));
+        double v1 = AS_NUM(tos);
+        tos = NUM_VAL(-v1);
         DISPATCH();
     }
     code_f2i: {
-        double v1 = AS_NUM(vm_pop(vm));
-        vm_push(vm, INT32_VAL((int)v1));
+        double v1 = AS_NUM(tos);
+        tos = INT32_VAL((int)v1);
         DISPATCH();
     }
     code_not: {
-        bool b = AS_BOOL(vm_pop(vm));
-        vm_push(vm, BOOL_VAL(!b));
+        bool b = AS_BOOL(tos);
+        tos = BOOL_VAL(!b);
         DISPATCH();
     }
     code_b2i: {
-        bool b = AS_BOOL(vm_pop(vm));
-        vm_push(vm, INT32_VAL(b));
+        bool b = AS_BOOL(tos);
+        tos = INT32_VAL(b);
         DISPATCH();
     }
     code_syscall: {
-        int index = AS_INT32(instr->v1);
+        int index = instr->a;
+        SAVE();
         system_methods[index](vm);
+        RESTORE();
         DISPATCH();
     }
     code_invoke: {
         // Arguments already on the stack
-        int address = AS_INT32(instr->v1);
-        int args = AS_INT32(instr->v2);
-
-        // Arg0 -3
-        // Arg1 -2
-        // Arg2 -1
-        // sp (args=3)
-        // ...  +1
-        // ...  +2
-
-        vm_push(vm, INT32_VAL(args));
-        vm_push(vm, INT32_VAL(vm->fp));
-        vm_push(vm, INT32_VAL(vm->pc));
+        int address = instr->a;
+        int args = CALL_ARGS(instr->b);
 
         // |   STACK_BOTTOM      |
         // |...                  |
-        // |Arg0               -7|
-        // |Arg1               -6|
-        // |Arg2               -5|
-        // |...                -4|
-        // |NUM_ARGS           -3|
-        // |FP                 -2|    <-- vm->fp - 2
-        // |PC                 -1|
+        // |Class / ...        -4|    <-- receiver
+        // |Arg0               -3|
+        // |Arg1               -2|
+        // |Arg2               -1|
         // |...                 0|    <-- current position sp / fp
         // |...                +1|
         // |    STACK_TOP        |
 
-        vm->fp = vm->sp;
-        vm->pc = address;
+#ifndef NO_TIER
+        if(--hot[address] == 0) {
+            TIER_UP(address);
+            address = instr->a;
+        }
+#endif
+        ENTER(sp, maxDepth[address]);
+        if(frame == &vm->frames[vm->frameSize-1]) {
+            SAVE();
+            if(!vm_grow_frames(vm)) goto stack_overflow;
+            RELOAD();
+        }
+
+#ifdef JIT
+        // Hot functions run as native code, the result replaces the arguments
+        if(vm->jit && jit_hot(vm->jit, address)) {
+            val_t ret;
+            SAVE();
+            if(!jit_call(vm->jit, vm, address, sp, &ret)) {
+                // Caught at the call, unless the VM was reset by vm_throw
+                if(vm->exception != NULL_VAL) {
+                    RELOAD();
+                    SAVE();
+                    goto exception;
+                }
+                RESTORE();
+                DISPATCH();
+            }
+            RELOAD();
+            if(instr->b & CALL_VOID) {
+                sp -= args;
+                FILL();
+                DISPATCH();
+            }
+            sp -= args - 1;
+            tos = ret;
+            DISPATCH();
+        }
+#endif
+        frame++;
+        frame->pc = pc;
+        frame->fp = fp;
+        frame->receiver = sp - args - 1;
+        frame->keep = false;
+        frame->level = 0;
+
+        // The arguments are read from memory
+        SPILL();
+        fp = sp;
+        pc = address;
         DISPATCH();
     }
     code_reserve: {
-        vm->sp += AS_INT32(instr->v1);
+        SPILL();
+        sp += instr->a;
+        FILL();
         DISPATCH();
     }
     code_ret: {
         // Returns to previous instruction pointer,
         // and pushes the return value back on the stack.
         // If you call this function make sure there is a return value on the stack.
-        val_t ret = vm_pop(vm);
-
-        vm->sp = vm->fp;
-        vm->pc = AS_INT32(vm_pop(vm));
-        vm->fp = AS_INT32(vm_pop(vm));
-        vm->sp -= AS_INT32(vm_pop(vm));
+        val_t ret = tos;
+        sp = frame->receiver + 1;
+        pc = frame->pc;
+        fp = frame->fp;
+        if(frame->level) vm->display[frame->level] = frame->saved;
+
+        // Tail called from a class method (see tailcall),
+        // return the class of the method as well
+        if(frame->keep) {
+            val_t clazz = stack[sp-1];
+            stack[sp-1] = ret;
+            tos = clazz;
+            sp++;
+            frame--;
+            DISPATCH();
+        }
+        frame--;
 
-        vm_push(vm, ret);
+        // Push the return value
+        tos = ret;
+        sp++;
         DISPATCH();
     }
     code_retvirtual: {
         // Returns from a virtual class function
-        val_t ret = vm_pop(vm);
-
-        vm->sp = vm->fp;
-        vm->pc = AS_INT32(vm_pop(vm));
-        vm->fp = AS_INT32(vm_pop(vm));
-        vm->sp -= AS_INT32(vm_pop(vm));
-        val_t clazz = vm_pop(vm);
+        val_t ret = tos;
+        sp = frame->receiver + 1;
+        pc = frame->pc;
+        fp = frame->fp;
+        if(frame->level) vm->display[frame->level] = frame->saved;
+
+        // Tail called, the class of the first method is kept below
+        if(frame->keep) {
+            sp--;
+        }
+        frame--;
+        val_t clazz = stack[sp-1];
 
-        vm_push(vm, ret);
-        vm_push(vm, clazz);
+        stack[sp-1] = ret;
+        tos = clazz;
+        sp++;
+        DISPATCH();
+    }
+    code_retvoid: {
+        // Returns from a void function, nothing is pushed.
+        // The class of a method stays below the arguments, where the caller expects it.
+        // Void functions are never tail called, so the frame is not kept.
+        sp = frame->receiver + 1;
+        pc = frame->pc;
+        fp = frame->fp;
+        if(frame->level) vm->display[frame->level] = frame->saved;
+        frame--;
+        FILL();
         DISPATCH();
     }
     code_jmp: {
-        vm->pc = AS_INT32(instr->v1);
+        if(instr->a < pc) TIER_LOOP();
+        pc = instr->a;
         DISPATCH();
     }
     code_jmpf: {
-        bool result = AS_BOOL(vm_pop(vm));
+        bool result = AS_BOOL(POP());
         if(!result) {
-            vm->pc = AS_INT32(instr->v1);
+            pc = instr->a;
         }
         DISPATCH();
     }
@@ -616,34 +1046,40 @@ void vm_exec(vm_t* vm, vector_t* buffer) {
         // Reverse list fetching and inserting.
         // Copying is not needed, because array consumes all the objects.
         // The objects already have to be a copy.
-        size_t elsz = AS_INT32(instr->v1);
+        size_t elsz = instr->a;
         val_t* arr = malloc(sizeof(val_t) * elsz);
+        SPILL();
         for(int i = elsz; i > 0; i--) {
             // Get index object
-            val_t val = vm->stack[vm->sp - i];
+            val_t val = stack[sp - i];
             arr[elsz - i] = COPY_VAL(val);        // <-- vm_register causes all sub objects also to be appended, therefore error
-            vm->stack[vm->sp - i] = NULL_VAL;
+            stack[sp - i] = NULL_VAL;
         }
-        vm->sp -= elsz;
+        sp -= elsz;
+        FILL();
 
         obj_t* obj = obj_array_new(arr, elsz);
-        vm_push(vm, OBJ_VAL(obj));
+        PUSH(OBJ_VAL(obj));
+        SYNC();
         obj_append(vm, obj);
         DISPATCH();
     }
     code_str: {
-        size_t elsz = AS_INT32(instr->v1);
+        size_t elsz = instr->a;
         char *str = malloc(sizeof(char) * (elsz+1));
 
+        SPILL();
         for(int i = elsz; i > 0; i--) {
-            val_t val = vm->stack[vm->sp - i];
+            val_t val = stack[sp - i];
             str[elsz - i] = (char)AS_INT32(val);
-            vm->stack[vm->sp - i] = 0;
+            stack[sp - i] = 0;
         }
-        vm->sp -= elsz;
+        sp -= elsz;
+        FILL();
         str[elsz] = '\0';
         obj_t* obj = obj_string_nocopy_new(str);
-        vm_push(vm, OBJ_VAL(obj));
+        PUSH(OBJ_VAL(obj));
+        SYNC();
         obj_append(vm, obj);
         DISPATCH();
     }
@@ -653,7 +1089,7 @@ void vm_exec(vm_t* vm, vector_t* buffer) {
         // 1. Test if library is loaded
         // 2. Load library into hashtable
 
-        /*char* path = AS_STRING(instr->v1);
+        /*char* path = AS_STRING(instr->v);
          shared_lib* lib = hashmap_find(vm->libraries, path);
         if(!lib) {
             shared_lib* lib = calloc(1, sizeof(shared_lib));
@@ -666,105 +1102,105 @@ void vm_exec(vm_t* vm, vector_t* buffer) {
         DISPATCH();
     }
     code_tostr: {
-        val_t val = vm_pop(vm);
+        val_t val = POP();
         char* str = val_tostr(val);
-        vm_register(vm, STRING_NOCOPY_VAL(str));
+        REGISTER(STRING_NOCOPY_VAL(str));
         DISPATCH();
     }
     code_beq: {
-        bool b2 = AS_BOOL(vm_pop(vm));
-        bool b1 = AS_BOOL(vm_pop(vm));
-        vm_push(vm, BOOL_VAL(b1 == b2));
+        bool b2 = AS_BOOL(POP());
+        bool b1 = AS_BOOL(tos);
+        tos = BOOL_VAL(b1 == b2);
         DISPATCH();
     }
     code_ieq: {
-        int v2 = AS_INT32(vm_pop(vm));
-        int v1 = AS_INT32(vm_pop(vm));
-        vm_push(vm, BOOL_VAL(v1 == v2));
+        int v2 = AS_INT32(POP());
+        int v1 = AS_INT32(tos);
+        tos = BOOL_VAL(v1 == v2);
         DISPATCH();
     }
     code_feq: {
-        double v2 = AS_NUM(vm_pop(vm));
-        double v1 = AS_NUM(vm_pop(vm));
-        vm_push(vm, BOOL_VAL(v1 == v2));
+        double v2 = AS_NUM(POP());
+        double v1 = AS_NUM(tos);
+        tos = BOOL_VAL(v1 == v2);
         DISPATCH();
     }
     code_bne: {
-        bool b2 = AS_BOOL(vm_pop(vm));
-        bool b1 = AS_BOOL(vm_pop(vm));
-        vm_push(vm, BOOL_VAL(b1 != b2));
+        bool b2 = AS_BOOL(POP());
+        bool b1 = AS_BOOL(tos);
+        tos = BOOL_VAL(b1 != b2);
         DISPATCH();
     }
     code_ine: {
-        int v2 = AS_INT32(vm_pop(vm));
-        int v1 = AS_INT32(vm_pop(vm));
-        vm_push(vm, BOOL_VAL(v1 != v2));
+        int v2 = AS_INT32(POP());
+        int v1 = AS_INT32(tos);
+        tos = BOOL_VAL(v1 != v2);
         DISPATCH();
     }
     code_fne: {
-        double v2 = AS_NUM(vm_pop(vm));
-        double v1 = AS_NUM(vm_pop(vm));
-        vm_push(vm, BOOL_VAL(v1 != v2));
+        double v2 = AS_NUM(POP());
+        double v1 = AS_NUM(tos);
+        tos = BOOL_VAL(v1 != v2);
         DISPATCH();
     }
     code_ilt: {
-        int v2 = AS_INT32(vm_pop(vm));
-        int v1 = AS_INT32(vm_pop(vm));
-        vm_push(vm, BOOL_VAL(v1 < v2));
+        int v2 = AS_INT32(POP());
+        int v1 = AS_INT32(tos);
+        tos = BOOL_VAL(v1 < v2);
         DISPATCH();
     }
     code_igt: {
-        int v2 = AS_INT32(vm_pop(vm));
-        int v1 = AS_INT32(vm_pop(vm));
-        vm_push(vm, BOOL_VAL(v1 > v2));
+        int v2 = AS_INT32(POP());
+        int v1 = AS_INT32(tos);
+        tos = BOOL_VAL(v1 > v2);
         DISPATCH();
     }
     code_ile: {
-        int v2 = AS_INT32(vm_pop(vm));
-        int v1 = AS_INT32(vm_pop(vm));
-        vm_push(vm, BOOL_VAL(v1 <= v2));
+        int v2 = AS_INT32(POP());
+        int v1 = AS_INT32(tos);
+        tos = BOOL_VAL(v1 <= v2);
         DISPATCH();
     }
     code_ige: {
-        int v2 = AS_INT32(vm_pop(vm));
-        int v1 = AS_INT32(vm_pop(vm));
-        vm_push(vm, BOOL_VAL(v1 >= v2));
+        int v2 = AS_INT32(POP());
+        int v1 = AS_INT32(tos);
+        tos = BOOL_VAL(v1 >= v2);
         DISPATCH();
     }
     code_flt: {
-        double v2 = AS_NUM(vm_pop(vm));
-        double v1 = AS_NUM(vm_pop(vm));
-        vm_push(vm, BOOL_VAL(v1 < v2));
+        double v2 = AS_NUM(POP());
+        double v1 = AS_NUM(tos);
+        tos = BOOL_VAL(v1 < v2);
         DISPATCH();
     }
     code_fgt: {
-        double v2 = AS_NUM(vm_pop(vm));
-        double v1 = AS_NUM(vm_pop(vm));
-        vm_push(vm, BOOL_VAL(v1 > v2));
+        double v2 = AS_NUM(POP());
+        double v1 = AS_NUM(tos);
+        tos = BOOL_VAL(v1 > v2);
         DISPATCH();
     }
     code_fle: {
-        double v2 = AS_NUM(vm_pop(vm));
-        double v1 = AS_NUM(vm_pop(vm));
-        vm_push(vm, BOOL_VAL(v1 <= v2));
+        double v2 = AS_NUM(POP());
+        double v1 = AS_NUM(tos);
+        tos = BOOL_VAL(v1 <= v2);
         DISPATCH();
     }
     code_fge: {
-        double v2 = AS_NUM(vm_pop(vm));
-        double v1 = AS_NUM(vm_pop(vm));
-        vm_push(vm, BOOL_VAL(v1 >= v2));
+        double v2 = AS_NUM(POP());
+        double v1 = AS_NUM(tos);
+        tos = BOOL_VAL(v1 >= v2);
         DISPATCH();
     }
     code_band: {
-        bool b2 = AS_BOOL(vm_pop(vm));
-        bool b1 = AS_BOOL(vm_pop(vm));
-        vm_push(vm, BOOL_VAL(b1 && b2));
+        bool b2 = AS_BOOL(POP());
+        bool b1 = AS_BOOL(tos);
+        tos = BOOL_VAL(b1 && b2);
         DISPATCH();
     }
     code_bor: {
-        bool b2 = AS_BOOL(vm_pop(vm));
-        bool b1 = AS_BOOL(vm_pop(vm));
-        vm_push(vm, BOOL_VAL(b1 || b2));
+        bool b2 = AS_BOOL(POP());
+        bool b1 = AS_BOOL(tos);
+        tos = BOOL_VAL(b1 || b2);
         DISPATCH();
     }
     code_getsub: {
@@ -772,19 +1208,13 @@ void vm_exec(vm_t* vm, vector_t* buffer) {
         // | object |
         // | key     |
         // | getsub |
-        val_t key = vm_pop(vm);
-        val_t obj = vm_pop(vm);
+        val_t key = POP();
+        val_t obj = POP();
         int idx = AS_INT32(key);
 
-        if(IS_STRING(obj)) {
-            char* str = AS_STRING(obj);
-            // VM_ASSERT(idx >= 0 && idx < strlen(str), "Array index out of bounds");
-            vm_push(vm, INT32_VAL(str[idx]));
-        } else {
-            obj_array_t* arr = AS_ARRAY(obj);
-            // VM_ASSERT(idx >= 0 && idx < arr->len, "Array index out of bounds");
-            vm_copy(vm, arr->data[idx]);
-        }
+        obj_array_t* arr = AS_ARRAY(obj);
+        VM_ASSERT(IN_ARRAY(arr, idx), "Index out of bounds");
+        COPY(arr->data[idx]);
         DISPATCH();
     }
     code_setsub: {
@@ -793,164 +1223,147 @@ void vm_exec(vm_t* vm, vector_t* buffer) {
         // | object  |
         // | key     |
         // | setsub  |
-        val_t key = vm_pop(vm);
-        val_t obj = vm_pop(vm);
-        val_t val = vm_pop(vm);
+        val_t key = POP();
+        val_t obj = POP();
+        val_t val = POP();
         int idx = AS_INT32(key);
+        VM_ASSERT(IN_ARRAY(AS_ARRAY(obj), idx), "Index out of bounds");
 
-        if(IS_STRING(obj)) {
-            obj = COPY_VAL(obj);
-            char* data = AS_STRING(obj);
-            // VM_ASSERT(idx >= 0 && idx < strlen(data), "Array index out of bounds");
-            data[idx] = (char)AS_INT32(val);
-            vm_register(vm, obj);
-        }
-        else {
-            // Copy the whole array
-            // Upload the new array
-            obj = COPY_VAL(obj);
-
-            // Free the copied object at index
-            obj_array_t* arr = AS_ARRAY(obj);
-            val_free(arr->data[idx]);
+        // Copy the whole array
+        // Upload the new array
+        obj = COPY_VAL(obj);
 
-            // Try to replace it
-            // VM_ASSERT(idx >= 0 && idx < arr->len, "Array index out of bounds");
-            arr->data[idx] = val;
-            vm_register(vm, obj);
-        }
+        // Free the copied object at index and replace it
+        obj_array_t* arr = AS_ARRAY(obj);
+        val_free(arr->data[idx]);
+        arr->data[idx] = val;
+        REGISTER(obj);
         DISPATCH();
     }
     code_len: {
-        val_t obj = vm_pop(vm);
-
-        if(IS_STRING(obj)) {
-            char* data = AS_STRING(obj);
-            vm_push(vm, INT32_VAL(strlen(data)));
-        } else {
-            obj_array_t* arr = AS_ARRAY(obj);
-            vm_push(vm, INT32_VAL(arr->len));
-        }
+        obj_array_t* arr = AS_ARRAY(tos);
+        tos = INT32_VAL(arr->len);
         DISPATCH();
     }
     code_append: {
-        val_t val = vm_pop(vm);
-        val_t obj = vm_pop(vm);
-
-        if(IS_STRING(obj)) {
-            // Simple string concatenation
-            char* str1 = AS_STRING(obj);
-            char* str2 = AS_STRING(val);
-            size_t len = strlen(str1) + strlen(str2) + 1;
-            char* data = malloc(sizeof(char) * len);
-            data[0] = '\0';
-            strcat(data, str1);
-            strcat(data, str2);
-
-            obj_t* obj_ptr = obj_string_nocopy_new(data);
-            vm_push(vm, OBJ_VAL(obj_ptr));
-            obj_append(vm, obj_ptr);
-        } else {
-            // Allocate a new val_t array
-            // Upload it into a obj_t form
-            // register it / push it to the stack
-            obj_array_t* arr1 = AS_ARRAY(obj);
-            obj_array_t* arr2 = AS_ARRAY(val);
-
-            size_t len = arr1->len + arr2->len;
-            val_t* arr3 = malloc(sizeof(val_t) * len);
-
-            size_t i;
-            for(i = 0; i < arr1->len; i++) {
-                arr3[i] = val_copy(arr1->data[i]);
-            }
-            for(i = 0; i < arr2->len; i++) {
-                arr3[i+arr1->len] = val_copy(arr2->data[i]);
-            }
-
-            obj_t* newObj = obj_array_new(arr3, len);
-            vm_push(vm, OBJ_VAL(newObj));
-            obj_append(vm, newObj);
+        // Allocate a new val_t array
+        // Upload it into a obj_t form
+        // register it / push it to the stack
+        val_t val = POP();
+        val_t obj = POP();
+        obj_array_t* arr1 = AS_ARRAY(obj);
+        obj_array_t* arr2 = AS_ARRAY(val);
+
+        size_t len = arr1->len + arr2->len;
+        val_t* arr3 = malloc(sizeof(val_t) * len);
+
+        size_t i;
+        for(i = 0; i < arr1->len; i++) {
+            arr3[i] = val_copy(arr1->data[i]);
+        }
+        for(i = 0; i < arr2->len; i++) {
+            arr3[i+arr1->len] = val_copy(arr2->data[i]);
         }
+
+        obj_t* newObj = obj_array_new(arr3, len);
+        PUSH(OBJ_VAL(newObj));
+        SYNC();
+        obj_append(vm, newObj);
         DISPATCH();
     }
     code_cons: {
         // Construct a new value on top
-        val_t val = vm_pop(vm);
-        val_t obj = vm_pop(vm);
+        val_t val = POP();
+        val_t obj = POP();
 
-        if(IS_STRING(obj)) {
-            // Allocate len + 2 => one for the char and one for the trailing zero
-            char* str = AS_STRING(obj);
-            size_t len = strlen(str);
-            char c = (char)AS_INT32(val);
-            char* newStr = malloc(sizeof(char) * (len+2));
-            strcpy(newStr, str);
-            newStr[len] = c;
-            newStr[len+1] = '\0';
+        // Copy the whole array
+        obj = COPY_VAL(obj);
 
-            obj_t* obj_ptr = obj_string_nocopy_new(newStr);
-            vm_push(vm, OBJ_VAL(obj_ptr));
-            obj_append(vm, obj_ptr);
-        } else {
-            // Copy the whole array
-            obj = COPY_VAL(obj);
+        // Get the information
+        obj_array_t* arr = AS_ARRAY(obj);
+        arr->len += 1;
+        size_t allocSz = sizeof(val_t) * arr->len;
 
-            // Get the information
-            obj_array_t* arr = AS_ARRAY(obj);
-            arr->len += 1;
-            size_t allocSz = sizeof(val_t) * arr->len;
+        // Reallocate and assign its content
+        arr->data = (arr->len == 1) ? malloc(allocSz) : realloc(arr->data, allocSz);
+        arr->data[arr->len-1] = COPY_VAL(val);
 
-            // Reallocate and assign its content
-            arr->data = (arr->len == 1) ? malloc(allocSz) : realloc(arr->data, allocSz);
-            arr->data[arr->len-1] = COPY_VAL(val);
-
-            //vm_register(vm, obj);
-            vm_push(vm, obj);
-            obj_append(vm, AS_OBJ(obj));
-        }
+        //vm_register(vm, obj);
+        PUSH(obj);
+        SYNC();
+        obj_append(vm, AS_OBJ(obj));
         DISPATCH();
     }
-    code_upval: {
-        int scopes = AS_INT32(instr->v1);
-        int offset = AS_INT32(instr->v2);
-        int fp = vm->fp;
-        int sp = vm->sp;
+    code_sgetsub: {
+        int idx = AS_INT32(POP());
+        char* str = AS_STRING(tos);
+        VM_ASSERT(IN_STRING(str, idx), "Index out of bounds");
+        tos = INT32_VAL(str[idx]);
+        DISPATCH();
+    }
+    code_ssetsub: {
+        int idx = AS_INT32(POP());
+        val_t obj = POP();
+        val_t val = POP();
+        VM_ASSERT(IN_STRING(AS_STRING(obj), idx), "Index out of bounds");
 
-        for(int i = 0; i < scopes; i++) {
-            vm->fp = AS_INT32(vm->stack[vm->fp - 2]);
-        }
-        vm->sp = vm->fp;
+        obj = COPY_VAL(obj);
+        AS_STRING(obj)[idx] = (char)AS_INT32(val);
+        REGISTER(obj);
+        DISPATCH();
+    }
+    code_slen: {
+        // Strings are zero-terminated, they keep no length
+        tos = INT32_VAL(strlen(AS_STRING(tos)));
+        DISPATCH();
+    }
+    code_sappend: {
+        // Simple string concatenation
+        val_t val = POP();
+        char* str1 = AS_STRING(POP());
+        char* str2 = AS_STRING(val);
+        size_t len1 = strlen(str1);
+        size_t len2 = strlen(str2);
+        char* data = malloc(sizeof(char) * (len1 + len2 + 1));
+        memcpy(data, str1, len1);
+        memcpy(data + len1, str2, len2 + 1);
 
-        val_t val = vm->stack[vm->fp+offset];
-        vm->sp = sp;
-        vm->fp = fp;
+        obj_t* obj_ptr = obj_string_nocopy_new(data);
+        PUSH(OBJ_VAL(obj_ptr));
+        SYNC();
+        obj_append(vm, obj_ptr);
+        DISPATCH();
+    }
+    code_scons: {
+        // Allocate len + 2 => one for the char and one for the trailing zero
+        val_t val = POP();
+        char* str = AS_STRING(POP());
+        size_t len = strlen(str);
+        char* newStr = malloc(sizeof(char) * (len+2));
+        memcpy(newStr, str, len);
+        newStr[len] = (char)AS_INT32(val);
+        newStr[len+1] = '\0';
 
-        vm_copy(vm, val);
+        obj_t* obj_ptr = obj_string_nocopy_new(newStr);
+        PUSH(OBJ_VAL(obj_ptr));
+        SYNC();
+        obj_append(vm, obj_ptr);
+        DISPATCH();
+    }
+    code_upval: {
+        // Frame of the enclosing function at level a
+        COPY(stack[vm->display[instr->a] + instr->b]);
         DISPATCH();
     }
     code_upstore: {
-        val_t newVal = vm_pop(vm);
-
-        int scopes = AS_INT32(instr->v1);
-        int offset = AS_INT32(instr->v2);
-
-        int fp = vm->fp;
-        int sp = vm->sp;
-
-        for(int i = 0; i < scopes; i++) {
-            vm->fp = AS_INT32(vm->stack[vm->fp - 2]);
-        }
-        vm->sp = vm->fp;
-        vm->stack[vm->fp+offset] = newVal;
-
-        vm->sp = sp;
-        vm->fp = fp;
+        stack[vm->display[instr->a] + instr->b] = POP();
+        FILL();
         DISPATCH();
     }
     code_class: {
-        obj_t* obj = obj_class_new(AS_INT32(instr->v1));
-        vm_push(vm, OBJ_VAL(obj));
+        obj_t* obj = obj_class_new(instr->a);
+        PUSH(OBJ_VAL(obj));
+        SYNC();
         obj_append(vm, obj);
         DISPATCH();
     }
@@ -960,29 +1373,387 @@ void vm_exec(vm_t* vm, vector_t* buffer) {
         // value
         // class
 
-        int index = AS_INT32(instr->v1);
-        val_t val = vm_pop(vm);
-        val_t class = vm_pop(vm);
+        int index = instr->a;
+        val_t val = POP();
 
-        obj_class_t* cls = AS_CLASS(class);
+        obj_class_t* cls = AS_CLASS(tos);
+        VM_ASSERT((unsigned int)index < cls->field_count, "Field out of range");
         cls->fields[index] = val;
-
-        vm_push(vm, class);
         DISPATCH();
     }
     code_getfield: {
         // Copy val to keep class internal value alive
-        int index = AS_INT32(instr->v1);
-        val_t class = vm_pop(vm);
+        int index = instr->a;
+        val_t class = POP();
 
         obj_class_t* cls = AS_CLASS(class);
+        VM_ASSERT((unsigned int)index < cls->field_count, "Field out of range");
         val_t val = cls->fields[index];
 
         // Old, slow version
         // val = COPY_VAL(val); // <--
         // vm_register(vm, val);
 
-        vm_copy(vm, val);
+        COPY(val);
+        DISPATCH();
+    }
+    code_iaddlk: {
+        // load x; push k; iadd
+        int v1 = AS_INT32(stack[fp+instr->a]);
+        PUSH(INT32_VAL(v1 + instr->b));
+        DISPATCH();
+    }
+    code_isublk: {
+        // load x; push k; isub
+        int v1 = AS_INT32(stack[fp+instr->a]);
+        PUSH(INT32_VAL(v1 - instr->b));
+        DISPATCH();
+    }
+    code_iltlk: {
+        // load x; push k; ilt
+        int v1 = AS_INT32(stack[fp+instr->a]);
+        PUSH(BOOL_VAL(v1 < instr->b));
+        DISPATCH();
+    }
+    code_load2: {
+        COPY(stack[fp+instr->a]);
+        COPY(stack[fp+instr->b]);
+        DISPATCH();
+    }
+    code_ldfield: {
+        // ldarg0; getfield x
+        // The class itself does not need to be copied
+        obj_class_t* cls = AS_CLASS(stack[frame->receiver]);
+        VM_ASSERT((unsigned int)instr->a < cls->field_count, "Field out of range");
+        COPY(cls->fields[instr->a]);
+        DISPATCH();
+    }
+    code_storejmp: {
+        stack[fp+instr->b] = POP();
+        FILL();
+        if(instr->a < pc) TIER_LOOP();
+        pc = instr->a;
+        DISPATCH();
+    }
+    code_jieq: {
+        int v2 = AS_INT32(POP());
+        int v1 = AS_INT32(POP());
+        if(!(v1 == v2)) {
+            pc = instr->a;
+        }
+        DISPATCH();
+    }
+    code_jine: {
+        int v2 = AS_INT32(POP());
+        int v1 = AS_INT32(POP());
+        if(!(v1 != v2)) {
+            pc = instr->a;
+        }
+        DISPATCH();
+    }
+    code_jilt: {
+        int v2 = AS_INT32(POP());
+        int v1 = AS_INT32(POP());
+        if(!(v1 < v2)) {
+            pc = instr->a;
+        }
+        DISPATCH();
+    }
+    code_jigt: {
+        int v2 = AS_INT32(POP());
+        int v1 = AS_INT32(POP());
+        if(!(v1 > v2)) {
+            pc = instr->a;
+        }
+        DISPATCH();
+    }
+    code_jile: {
+        int v2 = AS_INT32(POP());
+        int v1 = AS_INT32(POP());
+        if(!(v1 <= v2)) {
+            pc = instr->a;
+        }
+        DISPATCH();
+    }
+    code_jige: {
+        int v2 = AS_INT32(POP());
+        int v1 = AS_INT32(POP());
+        if(!(v1 >= v2)) {
+            pc = instr->a;
+        }
+        DISPATCH();
+    }
+    code_jfeq: {
+        double v2 = AS_NUM(POP());
+        double v1 = AS_NUM(POP());
+        if(!(v1 == v2)) {
+            pc = instr->a;
+        }
+        DISPATCH();
+    }
+    code_jfne: {
+        double v2 = AS_NUM(POP());
+        double v1 = AS_NUM(POP());
+        if(!(v1 != v2)) {
+            pc = instr->a;
+        }
+        DISPATCH();
+    }
+    code_jflt: {
+        double v2 = AS_NUM(POP());
+        double v1 = AS_NUM(POP());
+        if(!(v1 < v2)) {
+            pc = instr->a;
+        }
+        DISPATCH();
+    }
+    code_jfgt: {
+        double v2 = AS_NUM(POP());
+        double v1 = AS_NUM(POP());
+        if(!(v1 > v2)) {
+            pc = instr->a;
+        }
+        DISPATCH();
+    }
+    code_jfle: {
+        double v2 = AS_NUM(POP());
+        double v1 = AS_NUM(POP());
+        if(!(v1 <= v2)) {
+            pc = instr->a;
+        }
+        DISPATCH();
+    }
+    code_jfge: {
+        double v2 = AS_NUM(POP());
+        double v1 = AS_NUM(POP());
+        if(!(v1 >= v2)) {
+            pc = instr->a;
+        }
+        DISPATCH();
+    }
+    code_jieqk: {
+        int v1 = AS_INT32(POP());
+        if(!(v1 == instr->b)) {
+            pc = instr->a;
+        }
+        DISPATCH();
+    }
+    code_jinek: {
+        int v1 = AS_INT32(POP());
+        if(!(v1 != instr->b)) {
+            pc = instr->a;
+        }
+        DISPATCH();
+    }
+    code_jiltk: {
+        int v1 = AS_INT32(POP());
+        if(!(v1 < instr->b)) {
+            pc = instr->a;
+        }
+        DISPATCH();
+    }
+    code_jigtk: {
+        int v1 = AS_INT32(POP());
+        if(!(v1 > instr->b)) {
+            pc = instr->a;
+        }
+        DISPATCH();
+    }
+    code_jilek: {
+        int v1 = AS_INT32(POP());
+        if(!(v1 <= instr->b)) {
+            pc = instr->a;
+        }
+        DISPATCH();
+    }
+    code_jigek: {
+        int v1 = AS_INT32(POP());
+        if(!(v1 >= instr->b)) {
+            pc = instr->a;
+        }
+        DISPATCH();
+    }
+    code_incl: {
+        // x := x + k
+        SPILL();
+        val_t* slot = &stack[fp+instr->a];
+        *slot = INT32_VAL(AS_INT32(*slot) + instr->b);
+        FILL();
+        DISPATCH();
+    }
+    code_ginc: {
+        SPILL();
+        val_t* slot = &stack[instr->a];
+        *slot = INT32_VAL(AS_INT32(*slot) + instr->b);
+        FILL();
+        DISPATCH();
+    }
+    code_addl: {
+        // x := x + y
+        SPILL();
+        val_t* slot = &stack[fp+instr->a];
+        *slot = INT32_VAL(AS_INT32(*slot) + AS_INT32(stack[fp+instr->b]));
+        FILL();
+        DISPATCH();
+    }
+    code_jieqlk: {
+        int v1 = AS_INT32(stack[fp+SLOT_OF(instr->b)]);
+        if(!(v1 == IMM_OF(instr->b))) {
+            pc = instr->a;
+        }
+        DISPATCH();
+    }
+    code_jinelk: {
+        int v1 = AS_INT32(stack[fp+SLOT_OF(instr->b)]);
+        if(!(v1 != IMM_OF(instr->b))) {
+            pc = instr->a;
+        }
+        DISPATCH();
+    }
+    code_jiltlk: {
+        int v1 = AS_INT32(stack[fp+SLOT_OF(instr->b)]);
+        if(!(v1 < IMM_OF(instr->b))) {
+            pc = instr->a;
+        }
+        DISPATCH();
+    }
+    code_jigtlk: {
+        int v1 = AS_INT32(stack[fp+SLOT_OF(instr->b)]);
+        if(!(v1 > IMM_OF(instr->b))) {
+            pc = instr->a;
+        }
+        DISPATCH();
+    }
+    code_jilelk: {
+        int v1 = AS_INT32(stack[fp+SLOT_OF(instr->b)]);
+        if(!(v1 <= IMM_OF(instr->b))) {
+            pc = instr->a;
+        }
+        DISPATCH();
+    }
+    code_jigelk: {
+        int v1 = AS_INT32(stack[fp+SLOT_OF(instr->b)]);
+        if(!(v1 >= IMM_OF(instr->b))) {
+            pc = instr->a;
+        }
+        DISPATCH();
+    }
+    code_forl: {
+        // i := i + 1, jump back to the body while i < limit (the next slot)
+        SPILL();
+        val_t* slot = &stack[fp+instr->b];
+        int i = AS_INT32(slot[0]) + 1;
+        slot[0] = INT32_VAL(i);
+        if(i < AS_INT32(slot[1])) {
+            TIER_LOOP();
+            pc = instr->a;
+        }
+        FILL();
+        DISPATCH();
+    }
+    code_forin: {
+        // Slots: array, index, element.
+        // The element is not copied, arrays are never changed in place.
+        SPILL();
+        val_t* slot = &stack[fp+instr->b];
+        obj_array_t* arr = AS_ARRAY(slot[0]);
+        int i = AS_INT32(slot[1]) + 1;
+        slot[1] = INT32_VAL(i);
+        if(i < (int)arr->len) {
+            slot[2] = arr->data[i];
+            TIER_LOOP();
+            pc = instr->a;
+        }
+        FILL();
+        DISPATCH();
+    }
+    code_switch: {
+        // The entries follow (pc), keys out of range take the last one
+        uint32_t key = (uint32_t)AS_INT32(POP()) - (uint32_t)instr->a;
+        if(key > (uint32_t)instr->b) key = instr->b;
+        pc = code[pc + key].a;
+        DISPATCH();
+    }
+    code_case: {
+        pc = instr->a;
+        DISPATCH();
+    }
+    code_tailcall: {
+        // invoke; ret
+        // Replaces the current frame by the frame of the callee,
+        // the saved fp and pc are reused.
+        int args = TAIL_ARGS(instr->b);
+        int mode = instr->b;
+        int count = (mode & TAIL_CALLEE_VIRTUAL) ? args + 1 : args;
+
+        // Arg0 of the current frame, or its receiver
+        int dest = frame->receiver + 1;
+        if(mode & TAIL_SELF_VIRTUAL) dest--;
+
+        // The caller expects the class of this method to be returned:
+        // keep it below the new frame and mark the frame.
+        // If marked already, the kept class is used.
+        if((mode & TAIL_KEEP) && !frame->keep) {
+            dest++;
+            frame->keep = true;
+        }
+
+#ifndef NO_TIER
+        if(--hot[instr->a] == 0) TIER_UP(instr->a);
+#endif
+        ENTER(dest + count, maxDepth[instr->a]);
+        if(frame->level) {
+            vm->display[frame->level] = frame->saved;
+            frame->level = 0;
+        }
+
+        // Move the arguments down
+        SPILL();
+        int src = sp - count;
+        for(int i = 0; i < count; i++) {
+            stack[dest+i] = stack[src+i];
+        }
+        sp = dest + count;
+        FILL();
+
+        frame->receiver = sp - args - 1;
+        fp = sp;
+        pc = instr->a;
+        DISPATCH();
+    }
+    code_enter: {
+        // The current frame becomes the display entry of level a,
+        // the previous entry is restored on return
+        frame->level = instr->a;
+        frame->saved = vm->display[instr->a];
+        vm->display[instr->a] = fp;
+        DISPATCH();
+    }
+    code_borrow: {
+        // The receiver of a method call is the object of the variable itself,
+        // the method changes it in place (see stfield)
+        PUSH(stack[fp+instr->a]);
+        DISPATCH();
+    }
+    code_gborrow: {
+        PUSH(stack[instr->a]);
+        DISPATCH();
+    }
+    code_borrow0: {
+        PUSH(stack[frame->receiver]);
+        DISPATCH();
+    }
+    code_stfield: {
+        // ldarg0; <value>; setfield x; setarg0 without the copy of the class
+        obj_class_t* cls = AS_CLASS(stack[frame->receiver]);
+        VM_ASSERT((unsigned int)instr->a < cls->field_count, "Field out of range");
+        cls->fields[instr->a] = POP();
+        DISPATCH();
+    }
+    code_catch: {
+        // Entered by vm_unwind only
+        PUSH(vm->exception);
+        vm->exception = NULL_VAL;
         DISPATCH();
     }
 }
@@ -992,30 +1763,83 @@ void vm_exec(vm_t* vm, vector_t* buffer) {
 // => clears all elements by GC.
 void vm_clear(vm_t* vm) {
     vm->sp = 0;
+    vm->depth = 0;
     vm_gc(vm);
     vm->argc = 0;
     vm->argv = 0;
 }
 
-void vm_run(vm_t* vm, vector_t* buffer) {
-    vm_run_args(vm, buffer, 0, 0);
+// Replaces each opcode in the code stream by its handler address
+void vm_thread(bytecode_t* bytecode) {
+    if(!handlers) vm_exec(0, 0);
+
+    for(size_t i = 0; i < bytecode->size; i++) {
+        code_t* code = &bytecode->code[i];
+        code->handler = handlers[code->op];
+    }
 }
 
-// Execute a buffer
-void vm_run_args(vm_t* vm, vector_t* buffer, int argc, char** argv) {
+// Restores the opcodes of a threaded code stream
+void vm_unthread(bytecode_t* bytecode) {
+    for(size_t i = 0; i < bytecode->size; i++) {
+        code_t* code = &bytecode->code[i];
+        for(size_t op = 0; op < handler_count; op++) {
+            if(code->handler == handlers[op]) {
+                code->op = op;
+                break;
+            }
+        }
+    }
+}
+
+void vm_run(vm_t* vm, bytecode_t* bytecode) {
+    vm_run_args(vm, bytecode, 0, 0);
+}
+
+// Execute a loaded buffer
+void vm_run_args(vm_t* vm, bytecode_t* bytecode, int argc, char** argv) {
     vm->argc = argc;
     vm->argv = argv;
     vm->maxObjects = 8;
 
 #ifndef NO_IR
     // Print out bytecodes
-    vm_print_code(vm, buffer);
+    vm_print_code(vm, bytecode);
     printf("\nExecution:\n");
 #endif
 
+    if(!bytecode->frame) {
+        vm_throw(vm, "Invalid bytecode: %s", bytecode->error);
+        return;
+    }
+
     // Run
 #ifndef NO_EXEC
-    vm_exec(vm, buffer);
+#ifdef JIT
+    vm->jit = jit_new(bytecode);
+#endif
+#ifndef NO_TIER
+    vm->tier = tier_new(bytecode);
+#endif
+#ifndef NO_THREADED
+    vm_thread(bytecode);
+    vm_exec(vm, bytecode);
+    vm_unthread(bytecode);
+#else
+    vm_exec(vm, bytecode);
+#endif
+#ifdef JIT
+    jit_free(vm->jit);
+    vm->jit = 0;
+#endif
+#ifndef NO_TIER
+    tier_free(vm->tier);
+    vm->tier = 0;
+#endif
+#endif
+
+#ifdef PROFILE
+    vm_profile_print();
 #endif
 
     vm_clear(vm);
@@ -22,28 +22,80 @@
 #include "../lib/libdef.h"
 #include "../lib/native.h"
 
-#define STACK_SIZE 512
+// Initial sizes of the value stack and the frame stack,
+// both grow on demand up to the stack limit of the VM
+#define STACK_SIZE 256
+#define FRAME_SIZE 32
+#define STACK_LIMIT 65536
+
+// Hot functions are re-optimized at runtime (see tier.h), unless built with -DNO_TIER.
+// The JIT compiles them to native code instead.
+#if defined(JIT) && !defined(NO_TIER)
+#define NO_TIER
+#endif
+
+/**
+ * frame_t - call frame
+ *
+ * Kept apart from the value stack, so the stack only holds values.
+ *
+ * @pc Return address
+ * @fp Frame pointer of the caller
+ * @receiver Slot below the arguments, holds the class of a method
+ * @keep Tail called from a method, its class is kept below the receiver
+ * @level Display level set by enter, 0 if none
+ * @saved Previous display entry of that level
+ */
+typedef struct {
+	int pc;
+	int fp;
+	int receiver;
+	bool keep;
+	int level;
+	int saved;
+} frame_t;
 
 /**
  * vm_t - VM definition
  *
- * @stack General purpose Stack / RAM
+ * @slots Guard slot and stack memory
+ * @stack General purpose Stack / RAM, starts after the guard slot
+ * @stackSize Allocated stack slots
+ * @stackLimit Maximum number of stack slots and call frames
  * @pc Program counter
  * @fp Frame pointer
  * @sp Stack pointer
+ * @frames Call frames, the first one belongs to the toplevel code
+ * @frameSize Allocated call frames
+ * @depth Index of the current call frame
+ * @display Frame pointer of the active function of every nesting level
  * @firstVal Current reference for GC
  * @numObject Counted objects by GC
  * @maxObjects Count of objects when GC is triggered
  * @errjmp Jump position when failure occurs.
+ * @exception Thrown exception, until it is caught (NULL_VAL otherwise)
  * @argc Argument count
  * @argc Arguments
+ * @jit Native code, if built with -DJIT
+ * @tier Counters of the second tier, unless built with -DNO_TIER
  */
 typedef struct {
 	// Stack
-	val_t stack[STACK_SIZE];
+	// The guard slot below the stack takes the cached top
+	// of an empty stack in vm_exec.
+	// Stack and frames are reallocated when they grow,
+	// so they are addressed by index (pc, fp, sp, depth).
+	val_t* slots;
+	val_t* stack;
+	int stackSize;
+	int stackLimit;
 	int pc;
 	int fp;
 	int sp;
+	frame_t* frames;
+	int frameSize;
+	int depth;
+	int display[DISPLAY_SIZE];
 
 	// Gargabe collection
 	obj_t* firstVal;
@@ -51,20 +103,45 @@ typedef struct {
 	int maxObjects;
 
 	int errjmp;
+	val_t exception;
 	int argc;
 	char** argv;
+
+#ifdef JIT
+	// Native code of hot functions (see jit.h)
+	struct jit_t* jit;
+#endif
+#ifndef NO_TIER
+	// Re-optimization of hot functions (see tier.h)
+	struct tier_t* tier;
+#endif
 } vm_t;
 
 // Internal function
 typedef void (*gvm_c_function)(vm_t*);
 
 // Methods
-void vm_run(vm_t* vm, vector_t* buffer);
-void vm_run_args(vm_t* vm, vector_t* buffer, int argc, char** argv);
+void vm_init(vm_t* vm, int stackLimit);
+void vm_free(vm_t* vm);
+void vm_run(vm_t* vm, bytecode_t* bytecode);
+void vm_run_args(vm_t* vm, bytecode_t* bytecode, int argc, char** argv);
 
 void vm_register(vm_t* vm, val_t val);
 void vm_push(vm_t* vm, val_t val);
 val_t vm_pop(vm_t* vm);
 void vm_gc(vm_t* vm);
 
+// Shared with the register VM and the JIT (see regvm.h, jit.h)
+void vm_throw(vm_t* vm, const char* format, ...);
+void vm_raise(vm_t* vm, const char* format, ...);
+void vm_uncaught(vm_t* vm);
+bool vm_unwind(vm_t* vm, bytecode_t* bytecode);
+void vm_clear(vm_t* vm);
+void vm_syscall(vm_t* vm, int index);
+void vm_copy(vm_t* vm, val_t val);
+bool vm_grow_stack(vm_t* vm, int size);
+bool vm_grow_frames(vm_t* vm);
+void obj_append(vm_t* vm, obj_t* obj);
+void val_append(vm_t* vm, val_t v1);
+
 #endif